@@ -4,6 +4,7 @@
 #include "device.h"
 #include "cdev.h"
 #include "ioctl.h"
+#include "dmabuf_exp.h"
 #include "uapi/qdmabuf.h"
 
 #include <linux/platform_device.h>
@@ -174,8 +175,25 @@ static int __device_start(struct qdmabuf_device* self) {
 		goto err0;
 	}
 
+	err = qdmabuf_dmabuf_carveout_init(&self->pdev->dev, &self->carveout);
+	if(err) {
+		pr_err("qdmabuf_dmabuf_carveout_init() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	err = dmabuf_exp_stats_init(&self->pdev->dev);
+	if(err) {
+		pr_err("dmabuf_exp_stats_init() failed, err=%d\n", err);
+		goto err2;
+	}
+
 	return 0;
 
+err2:
+	qdmabuf_dmabuf_carveout_uninit(self->carveout);
+	self->carveout = NULL;
+err1:
+	qdmabuf_cdev_stop(&self->cdev);
 err0:
 	return err;
 }
@@ -183,6 +201,9 @@ err0:
 static void __device_stop(struct qdmabuf_device* self) {
 	// pr_info("\n");
 
+	dmabuf_exp_stats_uninit(&self->pdev->dev);
+	qdmabuf_dmabuf_carveout_uninit(self->carveout);
+	self->carveout = NULL;
 	qdmabuf_cdev_stop(&self->cdev);
 }
 
@@ -192,13 +213,26 @@ static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg
 
 	switch(cmd) {
 	case QDMABUF_IOCTL_ALLOC:
-		ret = qdmabuf_ioctl_alloc(device, arg);
+	case QDMABUF_IOCTL_ALLOC_EXT:
+		ret = qdmabuf_ioctl_alloc(device, cmd, arg);
 		break;
 
 	case QDMABUF_IOCTL_INFO:
 		ret = qdmabuf_ioctl_info(device, arg);
 		break;
 
+	case QDMABUF_IOCTL_QUERY_SEGS:
+		ret = qdmabuf_ioctl_query_segs(device, arg);
+		break;
+
+	case QDMABUF_IOCTL_SYNC:
+		ret = qdmabuf_ioctl_sync(device, arg);
+		break;
+
+	case QDMABUF_IOCTL_IMPORT:
+		ret = qdmabuf_ioctl_import(device, arg);
+		break;
+
 	default:
 		ret = -EINVAL;
 		break;
@@ -5,12 +5,17 @@
 
 #define QDMABUF_DRIVER_NAME "qdmabuf"
 
+struct exp_carveout_region;
+
 struct qdmabuf_device {
 	struct kref ref;
 	struct platform_device* pdev;
 
 	// cdev
 	struct qdmabuf_cdev cdev;
+
+	// reserved memory of QDMABUF_TYPE_CARVEOUT, NULL if none
+	struct exp_carveout_region* carveout;
 };
 
 int qdmabuf_device_register(void);
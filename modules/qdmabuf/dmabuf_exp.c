@@ -2,6 +2,15 @@
 
 #include "dmabuf_exp.h"
 
+#include <linux/slab.h>
+#include <linux/dma-mapping.h>
+#include <linux/device.h>
+#include <linux/nodemask.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
 static void dmabuf_exp_vm_open(struct vm_area_struct *vma)
 {
 	struct dmabuf_exp_vmarea_handler *h = vma->vm_private_data;
@@ -28,3 +37,377 @@ const struct vm_operations_struct dmabuf_exp_vm_ops = {
 	.open = dmabuf_exp_vm_open,
 	.close = dmabuf_exp_vm_close,
 };
+
+int dmabuf_exp_segs_init(struct dmabuf_exp_segs *segs, dma_addr_t dma_addr, size_t len) {
+	segs->segs = kmalloc(sizeof(*segs->segs), GFP_KERNEL);
+	if (!segs->segs) {
+		pr_err("kmalloc() failed\n");
+		return -ENOMEM;
+	}
+
+	segs->segs[0].dma_addr = dma_addr;
+	segs->segs[0].len = len;
+	segs->nsegs = 1;
+
+	return 0;
+}
+
+int dmabuf_exp_segs_init_sgt(struct dmabuf_exp_segs *segs, struct sg_table *sgt) {
+	struct scatterlist *sg;
+	struct qdmabuf_seg *seg;
+	unsigned int nsegs = 0;
+	int i;
+
+	segs->segs = kvmalloc_array(sgt->nents, sizeof(*segs->segs), GFP_KERNEL);
+	if (!segs->segs) {
+		pr_err("kvmalloc_array() failed\n");
+		return -ENOMEM;
+	}
+
+	/* merge entries the IOMMU (or the allocator) made adjacent */
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		dma_addr_t dma_addr = sg_dma_address(sg);
+		unsigned int len = sg_dma_len(sg);
+
+		if (!len)
+			continue;
+
+		if (nsegs) {
+			seg = &segs->segs[nsegs - 1];
+			if (seg->dma_addr + seg->len == dma_addr) {
+				seg->len += len;
+				continue;
+			}
+		}
+
+		seg = &segs->segs[nsegs++];
+		seg->dma_addr = dma_addr;
+		seg->len = len;
+	}
+	segs->nsegs = nsegs;
+
+	return 0;
+}
+
+void dmabuf_exp_segs_free(struct dmabuf_exp_segs *segs) {
+	kvfree(segs->segs);
+	segs->segs = NULL;
+	segs->nsegs = 0;
+}
+
+int dmabuf_exp_get_segs(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	int err;
+
+	err = qdmabuf_dmabuf_segs_dma_contig(dmabuf, segs);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_segs_dma_sg(dmabuf, segs);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_segs_vmalloc(dmabuf, segs);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_segs_carveout(dmabuf, segs);
+	if (err != -ENOTTY)
+		return err;
+
+	return qdmabuf_dmabuf_segs_user(dmabuf, segs);
+}
+
+static void dmabuf_exp_sync_sg(struct device *dev, struct scatterlist *sgl, int nents,
+	enum dma_data_direction dma_dir, bool for_cpu) {
+	if (for_cpu)
+		dma_sync_sg_for_cpu(dev, sgl, nents, dma_dir);
+	else
+		dma_sync_sg_for_device(dev, sgl, nents, dma_dir);
+}
+
+void dmabuf_exp_sync_sgt_range(struct device *dev, struct sg_table *sgt, enum dma_data_direction dma_dir,
+	unsigned long offset, unsigned long len, bool for_cpu) {
+	struct scatterlist *sg;
+	struct scatterlist part;
+	unsigned long pos = 0;
+	unsigned long start = round_down(offset, PAGE_SIZE);
+	unsigned long end = PAGE_ALIGN(offset + len);
+	unsigned long first, last;
+	int i;
+
+	/* entries merged by an IOMMU have no DMA address of their own to cut from */
+	if (sgt->nents != sgt->orig_nents) {
+		dmabuf_exp_sync_sg(dev, sgt->sgl, sgt->orig_nents, dma_dir, for_cpu);
+		return;
+	}
+
+	/*
+	 * An entry can span many MB of high order pages and a partial list of
+	 * the mapped table must not be synced, so every entry overlapping the
+	 * range is cut down to the overlapping pages in a one entry table.
+	 */
+	for_each_sg(sgt->sgl, sg, sgt->orig_nents, i) {
+		if (pos >= end)
+			break;
+
+		if (pos + sg->length > start) {
+			first = max(start, pos) - pos;
+			last = min(end, pos + sg->length) - pos;
+
+			sg_init_table(&part, 1);
+			sg_set_page(&part, sg_page(sg), last - first, sg->offset + first);
+			sg_dma_address(&part) = sg_dma_address(sg) + first;
+			sg_dma_len(&part) = last - first;
+#ifdef CONFIG_NEED_SG_DMA_FLAGS
+			part.dma_flags = sg->dma_flags;
+#endif
+
+			dmabuf_exp_sync_sg(dev, &part, 1, dma_dir, for_cpu);
+		}
+
+		pos += sg->length;
+	}
+}
+
+int dmabuf_exp_sync_range(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	int err;
+
+	err = qdmabuf_dmabuf_sync_dma_contig(dmabuf, offset, len, for_cpu);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_sync_dma_sg(dmabuf, offset, len, for_cpu);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_sync_vmalloc(dmabuf, offset, len, for_cpu);
+	if (err != -ENOTTY)
+		return err;
+
+	err = qdmabuf_dmabuf_sync_carveout(dmabuf, offset, len, for_cpu);
+	if (err != -ENOTTY)
+		return err;
+
+	return qdmabuf_dmabuf_sync_user(dmabuf, offset, len, for_cpu);
+}
+
+/*
+ * Bytes held by exported buffers, per NUMA node of the backing pages, so
+ * placement can be checked against the device's node.
+ */
+static atomic_long_t __node_bytes[MAX_NUMNODES];
+
+void dmabuf_exp_node_stats_add(struct page *page, unsigned long bytes) {
+	if (page)
+		atomic_long_add(bytes, &__node_bytes[page_to_nid(page)]);
+}
+
+void dmabuf_exp_node_stats_sub(struct page *page, unsigned long bytes) {
+	if (page)
+		atomic_long_sub(bytes, &__node_bytes[page_to_nid(page)]);
+}
+
+static ssize_t node_stats_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	ssize_t ret = 0;
+	int nid;
+
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "device_node=%d\n", dev_to_node(dev));
+	for_each_online_node(nid) {
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "node%d=%ld\n",
+			nid, atomic_long_read(&__node_bytes[nid]));
+	}
+
+	return ret;
+}
+
+static DEVICE_ATTR(node_stats, 0444, node_stats_show, NULL);
+
+/*
+ * Allocation latency is binned in power-of-2 microseconds, the last bin
+ * collects everything at or above 2^(DMABUF_EXP_LAT_BINS - 2) us.
+ */
+#define DMABUF_EXP_LAT_BINS		20
+
+struct dmabuf_exp_type_stats {
+	unsigned long live_buffers;
+	unsigned long live_bytes;
+	unsigned long peak_bytes;
+	unsigned long allocs;
+	unsigned long fails;
+	unsigned long lat_bins[DMABUF_EXP_LAT_BINS];
+};
+
+static const char* __type_names[DMABUF_EXP_TYPE_MAX] = {
+	[QDMABUF_TYPE_DMA_CONTIG] = "dma-contig",
+	[QDMABUF_TYPE_DMA_SG] = "dma-sg",
+	[QDMABUF_TYPE_VMALLOC] = "vmalloc",
+	[QDMABUF_TYPE_CARVEOUT] = "carveout",
+	[DMABUF_EXP_TYPE_USER] = "user",
+};
+
+static DEFINE_MUTEX(__stats_lock);
+static struct dmabuf_exp_type_stats __type_stats[DMABUF_EXP_TYPE_MAX];
+static LIST_HEAD(__stats_bufs);
+static struct dentry *__debugfs_root;
+
+void dmabuf_exp_stats_alloc_done(int type, ktime_t start, int ret) {
+	struct dmabuf_exp_type_stats *stats;
+	s64 us;
+	int bin;
+
+	if (type < 0 || type >= DMABUF_EXP_TYPE_MAX)
+		return;
+
+	stats = &__type_stats[type];
+	us = ktime_us_delta(ktime_get(), start);
+	bin = (us > 0) ? min(fls64(us), DMABUF_EXP_LAT_BINS - 1) : 0;
+
+	mutex_lock(&__stats_lock);
+	if (ret < 0) {
+		stats->fails++;
+	} else {
+		stats->allocs++;
+		stats->lat_bins[bin]++;
+	}
+	mutex_unlock(&__stats_lock);
+}
+
+void dmabuf_exp_stats_buf_add(struct dmabuf_exp_stats_buf *sbuf, int type, unsigned long size) {
+	struct dmabuf_exp_type_stats *stats = &__type_stats[type];
+
+	INIT_LIST_HEAD(&sbuf->attachments);
+	sbuf->type = type;
+	sbuf->size = size;
+	sbuf->pid = task_tgid_nr(current);
+	get_task_comm(sbuf->comm, current);
+
+	mutex_lock(&__stats_lock);
+	list_add_tail(&sbuf->node, &__stats_bufs);
+	stats->live_buffers++;
+	stats->live_bytes += size;
+	if (stats->peak_bytes < stats->live_bytes)
+		stats->peak_bytes = stats->live_bytes;
+	mutex_unlock(&__stats_lock);
+}
+
+void dmabuf_exp_stats_buf_del(struct dmabuf_exp_stats_buf *sbuf) {
+	struct dmabuf_exp_type_stats *stats = &__type_stats[sbuf->type];
+
+	mutex_lock(&__stats_lock);
+	list_del(&sbuf->node);
+	stats->live_buffers--;
+	stats->live_bytes -= sbuf->size;
+	mutex_unlock(&__stats_lock);
+}
+
+void dmabuf_exp_stats_attach(struct dmabuf_exp_stats_buf *sbuf, struct dmabuf_exp_stats_attach *sattach,
+	struct device *dev, const enum dma_data_direction *dma_dir) {
+	sattach->dev = dev;
+	sattach->dma_dir = dma_dir;
+
+	mutex_lock(&__stats_lock);
+	list_add_tail(&sattach->node, &sbuf->attachments);
+	mutex_unlock(&__stats_lock);
+}
+
+void dmabuf_exp_stats_detach(struct dmabuf_exp_stats_attach *sattach) {
+	mutex_lock(&__stats_lock);
+	list_del(&sattach->node);
+	mutex_unlock(&__stats_lock);
+}
+
+static ssize_t alloc_stats_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct dmabuf_exp_type_stats *stats;
+	ssize_t ret = 0;
+	int type;
+	int i;
+
+	mutex_lock(&__stats_lock);
+	for (type = 0; type < DMABUF_EXP_TYPE_MAX; type++) {
+		stats = &__type_stats[type];
+
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+			"%s buffers=%lu bytes=%lu peak=%lu allocs=%lu fails=%lu lat_us=",
+			__type_names[type], stats->live_buffers, stats->live_bytes,
+			stats->peak_bytes, stats->allocs, stats->fails);
+		for (i = 0; i < DMABUF_EXP_LAT_BINS; i++) {
+			ret += scnprintf(buf + ret, PAGE_SIZE - ret, "%s%lu",
+				i ? "," : "", stats->lat_bins[i]);
+		}
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "\n");
+	}
+	mutex_unlock(&__stats_lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR(alloc_stats, 0444, alloc_stats_show, NULL);
+
+static int buffers_show(struct seq_file *s, void *unused) {
+	struct dmabuf_exp_stats_buf *sbuf;
+	struct dmabuf_exp_stats_attach *sattach;
+	int attachments;
+	int mapped;
+
+	seq_printf(s, "%-10s %12s %8s %-16s %6s %6s devices\n",
+		"type", "size", "pid", "comm", "attach", "mapped");
+
+	mutex_lock(&__stats_lock);
+	list_for_each_entry(sbuf, &__stats_bufs, node) {
+		attachments = 0;
+		mapped = 0;
+		list_for_each_entry(sattach, &sbuf->attachments, node) {
+			attachments++;
+			if (READ_ONCE(*sattach->dma_dir) != DMA_NONE)
+				mapped++;
+		}
+
+		seq_printf(s, "%-10s %12lu %8d %-16s %6d %6d",
+			__type_names[sbuf->type], sbuf->size, sbuf->pid, sbuf->comm,
+			attachments, mapped);
+		list_for_each_entry(sattach, &sbuf->attachments, node) {
+			seq_printf(s, " %s%s", dev_name(sattach->dev),
+				READ_ONCE(*sattach->dma_dir) != DMA_NONE ? "*" : "");
+		}
+		seq_puts(s, "\n");
+	}
+	mutex_unlock(&__stats_lock);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(buffers);
+
+int dmabuf_exp_stats_init(struct device* dev) {
+	int err;
+
+	err = device_create_file(dev, &dev_attr_node_stats);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	err = device_create_file(dev, &dev_attr_alloc_stats);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	/* debugfs is optional, the buffer listing is simply missing without it */
+	__debugfs_root = debugfs_create_dir(dev_name(dev), NULL);
+	debugfs_create_file("buffers", 0444, __debugfs_root, NULL, &buffers_fops);
+
+	return 0;
+
+err1:
+	device_remove_file(dev, &dev_attr_node_stats);
+err0:
+	return err;
+}
+
+void dmabuf_exp_stats_uninit(struct device* dev) {
+	debugfs_remove_recursive(__debugfs_root);
+	__debugfs_root = NULL;
+	device_remove_file(dev, &dev_attr_alloc_stats);
+	device_remove_file(dev, &dev_attr_node_stats);
+}
@@ -4,6 +4,15 @@
 #include <linux/device.h>
 #include <linux/refcount.h>
 #include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-direction.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+#include "uapi/qdmabuf.h"
+
+struct exp_carveout_region;
 
 struct dmabuf_exp_vmarea_handler {
 	refcount_t *refcount;
@@ -13,9 +22,75 @@ struct dmabuf_exp_vmarea_handler {
 
 extern const struct vm_operations_struct dmabuf_exp_vm_ops;
 
-int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags, int dma_dir);
-int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, int dma_dir);
-int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, int dma_dir);
-int qdmabuf_dmabuf_alloc_sys_heap(struct device* device, int len, int fd_flags, int dma_dir);
+/* DMA segment list cached by each exporter, see QDMABUF_IOCTL_QUERY_SEGS */
+struct dmabuf_exp_segs {
+	struct qdmabuf_seg *segs;
+	unsigned int nsegs;
+};
+
+int dmabuf_exp_segs_init(struct dmabuf_exp_segs *segs, dma_addr_t dma_addr, size_t len);
+int dmabuf_exp_segs_init_sgt(struct dmabuf_exp_segs *segs, struct sg_table *sgt);
+void dmabuf_exp_segs_free(struct dmabuf_exp_segs *segs);
+int dmabuf_exp_get_segs(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+
+/* CPU access synchronisation of [offset, offset + len), see QDMABUF_IOCTL_SYNC */
+void dmabuf_exp_sync_sgt_range(struct device *dev, struct sg_table *sgt, enum dma_data_direction dma_dir,
+	unsigned long offset, unsigned long len, bool for_cpu);
+int dmabuf_exp_sync_range(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+
+int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node);
+int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node);
+int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node);
+int qdmabuf_dmabuf_alloc_carveout(struct exp_carveout_region *region, struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node);
+int qdmabuf_dmabuf_alloc_sys_heap(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node);
+int qdmabuf_dmabuf_import_user(struct device* device, unsigned long addr, unsigned long len,
+	int memfd, unsigned int flags, int fd_flags, int dma_dir);
+
+int qdmabuf_dmabuf_segs_dma_contig(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+int qdmabuf_dmabuf_segs_dma_sg(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+int qdmabuf_dmabuf_segs_vmalloc(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+int qdmabuf_dmabuf_segs_carveout(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+int qdmabuf_dmabuf_segs_user(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs);
+
+int qdmabuf_dmabuf_sync_dma_contig(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+int qdmabuf_dmabuf_sync_dma_sg(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+int qdmabuf_dmabuf_sync_vmalloc(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+int qdmabuf_dmabuf_sync_carveout(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+int qdmabuf_dmabuf_sync_user(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu);
+
+/* per NUMA node page accounting, see the node_stats sysfs file */
+void dmabuf_exp_node_stats_add(struct page *page, unsigned long bytes);
+void dmabuf_exp_node_stats_sub(struct page *page, unsigned long bytes);
+int dmabuf_exp_stats_init(struct device* dev);
+void dmabuf_exp_stats_uninit(struct device* dev);
+
+/* per exporter type accounting and buffer listing, see alloc_stats and buffers */
+#define DMABUF_EXP_TYPE_USER		(QDMABUF_TYPE_CARVEOUT + 1)
+#define DMABUF_EXP_TYPE_MAX			(DMABUF_EXP_TYPE_USER + 1)
+
+struct dmabuf_exp_stats_buf {
+	struct list_head node;
+	struct list_head attachments;
+	int type;
+	unsigned long size;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+};
+
+struct dmabuf_exp_stats_attach {
+	struct list_head node;
+	struct device *dev;
+	const enum dma_data_direction *dma_dir;
+};
+
+void dmabuf_exp_stats_alloc_done(int type, ktime_t start, int ret);
+void dmabuf_exp_stats_buf_add(struct dmabuf_exp_stats_buf *sbuf, int type, unsigned long size);
+void dmabuf_exp_stats_buf_del(struct dmabuf_exp_stats_buf *sbuf);
+void dmabuf_exp_stats_attach(struct dmabuf_exp_stats_buf *sbuf, struct dmabuf_exp_stats_attach *sattach,
+	struct device *dev, const enum dma_data_direction *dma_dir);
+void dmabuf_exp_stats_detach(struct dmabuf_exp_stats_attach *sattach);
+
+int qdmabuf_dmabuf_carveout_init(struct device* dev, struct exp_carveout_region **region);
+void qdmabuf_dmabuf_carveout_uninit(struct exp_carveout_region *region);
 
 #endif // __QDMABUF_DMABUF_EXP_H__
\ No newline at end of file
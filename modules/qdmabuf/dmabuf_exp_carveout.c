@@ -0,0 +1,667 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include "config.h"
+#include "device.h"
+#include "dmabuf_exp.h"
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/io.h>
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/kref.h>
+
+/*
+ * Physically contiguous buffers sub-allocated from a reserved memory region,
+ * e.g. booting an x86 box with memmap=256M$0x100000000 and loading with
+ * carveout_base=0x100000000 carveout_size=0x10000000, or a reserved-memory
+ * node referenced by the "memory-region" property of the qdmabuf node.
+ *
+ * A region outside of the kernel's memory map (e.g. a "no-map" node) is
+ * never mapped cacheable, so no cache maintenance is needed. A region of
+ * ordinary RAM (pfn_valid()) is already mapped cacheable by the kernel, so
+ * its buffers are cached, DMA mapped by page and synced like the others.
+ */
+static unsigned long long carveout_base;
+module_param(carveout_base, ullong, 0444);
+MODULE_PARM_DESC(carveout_base, "physical base address of the carve-out region");
+
+static unsigned long carveout_size;
+module_param(carveout_size, ulong, 0444);
+MODULE_PARM_DESC(carveout_size, "size in bytes of the carve-out region, 0 to disable");
+
+struct exp_carveout_region {
+	struct kref ref; // of the device and of each buffer
+	struct device *dev;
+	phys_addr_t base;
+	unsigned long size;
+	void *vaddr;
+	bool cached; // RAM with struct page, see above
+
+	struct mutex lock;
+	unsigned long *bitmap;
+	unsigned long nbits;
+
+	// stats
+	unsigned long used_pages;
+	unsigned long live_buffers;
+	unsigned long allocs;
+	unsigned long fails;
+};
+
+struct exp_carveout_buffer {
+	struct exp_carveout_region *region;
+	struct device *dev;
+	void *vaddr;
+	phys_addr_t phys;
+	dma_addr_t dma_addr;
+	unsigned long size;
+	enum dma_data_direction dma_dir;
+	unsigned int flags;
+
+	struct dmabuf_exp_vmarea_handler handler;
+	refcount_t refcount;
+	struct dmabuf_exp_stats_buf stats;
+
+	struct dmabuf_exp_segs segs;
+};
+
+struct exp_carveout_attachment {
+	struct sg_table sgt;
+	enum dma_data_direction dma_dir;
+	struct dmabuf_exp_stats_attach stats;
+};
+
+static int exp_carveout_region_alloc(struct exp_carveout_region *region, unsigned long size, phys_addr_t *phys) {
+	unsigned long npages = size >> PAGE_SHIFT;
+	unsigned long start;
+	int ret = 0;
+
+	mutex_lock(&region->lock);
+	start = bitmap_find_next_zero_area(region->bitmap, region->nbits, 0, npages, 0);
+	if (start >= region->nbits) {
+		region->fails++;
+		ret = -ENOMEM;
+	} else {
+		bitmap_set(region->bitmap, start, npages);
+		region->used_pages += npages;
+		region->live_buffers++;
+		region->allocs++;
+		*phys = region->base + ((phys_addr_t)start << PAGE_SHIFT);
+	}
+	mutex_unlock(&region->lock);
+
+	return ret;
+}
+
+static void exp_carveout_region_free(struct exp_carveout_region *region, phys_addr_t phys, unsigned long size) {
+	unsigned long npages = size >> PAGE_SHIFT;
+
+	mutex_lock(&region->lock);
+	bitmap_clear(region->bitmap, (phys - region->base) >> PAGE_SHIFT, npages);
+	region->used_pages -= npages;
+	region->live_buffers--;
+	mutex_unlock(&region->lock);
+}
+
+static void exp_carveout_region_release(struct kref *ref) {
+	struct exp_carveout_region *region = container_of(ref, struct exp_carveout_region, ref);
+
+	bitmap_free(region->bitmap);
+	memunmap(region->vaddr);
+	kfree(region);
+}
+
+static void exp_carveout_region_put(struct exp_carveout_region *region) {
+	kref_put(&region->ref, exp_carveout_region_release);
+}
+
+static dma_addr_t exp_carveout_map(struct exp_carveout_region *region, struct device *dev,
+	phys_addr_t phys, unsigned long size, enum dma_data_direction dma_dir, unsigned long attrs) {
+	if (region->cached)
+		return dma_map_page_attrs(dev, pfn_to_page(PHYS_PFN(phys)), 0, size, dma_dir, attrs);
+
+	return dma_map_resource(dev, phys, size, dma_dir, attrs);
+}
+
+static void exp_carveout_unmap(struct exp_carveout_region *region, struct device *dev,
+	dma_addr_t dma_addr, unsigned long size, enum dma_data_direction dma_dir, unsigned long attrs) {
+	if (region->cached)
+		dma_unmap_page_attrs(dev, dma_addr, size, dma_dir, attrs);
+	else
+		dma_unmap_resource(dev, dma_addr, size, dma_dir, attrs);
+}
+
+static ssize_t carveout_stats_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct qdmabuf_device *device = dev_get_drvdata(dev);
+	struct exp_carveout_region *region = device->carveout;
+	unsigned long start = 0, end;
+	unsigned long largest_free = 0;
+	unsigned long free_extents = 0;
+	ssize_t ret;
+
+	mutex_lock(&region->lock);
+	while ((start = find_next_zero_bit(region->bitmap, region->nbits, start)) < region->nbits) {
+		end = find_next_bit(region->bitmap, region->nbits, start);
+		largest_free = max(largest_free, end - start);
+		free_extents++;
+		start = end;
+	}
+
+	ret = snprintf(buf, PAGE_SIZE,
+		"size=%lu used=%lu free=%lu largest_free=%lu free_extents=%lu buffers=%lu allocs=%lu fails=%lu\n",
+		region->size,
+		region->used_pages << PAGE_SHIFT,
+		(region->nbits - region->used_pages) << PAGE_SHIFT,
+		largest_free << PAGE_SHIFT,
+		free_extents,
+		region->live_buffers,
+		region->allocs,
+		region->fails);
+	mutex_unlock(&region->lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR(carveout_stats, 0444, carveout_stats_show, NULL);
+
+static void exp_carveout_buffer_put(void *buf_priv)
+{
+	struct exp_carveout_buffer *buf = buf_priv;
+
+	if (!refcount_dec_and_test(&buf->refcount))
+		return;
+
+	dmabuf_exp_stats_buf_del(&buf->stats);
+	dmabuf_exp_segs_free(&buf->segs);
+	exp_carveout_unmap(buf->region, buf->dev, buf->dma_addr, buf->size, DMA_BIDIRECTIONAL, 0);
+	exp_carveout_region_free(buf->region, buf->phys, buf->size);
+	exp_carveout_region_put(buf->region);
+	put_device(buf->dev);
+	kfree(buf);
+}
+
+static int exp_carveout_attach(struct dma_buf *dbuf, struct dma_buf_attachment *dbuf_attach) {
+	struct exp_carveout_attachment *attach;
+	struct exp_carveout_buffer *buf = dbuf->priv;
+	int ret;
+
+	pr_debug("buf=%p\n", buf);
+
+	attach = kzalloc(sizeof(*attach), GFP_KERNEL);
+	if (!attach) {
+		pr_err("kzalloc() failed\n");
+
+		ret = -ENOMEM;
+		goto err0;
+	}
+
+	/* the region may have no struct page, only the DMA address is filled in */
+	ret = sg_alloc_table(&attach->sgt, 1, GFP_KERNEL);
+	if (ret) {
+		pr_err("sg_alloc_table() failed, err=%d\n", ret);
+
+		goto err1;
+	}
+
+	attach->dma_dir = DMA_NONE;
+	dmabuf_exp_stats_attach(&buf->stats, &attach->stats, dbuf_attach->dev, &attach->dma_dir);
+	dbuf_attach->priv = attach;
+
+	return 0;
+
+err1:
+	kfree(attach);
+err0:
+	return ret;
+}
+
+static void exp_carveout_detach(struct dma_buf *dbuf, struct dma_buf_attachment *db_attach) {
+	struct exp_carveout_attachment *attach = db_attach->priv;
+	struct exp_carveout_buffer *buf = dbuf->priv;
+	struct sg_table *sgt;
+
+	pr_debug("attach=%p\n", attach);
+
+	if (!attach) {
+		pr_err("unexpected value, attach=%p\n", attach);
+		goto err0;
+	}
+
+	sgt = &attach->sgt;
+
+	if (attach->dma_dir != DMA_NONE) {
+		exp_carveout_unmap(buf->region, db_attach->dev, sg_dma_address(sgt->sgl), sg_dma_len(sgt->sgl),
+			attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	}
+	sg_free_table(sgt);
+	dmabuf_exp_stats_detach(&attach->stats);
+	kfree(attach);
+	db_attach->priv = NULL;
+
+	return;
+
+err0:
+	return;
+}
+
+static void exp_carveout_dma_buf_release(struct dma_buf *dbuf) {
+	struct exp_carveout_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	exp_carveout_buffer_put(dbuf->priv);
+}
+
+static struct sg_table * exp_carveout_map_dma_buf(struct dma_buf_attachment *db_attach, enum dma_data_direction dma_dir) {
+	struct exp_carveout_attachment *attach = db_attach->priv;
+	struct exp_carveout_buffer *buf = db_attach->dmabuf->priv;
+	struct sg_table *sgt;
+	dma_addr_t dma_addr;
+
+	pr_debug("db_attach=%p\n", db_attach);
+
+	if (!attach) {
+		pr_err("unexpected value, attach=%p\n", attach);
+
+		sgt = NULL;
+		goto err0;
+	}
+
+	sgt = &attach->sgt;
+	/* return previously mapped sg table */
+	if (attach->dma_dir == dma_dir) {
+		goto done;
+	}
+
+	/* release any previous cache */
+	if (attach->dma_dir != DMA_NONE) {
+		exp_carveout_unmap(buf->region, db_attach->dev, sg_dma_address(sgt->sgl), sg_dma_len(sgt->sgl),
+			attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+		attach->dma_dir = DMA_NONE;
+	}
+
+	/* CPU caches are handled by begin/end_cpu_access() */
+	dma_addr = exp_carveout_map(buf->region, db_attach->dev, buf->phys, buf->size, dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(db_attach->dev, dma_addr)) {
+		pr_err("exp_carveout_map() failed\n");
+		sgt = ERR_PTR(-EIO);
+		goto err1;
+	}
+
+	sg_dma_address(sgt->sgl) = dma_addr;
+	sg_dma_len(sgt->sgl) = buf->size;
+	sgt->nents = 1;
+
+	attach->dma_dir = dma_dir;
+
+done:
+	return sgt;
+
+err1:
+err0:
+	return sgt;
+}
+
+static void exp_carveout_unmap_dma_buf(struct dma_buf_attachment * db_attach, struct sg_table * sgt, enum dma_data_direction dma_dir) {
+	pr_debug("db_attach=%p\n", db_attach);
+
+	/* nothing to be done here */
+}
+
+static int exp_carveout_sync_range(struct exp_carveout_buffer *buf,
+	unsigned long offset, unsigned long len, bool for_cpu)
+{
+	/* never mapped cacheable, nothing to be done here */
+	if (!buf->region->cached)
+		return 0;
+
+	/* the exporter's own mapping is DMA_BIDIRECTIONAL, sync it as mapped */
+	if (for_cpu)
+		dma_sync_single_range_for_cpu(buf->dev, buf->dma_addr, offset, len, DMA_BIDIRECTIONAL);
+	else
+		dma_sync_single_range_for_device(buf->dev, buf->dma_addr, offset, len, DMA_BIDIRECTIONAL);
+
+	return 0;
+}
+
+static int exp_carveout_begin_cpu_access(struct dma_buf *dbuf, enum dma_data_direction direction)
+{
+	struct exp_carveout_buffer *buf = dbuf->priv;
+
+	return exp_carveout_sync_range(buf, 0, buf->size, true);
+}
+
+static int exp_carveout_end_cpu_access(struct dma_buf *dbuf, enum dma_data_direction direction)
+{
+	struct exp_carveout_buffer *buf = dbuf->priv;
+
+	return exp_carveout_sync_range(buf, 0, buf->size, false);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
+static void * exp_carveout_vmap(struct dma_buf *dbuf)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5,19,0)
+static int exp_carveout_vmap(struct dma_buf *dbuf, struct dma_buf_map *map)
+#else
+static int exp_carveout_vmap(struct dma_buf *dbuf, struct iosys_map *map)
+#endif
+{
+	struct exp_carveout_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
+	return buf->vaddr;
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5,18,0)
+	dma_buf_map_set_vaddr(map, buf->vaddr);
+
+	return 0;
+#else
+	iosys_map_set_vaddr(map, buf->vaddr);
+
+	return 0;
+#endif
+}
+
+static int exp_carveout_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma) {
+	struct exp_carveout_buffer *buf = dbuf->priv;
+	unsigned long vm_size = vma->vm_end - vma->vm_start;
+	int ret;
+
+	pr_debug("buf=%p\n", buf);
+
+	if (!buf) {
+		pr_err("unexpected value, buf=%p\n", buf);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	if ((vma->vm_pgoff << PAGE_SHIFT) + vm_size > buf->size) {
+		pr_err("unexpected value, vm_pgoff=%lu, vm_size=%lu\n", vma->vm_pgoff, vm_size);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	/* a cached region keeps the attributes of the kernel's linear map */
+	if (!buf->region->cached) {
+		if (buf->flags & QDMABUF_ALLOC_FLAG_UNCACHED)
+			vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		else
+			vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+	}
+
+	ret = remap_pfn_range(vma, vma->vm_start, PHYS_PFN(buf->phys) + vma->vm_pgoff,
+		vm_size, vma->vm_page_prot);
+	if (ret) {
+		pr_err("remap_pfn_range() failed, err=%d\n", ret);
+		goto err0;
+	}
+
+#if KERNEL_VERSION(6, 3, 0) <= LINUX_VERSION_CODE
+	vma->__vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#else
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+
+	vma->vm_private_data = &buf->handler;
+	vma->vm_ops = &dmabuf_exp_vm_ops;
+
+	vma->vm_ops->open(vma);
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+static const struct dma_buf_ops exp_carveout_buf_ops = {
+	.attach = exp_carveout_attach,
+	.detach = exp_carveout_detach,
+	.map_dma_buf = exp_carveout_map_dma_buf,
+	.unmap_dma_buf = exp_carveout_unmap_dma_buf,
+	.release = exp_carveout_dma_buf_release,
+	.begin_cpu_access = exp_carveout_begin_cpu_access,
+	.end_cpu_access = exp_carveout_end_cpu_access,
+	.mmap = exp_carveout_mmap,
+	.vmap = exp_carveout_vmap,
+};
+
+int qdmabuf_dmabuf_segs_carveout(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	struct exp_carveout_buffer *buf = dmabuf->priv;
+
+	if (dmabuf->ops != &exp_carveout_buf_ops)
+		return -ENOTTY;
+
+	*segs = &buf->segs;
+
+	return 0;
+}
+
+int qdmabuf_dmabuf_sync_carveout(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	if (dmabuf->ops != &exp_carveout_buf_ops)
+		return -ENOTTY;
+
+	return exp_carveout_sync_range(dmabuf->priv, offset, len, for_cpu);
+}
+
+int qdmabuf_dmabuf_alloc_carveout(struct exp_carveout_region *region, struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node) {
+	struct exp_carveout_buffer *buf;
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	size_t size = PAGE_ALIGN(len);
+	struct dma_buf *dmabuf;
+	int ret;
+
+	pr_info("len=%d, fd_flags=%d, flags=0x%x, node=%d\n", len, fd_flags, flags, node);
+
+	if (!region) {
+		pr_err("carve-out region not configured\n");
+		ret = -ENODEV;
+		goto err0;
+	}
+
+	if (len <= 0) {
+		pr_err("unexpected value, len=%d\n", len);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	/* the kernel's cacheable alias of RAM may not be mapped otherwise */
+	if (region->cached && (flags & QDMABUF_ALLOC_FLAGS_MASK)) {
+		pr_err("unexpected value, flags=0x%x for a cached region\n", flags);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		pr_err("kzalloc() failed\n");
+		ret = -ENOMEM;
+		goto err0;
+	}
+
+	buf->dev = get_device(device);
+	if(!buf->dev) {
+		pr_err("get_device() failed\n");
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	buf->size = size;
+	buf->dma_dir = dma_dir;
+	buf->flags = flags;
+
+	buf->handler.refcount = &buf->refcount;
+	buf->handler.put = exp_carveout_buffer_put;
+	buf->handler.arg = buf;
+	refcount_set(&buf->refcount, 1);
+
+	ret = exp_carveout_region_alloc(region, buf->size, &buf->phys);
+	if (ret) {
+		pr_err("exp_carveout_region_alloc() failed, err=%d\n", ret);
+		goto err2;
+	}
+	kref_get(&region->ref);
+	buf->region = region;
+
+	buf->vaddr = region->vaddr + (buf->phys - region->base);
+	/* never hand out what the previous owner of the range left there */
+	memset(buf->vaddr, 0, buf->size);
+
+	/* also cleans the zeroed lines of a cached region */
+	buf->dma_addr = exp_carveout_map(region, buf->dev, buf->phys, buf->size, DMA_BIDIRECTIONAL, 0);
+	if (dma_mapping_error(buf->dev, buf->dma_addr)) {
+		pr_err("exp_carveout_map() failed\n");
+		ret = -EIO;
+		goto err3;
+	}
+
+	ret = dmabuf_exp_segs_init(&buf->segs, buf->dma_addr, buf->size);
+	if (ret) {
+		pr_err("dmabuf_exp_segs_init() failed, err=%d\n", ret);
+		goto err4;
+	}
+
+	exp_info.exp_name = "qdmabuf-carveout";
+	exp_info.ops = &exp_carveout_buf_ops;
+	exp_info.size = buf->size;
+	exp_info.flags = fd_flags;
+	exp_info.priv = buf;
+	dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dmabuf)) {
+		pr_err("dma_buf_export() failed, dmabuf=%p\n", dmabuf);
+
+		ret = PTR_ERR(dmabuf);
+		goto err5;
+	}
+	dmabuf_exp_stats_buf_add(&buf->stats, QDMABUF_TYPE_CARVEOUT, buf->size);
+
+	ret = dma_buf_fd(dmabuf, fd_flags);
+	if (ret < 0) {
+		pr_err("dma_buf_fd() failed, err=%d\n", ret);
+
+		goto err6;
+	}
+
+	return ret;
+
+err6:
+	/* release() drops the last reference and frees the buffer */
+	dma_buf_put(dmabuf);
+	return ret;
+err5:
+	dmabuf_exp_segs_free(&buf->segs);
+err4:
+	exp_carveout_unmap(region, buf->dev, buf->dma_addr, buf->size, DMA_BIDIRECTIONAL, 0);
+err3:
+	exp_carveout_region_free(region, buf->phys, buf->size);
+	exp_carveout_region_put(region);
+err2:
+	put_device(buf->dev);
+err1:
+	kfree(buf);
+err0:
+	return ret;
+}
+
+int qdmabuf_dmabuf_carveout_init(struct device* dev, struct exp_carveout_region **pregion) {
+	struct exp_carveout_region *region;
+	phys_addr_t base = carveout_base;
+	unsigned long size = carveout_size;
+	int err;
+
+	*pregion = NULL;
+
+#if Z_CONFIG_OF
+	if (!size && dev->of_node) {
+		struct device_node *np = of_parse_phandle(dev->of_node, "memory-region", 0);
+		struct reserved_mem *rmem;
+
+		if (np) {
+			rmem = of_reserved_mem_lookup(np);
+			of_node_put(np);
+
+			if (rmem) {
+				base = rmem->base;
+				size = rmem->size;
+			}
+		}
+	}
+#endif // Z_CONFIG_OF
+
+	if (!size)
+		return 0;
+
+	if (!PAGE_ALIGNED(base) || !PAGE_ALIGNED(size)) {
+		pr_err("unexpected value, base=%pa, size=%lu\n", &base, size);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	region = kzalloc(sizeof(*region), GFP_KERNEL);
+	if (!region) {
+		pr_err("kzalloc() failed\n");
+		err = -ENOMEM;
+		goto err0;
+	}
+
+	kref_init(&region->ref);
+	mutex_init(&region->lock);
+	region->dev = dev;
+	region->base = base;
+	region->size = size;
+	region->nbits = size >> PAGE_SHIFT;
+	region->cached = pfn_valid(PHYS_PFN(base)) && pfn_valid(PHYS_PFN(base + size - 1));
+
+	region->vaddr = memremap(region->base, region->size, region->cached ? MEMREMAP_WB : MEMREMAP_WC);
+	if (!region->vaddr) {
+		pr_err("memremap() failed, base=%pa, size=%lu\n", &base, size);
+		err = -ENOMEM;
+		goto err1;
+	}
+
+	region->bitmap = bitmap_zalloc(region->nbits, GFP_KERNEL);
+	if (!region->bitmap) {
+		pr_err("bitmap_zalloc() failed\n");
+		err = -ENOMEM;
+		goto err2;
+	}
+
+	*pregion = region;
+
+	err = device_create_file(dev, &dev_attr_carveout_stats);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err3;
+	}
+
+	pr_info("carve-out region %pa, size=%lu, cached=%d\n", &base, size, region->cached);
+
+	return 0;
+
+err3:
+	*pregion = NULL;
+	bitmap_free(region->bitmap);
+err2:
+	memunmap(region->vaddr);
+err1:
+	kfree(region);
+err0:
+	return err;
+}
+
+void qdmabuf_dmabuf_carveout_uninit(struct exp_carveout_region *region) {
+	if (!region)
+		return;
+
+	device_remove_file(region->dev, &dev_attr_carveout_stats);
+
+	/* freed along with the last exported buffer */
+	exp_carveout_region_put(region);
+}
@@ -18,12 +18,16 @@ struct exp_dma_contig_buffer {
 	/* MMAP related */
 	struct dmabuf_exp_vmarea_handler handler;
 	refcount_t refcount;
+	struct dmabuf_exp_stats_buf stats;
 	struct sg_table *sgt_base;
+
+	struct dmabuf_exp_segs segs;
 };
 
 struct exp_dma_contig_attachment {
 	struct sg_table sgt;
 	enum dma_data_direction dma_dir;
+	struct dmabuf_exp_stats_attach stats;
 };
 
 static void exp_dma_contig_buffer_put(void *buf_priv)
@@ -33,10 +37,13 @@ static void exp_dma_contig_buffer_put(void *buf_priv)
 	if (!refcount_dec_and_test(&buf->refcount))
 		return;
 
+	dmabuf_exp_stats_buf_del(&buf->stats);
 	if (buf->sgt_base) {
+		dmabuf_exp_node_stats_sub(sg_page(buf->sgt_base->sgl), buf->size);
 		sg_free_table(buf->sgt_base);
 		kfree(buf->sgt_base);
 	}
+	dmabuf_exp_segs_free(&buf->segs);
 	dma_free_attrs(buf->dev, buf->size, buf->vaddr, buf->dma_addr, buf->attrs);
 	put_device(buf->dev);
 	kfree(buf);
@@ -50,7 +57,7 @@ static int exp_dma_contig_attach(struct dma_buf *dbuf, struct dma_buf_attachment
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 	int ret;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	attach = kzalloc(sizeof(*attach), GFP_KERNEL);
 	if (!attach) {
@@ -71,7 +78,7 @@ static int exp_dma_contig_attach(struct dma_buf *dbuf, struct dma_buf_attachment
 		goto err1;
 	}
 
-	pr_info("sgt->orig_nents=%d\n", sgt->orig_nents);
+	pr_debug("sgt->orig_nents=%d\n", sgt->orig_nents);
 
 	rd = buf->sgt_base->sgl;
 	wr = sgt->sgl;
@@ -82,6 +89,7 @@ static int exp_dma_contig_attach(struct dma_buf *dbuf, struct dma_buf_attachment
 	}
 
 	attach->dma_dir = DMA_NONE;
+	dmabuf_exp_stats_attach(&buf->stats, &attach->stats, dbuf_attach->dev, &attach->dma_dir);
 	dbuf_attach->priv = attach;
 
 	return 0;
@@ -96,7 +104,7 @@ static void exp_dma_contig_detach(struct dma_buf *dbuf, struct dma_buf_attachmen
 	struct exp_dma_contig_attachment *attach = db_attach->priv;
 	struct sg_table *sgt;
 
-	pr_info("attach=%p\n", attach);
+	pr_debug("attach=%p\n", attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
@@ -116,6 +124,7 @@ static void exp_dma_contig_detach(struct dma_buf *dbuf, struct dma_buf_attachmen
 		dma_unmap_sg_attrs(db_attach->dev, sgt->sgl, sgt->orig_nents, attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
 	}
 	sg_free_table(sgt);
+	dmabuf_exp_stats_detach(&attach->stats);
 	kfree(attach);
 	db_attach->priv = NULL;
 
@@ -128,7 +137,7 @@ err0:
 static void exp_dma_contig_dma_buf_release(struct dma_buf *dbuf) {
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	exp_dma_contig_buffer_put(dbuf->priv);
 }
@@ -142,7 +151,7 @@ static struct sg_table * exp_dma_contig_map_dma_buf(struct dma_buf_attachment *d
 	int err;
 #endif
 
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
@@ -195,7 +204,7 @@ err0:
 }
 
 static void exp_dma_contig_unmap_dma_buf(struct dma_buf_attachment * db_attach, struct sg_table * sgt, enum dma_data_direction dma_dir) {
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	/* nothing to be done here */
 }
@@ -204,7 +213,7 @@ static int exp_dma_contig_begin_cpu_access(struct dma_buf *dbuf, enum dma_data_d
 {
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	return 0;
 }
@@ -213,7 +222,7 @@ static int exp_dma_contig_end_cpu_access(struct dma_buf *dbuf, enum dma_data_dir
 {
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	return 0;
 }
@@ -228,7 +237,7 @@ static int exp_dma_contig_vmap(struct dma_buf *dbuf, struct iosys_map *map)
 {
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
 	return buf->vaddr;
@@ -247,7 +256,7 @@ static int exp_dma_contig_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma)
 	struct exp_dma_contig_buffer *buf = dbuf->priv;
 	int ret;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	if (!buf) {
 		pr_err("unexpected value, buf=%p\n", buf);
@@ -295,14 +304,40 @@ static const struct dma_buf_ops exp_dma_contig_buf_ops = {
 	.vmap = exp_dma_contig_vmap,
 };
 
-int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags, int dma_dir) {
+int qdmabuf_dmabuf_segs_dma_contig(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	struct exp_dma_contig_buffer *buf = dmabuf->priv;
+
+	if (dmabuf->ops != &exp_dma_contig_buf_ops)
+		return -ENOTTY;
+
+	*segs = &buf->segs;
+
+	return 0;
+}
+
+int qdmabuf_dmabuf_sync_dma_contig(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	if (dmabuf->ops != &exp_dma_contig_buf_ops)
+		return -ENOTTY;
+
+	/* coherent memory, nothing to be done here */
+	return 0;
+}
+
+int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node) {
 	struct exp_dma_contig_buffer *buf;
 	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
 	size_t size = PAGE_ALIGN(len);
 	struct dma_buf *dmabuf;
 	int ret;
 
-	pr_info("len=%d, fd_flags=%d\n", len, fd_flags);
+	pr_info("len=%d, fd_flags=%d, flags=0x%x, node=%d\n", len, fd_flags, flags, node);
+
+	/* dma_alloc_attrs() has no uncached attribute beyond the coherent default */
+	if (flags & QDMABUF_ALLOC_FLAG_UNCACHED) {
+		pr_err("unexpected value, flags=0x%x\n", flags);
+		ret = -EINVAL;
+		goto err0;
+	}
 
 	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
 	if (!buf) {
@@ -319,7 +354,7 @@ int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags
 	}
 
 	buf->size = size;
-	buf->attrs = 0;
+	buf->attrs = (flags & QDMABUF_ALLOC_FLAG_WRITECOMBINE) ? DMA_ATTR_WRITE_COMBINE : 0;
 	buf->dma_dir = dma_dir;
 
 	buf->handler.refcount = &buf->refcount;
@@ -350,6 +385,13 @@ int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags
 		goto err4;
 	}
 
+	ret = dmabuf_exp_segs_init(&buf->segs, buf->dma_addr, buf->size);
+	if (ret) {
+		pr_err("dmabuf_exp_segs_init() failed, err=%d\n", ret);
+		goto err5;
+	}
+	dmabuf_exp_node_stats_add(sg_page(buf->sgt_base->sgl), buf->size);
+
 	exp_info.exp_name = "qdmabuf-dma-contig";
 	exp_info.ops = &exp_dma_contig_buf_ops;
 	exp_info.size = buf->size;
@@ -360,20 +402,26 @@ int qdmabuf_dmabuf_alloc_dma_contig(struct device* device, int len, int fd_flags
 		pr_err("dma_buf_export() failed, dmabuf=%p\n", dmabuf);
 
 		ret = PTR_ERR(dmabuf);
-		goto err5;
+		goto err6;
 	}
+	dmabuf_exp_stats_buf_add(&buf->stats, QDMABUF_TYPE_DMA_CONTIG, buf->size);
 
 	ret = dma_buf_fd(dmabuf, fd_flags);
 	if (ret < 0) {
 		pr_err("dma_buf_fd() failed, err=%d\n", ret);
 
-		goto err6;
+		goto err7;
 	}
 
 	return ret;
 
-err6:
+err7:
+	/* release() drops the last reference and frees the buffer */
 	dma_buf_put(dmabuf);
+	return ret;
+err6:
+	dmabuf_exp_node_stats_sub(sg_page(buf->sgt_base->sgl), buf->size);
+	dmabuf_exp_segs_free(&buf->segs);
 err5:
 	sg_free_table(buf->sgt_base);
 err4:
@@ -14,16 +14,21 @@ struct exp_dma_sg_buffer {
 	struct page **pages;
 	struct sg_table sg_table;
 	enum dma_data_direction dma_dir;
+	int node;
 
 	struct dmabuf_exp_vmarea_handler handler;
 	refcount_t refcount;
+	struct dmabuf_exp_stats_buf stats;
 	struct sg_table *dma_sgt;
 	unsigned int num_pages;
+
+	struct dmabuf_exp_segs segs;
 };
 
 struct exp_dma_sg_attachment {
 	struct sg_table sgt;
 	enum dma_data_direction dma_dir;
+	struct dmabuf_exp_stats_attach stats;
 };
 
 static void exp_dma_sg_buffer_put(void *buf_priv)
@@ -35,14 +40,18 @@ static void exp_dma_sg_buffer_put(void *buf_priv)
 	if (!refcount_dec_and_test(&buf->refcount))
 		return;
 
+	dmabuf_exp_stats_buf_del(&buf->stats);
 	pr_info("Freeing buffer of %d pages\n", buf->num_pages);
 	dma_unmap_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents,
 		buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	dmabuf_exp_segs_free(&buf->segs);
 	if (buf->vaddr)
 		vm_unmap_ram(buf->vaddr, buf->num_pages);
 	sg_free_table(buf->dma_sgt);
-	while (--i >= 0)
+	while (--i >= 0) {
+		dmabuf_exp_node_stats_sub(buf->pages[i], PAGE_SIZE);
 		__free_page(buf->pages[i]);
+	}
 	kvfree(buf->pages);
 	put_device(buf->dev);
 	kfree(buf);
@@ -56,7 +65,7 @@ static int exp_dma_sg_attach(struct dma_buf *dbuf, struct dma_buf_attachment *db
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
 	int ret;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	attach = kzalloc(sizeof(*attach), GFP_KERNEL);
 	if (!attach) {
@@ -77,7 +86,7 @@ static int exp_dma_sg_attach(struct dma_buf *dbuf, struct dma_buf_attachment *db
 		goto err1;
 	}
 
-	pr_info("sgt->orig_nents=%d\n", sgt->orig_nents);
+	pr_debug("sgt->orig_nents=%d\n", sgt->orig_nents);
 
 	rd = buf->dma_sgt->sgl;
 	wr = sgt->sgl;
@@ -88,6 +97,7 @@ static int exp_dma_sg_attach(struct dma_buf *dbuf, struct dma_buf_attachment *db
 	}
 
 	attach->dma_dir = DMA_NONE;
+	dmabuf_exp_stats_attach(&buf->stats, &attach->stats, dbuf_attach->dev, &attach->dma_dir);
 	dbuf_attach->priv = attach;
 
 	return 0;
@@ -102,7 +112,7 @@ static void exp_dma_sg_detach(struct dma_buf *dbuf, struct dma_buf_attachment *d
 	struct exp_dma_sg_attachment *attach = db_attach->priv;
 	struct sg_table *sgt;
 
-	pr_info("attach=%p\n", attach);
+	pr_debug("attach=%p\n", attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
@@ -122,6 +132,7 @@ static void exp_dma_sg_detach(struct dma_buf *dbuf, struct dma_buf_attachment *d
 		dma_unmap_sg_attrs(db_attach->dev, sgt->sgl, sgt->orig_nents, attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
 	}
 	sg_free_table(sgt);
+	dmabuf_exp_stats_detach(&attach->stats);
 	kfree(attach);
 	db_attach->priv = NULL;
 
@@ -134,7 +145,7 @@ err0:
 static void exp_dma_sg_dma_buf_release(struct dma_buf *dbuf) {
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	exp_dma_sg_buffer_put(dbuf->priv);
 }
@@ -151,7 +162,7 @@ static struct sg_table * exp_dma_sg_map_dma_buf(struct dma_buf_attachment *db_at
 	int err;
 #endif
 
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
@@ -211,33 +222,46 @@ static void exp_dma_sg_unmap_dma_buf(struct dma_buf_attachment * db_attach,
 	struct sg_table * sgt,
 	enum dma_data_direction dma_dir) {
 
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	/* nothing to be done here */
 }
 
+static int exp_dma_sg_sync_range(struct exp_dma_sg_buffer *buf,
+	unsigned long offset, unsigned long len, bool for_cpu)
+{
+	struct sg_table *sgt = buf->dma_sgt;
+
+	if (offset == 0 && len >= buf->size) {
+		if (for_cpu)
+			dma_sync_sg_for_cpu(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+		else
+			dma_sync_sg_for_device(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+	} else {
+		dmabuf_exp_sync_sgt_range(buf->dev, sgt, buf->dma_dir, offset, len, for_cpu);
+	}
+
+	return 0;
+}
+
 static int exp_dma_sg_begin_cpu_access(struct dma_buf *dbuf,
 	enum dma_data_direction direction)
 {
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
-	struct sg_table *sgt = buf->dma_sgt;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
-	dma_sync_sg_for_cpu(buf->dev, sgt->sgl, sgt->nents, buf->dma_dir);
-	return 0;
+	return exp_dma_sg_sync_range(buf, 0, buf->size, true);
 }
 
 static int exp_dma_sg_end_cpu_access(struct dma_buf *dbuf,
 	enum dma_data_direction direction)
 {
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
-	struct sg_table *sgt = buf->dma_sgt;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
-	dma_sync_sg_for_device(buf->dev, sgt->sgl, sgt->nents, buf->dma_dir);
-	return 0;
+	return exp_dma_sg_sync_range(buf, 0, buf->size, false);
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
@@ -250,7 +274,7 @@ static int exp_dma_sg_vmap(struct dma_buf *dbuf, struct iosys_map *map)
 {
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
 	return buf->vaddr;
@@ -269,7 +293,7 @@ static int exp_dma_sg_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma) {
 	struct exp_dma_sg_buffer *buf = dbuf->priv;
 	int ret;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	if (!buf) {
 		pr_err("unexpected value, buf=%p\n", buf);
@@ -309,6 +333,24 @@ static const struct dma_buf_ops exp_dma_sg_buf_ops = {
 	.vmap = exp_dma_sg_vmap,
 };
 
+int qdmabuf_dmabuf_segs_dma_sg(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	struct exp_dma_sg_buffer *buf = dmabuf->priv;
+
+	if (dmabuf->ops != &exp_dma_sg_buf_ops)
+		return -ENOTTY;
+
+	*segs = &buf->segs;
+
+	return 0;
+}
+
+int qdmabuf_dmabuf_sync_dma_sg(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	if (dmabuf->ops != &exp_dma_sg_buf_ops)
+		return -ENOTTY;
+
+	return exp_dma_sg_sync_range(dmabuf->priv, offset, len, for_cpu);
+}
+
 static int exp_dma_sg_alloc_compacted(struct exp_dma_sg_buffer *buf, gfp_t gfp_flags)
 {
 	unsigned int last_page = 0;
@@ -320,14 +362,14 @@ static int exp_dma_sg_alloc_compacted(struct exp_dma_sg_buffer *buf, gfp_t gfp_f
 		int i;
 
 		order = get_order(size);
-		pr_info("order=%d, size=%d", (int)order, (int)size);
+		pr_debug("order=%d, size=%d", (int)order, (int)size);
 		/* Don't over allocate*/
 		if ((PAGE_SIZE << order) > size)
 			order--;
 
 		pages = NULL;
 		while (!pages) {
-			pages = alloc_pages(GFP_KERNEL | __GFP_ZERO |
+			pages = alloc_pages_node(buf->node, GFP_KERNEL | __GFP_ZERO |
 					__GFP_NOWARN | gfp_flags, order);
 			if (pages)
 				break;
@@ -350,7 +392,7 @@ static int exp_dma_sg_alloc_compacted(struct exp_dma_sg_buffer *buf, gfp_t gfp_f
 	return 0;
 }
 
-int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, int dma_dir) {
+int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node) {
 	struct exp_dma_sg_buffer *buf;
 	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
 	size_t size = PAGE_ALIGN(len);
@@ -359,7 +401,17 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 	int num_pages;
 	int ret;
 
-	pr_info("len=%d, fd_flags=%d\n", len, fd_flags);
+	pr_info("len=%d, fd_flags=%d, flags=0x%x, node=%d\n", len, fd_flags, flags, node);
+
+	/*
+	 * a write-combined/uncached user mapping would alias the cacheable
+	 * linear map of these pages, only cached buffers are supported
+	 */
+	if (flags & QDMABUF_ALLOC_FLAGS_MASK) {
+		pr_err("unexpected value, flags=0x%x\n", flags);
+		ret = -EINVAL;
+		goto err0;
+	}
 
 	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
 	if (!buf) {
@@ -377,6 +429,7 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 
 	buf->vaddr = NULL;
 	buf->dma_dir = dma_dir;
+	buf->node = node;
 	buf->size = size;
 	/* size is already page aligned */
 	buf->num_pages = size >> PAGE_SHIFT;
@@ -400,6 +453,9 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 		goto err3;
 	}
 
+	for (num_pages = 0; num_pages < buf->num_pages; num_pages++)
+		dmabuf_exp_node_stats_add(buf->pages[num_pages], PAGE_SIZE);
+
 	ret = sg_alloc_table_from_pages(buf->dma_sgt, buf->pages, buf->num_pages, 0, size, GFP_KERNEL);
 	if (ret) {
 		pr_err("sg_alloc_table_from_pages() failed\n");
@@ -426,6 +482,12 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 	}
 #endif
 
+	ret = dmabuf_exp_segs_init_sgt(&buf->segs, sgt);
+	if (ret) {
+		pr_err("dmabuf_exp_segs_init_sgt() failed, err=%d\n", ret);
+		goto err5_1;
+	}
+
 	buf->handler.refcount = &buf->refcount;
 	buf->handler.put = exp_dma_sg_buffer_put;
 	buf->handler.arg = buf;
@@ -446,6 +508,7 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 		ret = PTR_ERR(dmabuf);
 		goto err6;
 	}
+	dmabuf_exp_stats_buf_add(&buf->stats, QDMABUF_TYPE_DMA_SG, buf->size);
 
 	ret = dma_buf_fd(dmabuf, fd_flags);
 	if (ret < 0) {
@@ -457,14 +520,22 @@ int qdmabuf_dmabuf_alloc_dma_sg(struct device* device, int len, int fd_flags, in
 	return ret;
 
 err7:
+	/* release() drops the last reference and frees the buffer */
 	dma_buf_put(dmabuf);
+	return ret;
 err6:
+	dmabuf_exp_segs_free(&buf->segs);
+err5_1:
+	dma_unmap_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents,
+		buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
 err5:
 	sg_free_table(buf->dma_sgt);
 err4:
 	num_pages = buf->num_pages;
-	while (num_pages--)
+	while (num_pages--) {
+		dmabuf_exp_node_stats_sub(buf->pages[num_pages], PAGE_SIZE);
 		__free_page(buf->pages[num_pages]);
+	}
 err3:
 	kvfree(buf->pages);
 err2:
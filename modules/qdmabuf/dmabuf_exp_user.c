@@ -0,0 +1,589 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include "dmabuf_exp.h"
+
+#include <linux/version.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/shmem_fs.h>
+#include <linux/overflow.h>
+#include <linux/fcntl.h>
+#include <linux/capability.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+
+/*
+ * dma-buf wrapping memory owned by user space, udmabuf-style: either a range
+ * of the caller's address space, pinned long-term, or a range of a memfd
+ * whose shmem pages are referenced directly. Pages are taken and the sg table
+ * is built and mapped once, at import time. Long-term pinned pages are charged
+ * to the importer's pinned_vm against RLIMIT_MEMLOCK until the buffer is freed.
+ */
+struct exp_user_buffer {
+	struct device *dev;
+	unsigned long size;
+	struct page **pages;
+	unsigned int num_pages;
+	bool pinned;
+	struct mm_struct *mm;
+	struct sg_table sg_table;
+	enum dma_data_direction dma_dir;
+
+	struct dmabuf_exp_vmarea_handler handler;
+	refcount_t refcount;
+	struct dmabuf_exp_stats_buf stats;
+
+	struct dmabuf_exp_segs segs;
+};
+
+struct exp_user_attachment {
+	struct sg_table sgt;
+	enum dma_data_direction dma_dir;
+	struct dmabuf_exp_stats_attach stats;
+};
+
+static void exp_user_release_pages(struct page **pages, unsigned int num_pages, bool pinned)
+{
+	unsigned int i;
+
+	if (pinned) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+		unpin_user_pages_dirty_lock(pages, num_pages, true);
+#else
+		for (i = 0; i < num_pages; i++) {
+			set_page_dirty_lock(pages[i]);
+			put_page(pages[i]);
+		}
+#endif
+		return;
+	}
+
+	for (i = 0; i < num_pages; i++)
+		put_page(pages[i]);
+}
+
+static int exp_user_charge_pinned(struct exp_user_buffer *buf)
+{
+	unsigned long lock_limit;
+	s64 pinned;
+
+	lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	pinned = atomic64_add_return(buf->num_pages, &current->mm->pinned_vm);
+	if (pinned > lock_limit && !capable(CAP_IPC_LOCK)) {
+		atomic64_sub(buf->num_pages, &current->mm->pinned_vm);
+		pr_err("RLIMIT_MEMLOCK exceeded, pinned=%lld, lock_limit=%lu\n", pinned, lock_limit);
+		return -ENOMEM;
+	}
+
+	buf->mm = current->mm;
+	mmgrab(buf->mm);
+
+	return 0;
+}
+
+static void exp_user_uncharge_pinned(struct exp_user_buffer *buf)
+{
+	if (!buf->mm)
+		return;
+
+	atomic64_sub(buf->num_pages, &buf->mm->pinned_vm);
+	mmdrop(buf->mm);
+	buf->mm = NULL;
+}
+
+static void exp_user_buffer_put(void *buf_priv)
+{
+	struct exp_user_buffer *buf = buf_priv;
+	struct sg_table *sgt = &buf->sg_table;
+
+	if (!refcount_dec_and_test(&buf->refcount))
+		return;
+
+	dmabuf_exp_stats_buf_del(&buf->stats);
+	pr_info("Releasing buffer of %d pages\n", buf->num_pages);
+	dmabuf_exp_segs_free(&buf->segs);
+	dma_unmap_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents,
+		buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	sg_free_table(sgt);
+	exp_user_release_pages(buf->pages, buf->num_pages, buf->pinned);
+	exp_user_uncharge_pinned(buf);
+	kvfree(buf->pages);
+	put_device(buf->dev);
+	kfree(buf);
+}
+
+static int exp_user_attach(struct dma_buf *dbuf, struct dma_buf_attachment *dbuf_attach) {
+	struct exp_user_attachment *attach;
+	unsigned int i;
+	struct scatterlist *rd, *wr;
+	struct sg_table *sgt;
+	struct exp_user_buffer *buf = dbuf->priv;
+	int ret;
+
+	pr_debug("buf=%p\n", buf);
+
+	attach = kzalloc(sizeof(*attach), GFP_KERNEL);
+	if (!attach) {
+		pr_err("kzalloc() failed\n");
+
+		ret = -ENOMEM;
+		goto err0;
+	}
+
+	sgt = &attach->sgt;
+	/* Copy the buf->sg_table scatter list to the attachment, as we can't
+	 * map the same scatter list to multiple attachments at the same time.
+	 */
+	ret = sg_alloc_table(sgt, buf->sg_table.orig_nents, GFP_KERNEL);
+	if (ret) {
+		pr_err("sg_alloc_table() failed, err=%d\n", ret);
+
+		goto err1;
+	}
+
+	rd = buf->sg_table.sgl;
+	wr = sgt->sgl;
+	for (i = 0; i < sgt->orig_nents; ++i) {
+		sg_set_page(wr, sg_page(rd), rd->length, rd->offset);
+		rd = sg_next(rd);
+		wr = sg_next(wr);
+	}
+
+	attach->dma_dir = DMA_NONE;
+	dmabuf_exp_stats_attach(&buf->stats, &attach->stats, dbuf_attach->dev, &attach->dma_dir);
+	dbuf_attach->priv = attach;
+
+	return 0;
+
+err1:
+	kfree(attach);
+err0:
+	return ret;
+}
+
+static void exp_user_detach(struct dma_buf *dbuf, struct dma_buf_attachment *db_attach) {
+	struct exp_user_attachment *attach = db_attach->priv;
+	struct sg_table *sgt;
+
+	pr_debug("attach=%p\n", attach);
+
+	if (!attach) {
+		pr_err("unexpected value, attach=%p\n", attach);
+		goto err0;
+	}
+
+	sgt = &attach->sgt;
+
+	/* release the scatterlist cache */
+	if (attach->dma_dir != DMA_NONE) {
+		dma_unmap_sg_attrs(db_attach->dev, sgt->sgl, sgt->orig_nents, attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	}
+	sg_free_table(sgt);
+	dmabuf_exp_stats_detach(&attach->stats);
+	kfree(attach);
+	db_attach->priv = NULL;
+
+	return;
+
+err0:
+	return;
+}
+
+static void exp_user_dma_buf_release(struct dma_buf *dbuf) {
+	struct exp_user_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	exp_user_buffer_put(dbuf->priv);
+}
+
+static struct sg_table * exp_user_map_dma_buf(struct dma_buf_attachment *db_attach,
+	enum dma_data_direction dma_dir) {
+	struct exp_user_attachment *attach = db_attach->priv;
+	struct sg_table *sgt;
+
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,10,120)
+#else
+	int err;
+#endif
+
+	pr_debug("db_attach=%p\n", db_attach);
+
+	if (!attach) {
+		pr_err("unexpected value, attach=%p\n", attach);
+
+		sgt = NULL;
+		goto err0;
+	}
+
+	sgt = &attach->sgt;
+	/* return previously mapped sg table */
+	if (attach->dma_dir == dma_dir) {
+		goto done;
+	}
+
+	/* release any previous cache */
+	if (attach->dma_dir != DMA_NONE) {
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,10,120)
+		dma_unmap_sg_attrs(db_attach->dev, sgt->sgl, sgt->orig_nents,
+				   attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+#else
+		dma_unmap_sgtable(db_attach->dev, sgt, attach->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+#endif
+		attach->dma_dir = DMA_NONE;
+	}
+
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,10,120)
+	sgt->nents = dma_map_sg_attrs(db_attach->dev, sgt->sgl, sgt->orig_nents, dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (!sgt->nents) {
+		pr_err("dma_map_sg_attrs() failed, sgt->nents=%d\n", (int)sgt->nents);
+		sgt = ERR_PTR(-EIO);
+		goto err1;
+	}
+#else
+	err = dma_map_sgtable(db_attach->dev, sgt, dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if(err) {
+		pr_err("dma_map_sgtable() failed, err=%d\n", err);
+		sgt = ERR_PTR(-EIO);
+		goto err1;
+	}
+#endif
+
+	attach->dma_dir = dma_dir;
+
+done:
+	return sgt;
+
+err1:
+err0:
+	return sgt;
+}
+
+static void exp_user_unmap_dma_buf(struct dma_buf_attachment * db_attach,
+	struct sg_table * sgt,
+	enum dma_data_direction dma_dir) {
+
+	pr_debug("db_attach=%p\n", db_attach);
+
+	/* nothing to be done here */
+}
+
+static int exp_user_sync_range(struct exp_user_buffer *buf,
+	unsigned long offset, unsigned long len, bool for_cpu)
+{
+	struct sg_table *sgt = &buf->sg_table;
+
+	if (offset == 0 && len >= buf->size) {
+		if (for_cpu)
+			dma_sync_sg_for_cpu(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+		else
+			dma_sync_sg_for_device(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+	} else {
+		dmabuf_exp_sync_sgt_range(buf->dev, sgt, buf->dma_dir, offset, len, for_cpu);
+	}
+
+	return 0;
+}
+
+static int exp_user_begin_cpu_access(struct dma_buf *dbuf,
+	enum dma_data_direction direction)
+{
+	struct exp_user_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	return exp_user_sync_range(buf, 0, buf->size, true);
+}
+
+static int exp_user_end_cpu_access(struct dma_buf *dbuf,
+	enum dma_data_direction direction)
+{
+	struct exp_user_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	return exp_user_sync_range(buf, 0, buf->size, false);
+}
+
+static int exp_user_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma) {
+	struct exp_user_buffer *buf = dbuf->priv;
+	int ret;
+
+	pr_debug("buf=%p\n", buf);
+
+	if (!buf) {
+		pr_err("unexpected value, buf=%p\n", buf);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	/* anonymous pages can't be inserted, import a memfd to share mappings */
+	ret = vm_map_pages(vma, buf->pages, buf->num_pages);
+	if (ret) {
+		pr_err("vm_map_pages() failed, err=%d\n", ret);
+		goto err0;
+	}
+
+	vma->vm_private_data = &buf->handler;
+	vma->vm_ops = &dmabuf_exp_vm_ops;
+
+	vma->vm_ops->open(vma);
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+static const struct dma_buf_ops exp_user_buf_ops = {
+	.attach = exp_user_attach,
+	.detach = exp_user_detach,
+	.map_dma_buf = exp_user_map_dma_buf,
+	.unmap_dma_buf = exp_user_unmap_dma_buf,
+	.release = exp_user_dma_buf_release,
+	.begin_cpu_access = exp_user_begin_cpu_access,
+	.end_cpu_access = exp_user_end_cpu_access,
+	.mmap = exp_user_mmap,
+};
+
+int qdmabuf_dmabuf_segs_user(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	struct exp_user_buffer *buf = dmabuf->priv;
+
+	if (dmabuf->ops != &exp_user_buf_ops)
+		return -ENOTTY;
+
+	*segs = &buf->segs;
+
+	return 0;
+}
+
+int qdmabuf_dmabuf_sync_user(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	if (dmabuf->ops != &exp_user_buf_ops)
+		return -ENOTTY;
+
+	return exp_user_sync_range(dmabuf->priv, offset, len, for_cpu);
+}
+
+static int exp_user_pin_pages(struct exp_user_buffer *buf, unsigned long addr)
+{
+	int ret;
+
+	ret = exp_user_charge_pinned(buf);
+	if (ret)
+		return ret;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	ret = pin_user_pages_fast(addr, buf->num_pages, FOLL_WRITE | FOLL_LONGTERM, buf->pages);
+#else
+	ret = get_user_pages_fast(addr, buf->num_pages, FOLL_WRITE | FOLL_LONGTERM, buf->pages);
+#endif
+	if (ret < 0) {
+		pr_err("pin_user_pages_fast() failed, err=%d\n", ret);
+		exp_user_uncharge_pinned(buf);
+		return ret;
+	}
+
+	if (ret != buf->num_pages) {
+		pr_err("pin_user_pages_fast() pinned %d of %u pages\n", ret, buf->num_pages);
+		exp_user_release_pages(buf->pages, ret, true);
+		exp_user_uncharge_pinned(buf);
+		return -EFAULT;
+	}
+
+	buf->pinned = true;
+
+	return 0;
+}
+
+static int exp_user_get_memfd_pages(struct exp_user_buffer *buf, int memfd, unsigned long offset)
+{
+	struct file *memfd_file;
+	pgoff_t pgoff = offset >> PAGE_SHIFT;
+	unsigned long end;
+	unsigned int i;
+	int ret;
+
+	memfd_file = fget(memfd);
+	if (!memfd_file) {
+		pr_err("fget() failed, memfd=%d\n", memfd);
+		ret = -EBADF;
+		goto err0;
+	}
+
+	if (!shmem_mapping(memfd_file->f_mapping)) {
+		pr_err("memfd=%d is not backed by shmem\n", memfd);
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	/* seals can't be removed, so a shrink-sealed memfd stays big enough */
+	if (!(READ_ONCE(SHMEM_I(file_inode(memfd_file))->seals) & F_SEAL_SHRINK)) {
+		pr_err("memfd=%d is not sealed with F_SEAL_SHRINK\n", memfd);
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	if (check_add_overflow(offset, buf->size, &end) ||
+		end > (unsigned long)i_size_read(file_inode(memfd_file))) {
+		pr_err("unexpected value, offset=%lu, size=%lu\n", offset, buf->size);
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	for (i = 0; i < buf->num_pages; i++) {
+		struct page *page = shmem_read_mapping_page(memfd_file->f_mapping, pgoff + i);
+
+		if (IS_ERR(page)) {
+			pr_err("shmem_read_mapping_page() failed, err=%ld\n", PTR_ERR(page));
+			ret = PTR_ERR(page);
+			goto err2;
+		}
+		buf->pages[i] = page;
+	}
+
+	buf->pinned = false;
+	fput(memfd_file);
+
+	return 0;
+
+err2:
+	exp_user_release_pages(buf->pages, i, false);
+err1:
+	fput(memfd_file);
+err0:
+	return ret;
+}
+
+int qdmabuf_dmabuf_import_user(struct device* device, unsigned long addr, unsigned long len,
+	int memfd, unsigned int flags, int fd_flags, int dma_dir) {
+	struct exp_user_buffer *buf;
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct dma_buf *dmabuf;
+	struct sg_table *sgt;
+	int ret;
+
+	pr_info("addr=%lx, len=%lu, memfd=%d, flags=0x%x, fd_flags=%d\n", addr, len, memfd, flags, fd_flags);
+
+	if (!len || !PAGE_ALIGNED(addr) || !PAGE_ALIGNED(len)) {
+		pr_err("unexpected value, addr=%lx, len=%lu\n", addr, len);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		pr_err("kzalloc() failed\n");
+		ret = -ENOMEM;
+		goto err0;
+	}
+
+	buf->dev = get_device(device);
+	if(!buf->dev) {
+		pr_err("get_device() failed\n");
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	buf->dma_dir = dma_dir;
+	buf->size = len;
+	buf->num_pages = len >> PAGE_SHIFT;
+
+	buf->pages = kvmalloc_array(buf->num_pages, sizeof(struct page *), GFP_KERNEL | __GFP_ZERO);
+	if (!buf->pages){
+		pr_err("kvmalloc_array() failed\n");
+		ret = -ENOMEM;
+		goto err2;
+	}
+
+	if (flags & QDMABUF_IMPORT_FLAG_MEMFD)
+		ret = exp_user_get_memfd_pages(buf, memfd, addr);
+	else
+		ret = exp_user_pin_pages(buf, addr);
+	if (ret) {
+		pr_err("exp_user_xxx_pages() failed, err=%d\n", ret);
+		goto err3;
+	}
+
+	sgt = &buf->sg_table;
+	ret = sg_alloc_table_from_pages(sgt, buf->pages, buf->num_pages, 0, buf->size, GFP_KERNEL);
+	if (ret) {
+		pr_err("sg_alloc_table_from_pages() failed, err=%d\n", ret);
+		goto err4;
+	}
+
+	/* user space may have written the pages through its cached mapping */
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,10,120)
+	sgt->nents = dma_map_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir, 0);
+	if (sgt->nents <= 0) {
+		pr_err("dma_map_sg_attrs() failed\n");
+		ret = -EIO;
+		goto err5;
+	}
+#else
+	ret = dma_map_sgtable(buf->dev, sgt, buf->dma_dir, 0);
+	if (ret) {
+		pr_err("dma_map_sgtable() failed, err=%d\n", ret);
+		goto err5;
+	}
+#endif
+
+	ret = dmabuf_exp_segs_init_sgt(&buf->segs, sgt);
+	if (ret) {
+		pr_err("dmabuf_exp_segs_init_sgt() failed, err=%d\n", ret);
+		goto err6;
+	}
+
+	buf->handler.refcount = &buf->refcount;
+	buf->handler.put = exp_user_buffer_put;
+	buf->handler.arg = buf;
+	refcount_set(&buf->refcount, 1);
+
+	exp_info.exp_name = "qdmabuf-user";
+	exp_info.ops = &exp_user_buf_ops;
+	exp_info.size = buf->size;
+	exp_info.flags = fd_flags;
+	exp_info.priv = buf;
+	dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dmabuf)) {
+		pr_err("dma_buf_export() failed, dmabuf=%p\n", dmabuf);
+
+		ret = PTR_ERR(dmabuf);
+		goto err7;
+	}
+	dmabuf_exp_stats_buf_add(&buf->stats, DMABUF_EXP_TYPE_USER, buf->size);
+
+	ret = dma_buf_fd(dmabuf, fd_flags);
+	if (ret < 0) {
+		pr_err("dma_buf_fd() failed, err=%d\n", ret);
+
+		goto err8;
+	}
+
+	return ret;
+
+err8:
+	/* release() drops the last reference and frees the buffer */
+	dma_buf_put(dmabuf);
+	return ret;
+err7:
+	dmabuf_exp_segs_free(&buf->segs);
+err6:
+	dma_unmap_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents,
+		buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+err5:
+	sg_free_table(sgt);
+err4:
+	exp_user_release_pages(buf->pages, buf->num_pages, buf->pinned);
+	exp_user_uncharge_pinned(buf);
+err3:
+	kvfree(buf->pages);
+err2:
+	put_device(buf->dev);
+err1:
+	kfree(buf);
+err0:
+	return ret;
+}
@@ -6,21 +6,46 @@
 #include <linux/dma-buf.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
 
 struct exp_vmalloc_buffer {
+	struct device *dev;
 	void *vaddr;
 	unsigned long size;
 	enum dma_data_direction dma_dir;
 
 	struct dmabuf_exp_vmarea_handler handler;
 	refcount_t refcount;
+	struct dmabuf_exp_stats_buf stats;
+
+	/* guards stats.attachments of this buffer for exp_vmalloc_sync_range() */
+	struct mutex attachments_lock;
+
+	/* segment list, mapped on first query */
+	struct mutex segs_lock;
+	struct sg_table segs_sgt;
+	struct dmabuf_exp_segs segs;
 };
 
 struct exp_vmalloc_attachment {
 	struct sg_table sgt;
 	enum dma_data_direction dma_dir;
+	struct dmabuf_exp_stats_attach stats;
 };
 
+static void exp_vmalloc_node_stats(struct exp_vmalloc_buffer *buf, bool add)
+{
+	unsigned long i;
+
+	for (i = 0; i < buf->size; i += PAGE_SIZE) {
+		if (add)
+			dmabuf_exp_node_stats_add(vmalloc_to_page(buf->vaddr + i), PAGE_SIZE);
+		else
+			dmabuf_exp_node_stats_sub(vmalloc_to_page(buf->vaddr + i), PAGE_SIZE);
+	}
+}
+
 static void exp_vmalloc_buffer_put(void *buf_priv)
 {
 	struct exp_vmalloc_buffer *buf = buf_priv;
@@ -28,7 +53,16 @@ static void exp_vmalloc_buffer_put(void *buf_priv)
 	if (!refcount_dec_and_test(&buf->refcount))
 		return;
 
+	dmabuf_exp_stats_buf_del(&buf->stats);
+	if (buf->segs.segs) {
+		dmabuf_exp_segs_free(&buf->segs);
+		dma_unmap_sg_attrs(buf->dev, buf->segs_sgt.sgl, buf->segs_sgt.orig_nents,
+			buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+		sg_free_table(&buf->segs_sgt);
+	}
+	exp_vmalloc_node_stats(buf, false);
 	vfree(buf->vaddr);
+	put_device(buf->dev);
 	kfree(buf);
 }
 
@@ -42,7 +76,7 @@ static int exp_vmalloc_attach(struct dma_buf *dbuf, struct dma_buf_attachment *d
 	int ret;
 	int i;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	attach = kzalloc(sizeof(*attach), GFP_KERNEL);
 	if (!attach) {
@@ -60,7 +94,7 @@ static int exp_vmalloc_attach(struct dma_buf *dbuf, struct dma_buf_attachment *d
 		goto err1;
 	}
 
-	pr_info("sgt->orig_nents=%d\n", sgt->orig_nents);
+	pr_debug("sgt->orig_nents=%d\n", sgt->orig_nents);
 
 	for_each_sg((sgt)->sgl, sg, (sgt)->nents, i) {
 		struct page *page = vmalloc_to_page(vaddr);
@@ -75,6 +109,9 @@ static int exp_vmalloc_attach(struct dma_buf *dbuf, struct dma_buf_attachment *d
 	}
 
 	attach->dma_dir = DMA_NONE;
+	mutex_lock(&buf->attachments_lock);
+	dmabuf_exp_stats_attach(&buf->stats, &attach->stats, dbuf_attach->dev, &attach->dma_dir);
+	mutex_unlock(&buf->attachments_lock);
 	dbuf_attach->priv = attach;
 
 	return 0;
@@ -87,15 +124,20 @@ err0:
 
 static void exp_vmalloc_detach(struct dma_buf *dbuf, struct dma_buf_attachment *db_attach) {
 	struct exp_vmalloc_attachment *attach = db_attach->priv;
+	struct exp_vmalloc_buffer *buf = dbuf->priv;
 	struct sg_table *sgt;
 
-	pr_info("attach=%p\n", attach);
+	pr_debug("attach=%p\n", attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
 		goto err0;
 	}
 
+	mutex_lock(&buf->attachments_lock);
+	dmabuf_exp_stats_detach(&attach->stats);
+	mutex_unlock(&buf->attachments_lock);
+
 	sgt = &attach->sgt;
 
 	/* release the scatterlist cache */
@@ -120,7 +162,7 @@ err0:
 static void exp_vmalloc_dma_buf_release(struct dma_buf *dbuf) {
 	struct exp_vmalloc_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	exp_vmalloc_buffer_put(dbuf->priv);
 }
@@ -136,7 +178,7 @@ static struct sg_table * exp_vmalloc_map_dma_buf(struct dma_buf_attachment *db_a
 	int err;
 #endif
 
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	if (!attach) {
 		pr_err("unexpected value, attach=%p\n", attach);
@@ -193,11 +235,55 @@ err0:
 }
 
 static void exp_vmalloc_unmap_dma_buf(struct dma_buf_attachment * db_attach, struct sg_table * sgt, enum dma_data_direction dma_dir) {
-	pr_info("db_attach=%p\n", db_attach);
+	pr_debug("db_attach=%p\n", db_attach);
 
 	/* nothing to be done here */
 }
 
+static int exp_vmalloc_sync_range(struct exp_vmalloc_buffer *buf,
+	unsigned long offset, unsigned long len, bool for_cpu)
+{
+	struct exp_vmalloc_attachment *attach;
+	struct dmabuf_exp_stats_attach *sattach;
+
+	mutex_lock(&buf->attachments_lock);
+	list_for_each_entry(sattach, &buf->stats.attachments, node) {
+		attach = container_of(sattach, struct exp_vmalloc_attachment, stats);
+		if (attach->dma_dir == DMA_NONE)
+			continue;
+
+		dmabuf_exp_sync_sgt_range(sattach->dev, &attach->sgt, attach->dma_dir, offset, len, for_cpu);
+	}
+	mutex_unlock(&buf->attachments_lock);
+
+	mutex_lock(&buf->segs_lock);
+	if (buf->segs.segs)
+		dmabuf_exp_sync_sgt_range(buf->dev, &buf->segs_sgt, buf->dma_dir, offset, len, for_cpu);
+	mutex_unlock(&buf->segs_lock);
+
+	return 0;
+}
+
+static int exp_vmalloc_begin_cpu_access(struct dma_buf *dbuf,
+	enum dma_data_direction direction)
+{
+	struct exp_vmalloc_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	return exp_vmalloc_sync_range(buf, 0, buf->size, true);
+}
+
+static int exp_vmalloc_end_cpu_access(struct dma_buf *dbuf,
+	enum dma_data_direction direction)
+{
+	struct exp_vmalloc_buffer *buf = dbuf->priv;
+
+	pr_debug("buf=%p\n", buf);
+
+	return exp_vmalloc_sync_range(buf, 0, buf->size, false);
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
 static void * exp_vmalloc_vmap(struct dma_buf *dbuf)
 #elif LINUX_VERSION_CODE < KERNEL_VERSION(5,19,0)
@@ -208,7 +294,7 @@ static int exp_vmalloc_vmap(struct dma_buf *dbuf, struct iosys_map *map)
 {
 	struct exp_vmalloc_buffer *buf = dbuf->priv;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5,11,0)
 	return buf->vaddr;
@@ -225,9 +311,10 @@ static int exp_vmalloc_vmap(struct dma_buf *dbuf, struct iosys_map *map)
 
 static int exp_vmalloc_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma) {
 	struct exp_vmalloc_buffer *buf = dbuf->priv;
+	unsigned long addr;
 	int ret;
 
-	pr_info("buf=%p\n", buf);
+	pr_debug("buf=%p\n", buf);
 
 	if (!buf) {
 		pr_err("unexpected value, buf=%p\n", buf);
@@ -235,12 +322,25 @@ static int exp_vmalloc_mmap(struct dma_buf *dbuf, struct vm_area_struct *vma) {
 		goto err0;
 	}
 
-	ret = remap_vmalloc_range(vma, buf->vaddr, 0);
-	if (ret) {
-		pr_err("remap_vmalloc_range() failed, err=%d\n", ret);
+	if (vma->vm_end - vma->vm_start > buf->size || vma->vm_pgoff) {
+		pr_err("unexpected value, size=%lu, pgoff=%lu\n",
+			vma->vm_end - vma->vm_start, vma->vm_pgoff);
+		ret = -EINVAL;
 		goto err0;
 	}
 
+	/*
+	 * vzalloc_node() memory is not VM_USERMAP, so insert the pages one by
+	 * one instead of remap_vmalloc_range().
+	 */
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+		ret = vm_insert_page(vma, addr, vmalloc_to_page(buf->vaddr + (addr - vma->vm_start)));
+		if (ret) {
+			pr_err("vm_insert_page() failed, err=%d\n", ret);
+			goto err0;
+		}
+	}
+
 	/*
 	 * Make sure that vm_areas for 2 buffers won't be merged together
 	 */
@@ -269,18 +369,112 @@ static const struct dma_buf_ops exp_vmalloc_buf_ops = {
 	.map_dma_buf = exp_vmalloc_map_dma_buf,
 	.unmap_dma_buf = exp_vmalloc_unmap_dma_buf,
 	.release = exp_vmalloc_dma_buf_release,
+	.begin_cpu_access = exp_vmalloc_begin_cpu_access,
+	.end_cpu_access = exp_vmalloc_end_cpu_access,
 	.mmap = exp_vmalloc_mmap,
 	.vmap = exp_vmalloc_vmap,
 };
 
-int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, int dma_dir) {
+static int exp_vmalloc_map_segs(struct exp_vmalloc_buffer *buf) {
+	int num_pages = PAGE_ALIGN(buf->size) / PAGE_SIZE;
+	struct sg_table *sgt = &buf->segs_sgt;
+	struct scatterlist *sg;
+	void *vaddr = buf->vaddr;
+	int ret;
+	int i;
+
+	ret = sg_alloc_table(sgt, num_pages, GFP_KERNEL);
+	if (ret) {
+		pr_err("sg_alloc_table() failed, err=%d\n", ret);
+		goto err0;
+	}
+
+	for_each_sg(sgt->sgl, sg, sgt->orig_nents, i) {
+		struct page *page = vmalloc_to_page(vaddr);
+
+		if (!page) {
+			pr_err("vmalloc_to_page() failed\n");
+			ret = -ENOMEM;
+			goto err1;
+		}
+		sg_set_page(sg, page, PAGE_SIZE, 0);
+		vaddr += PAGE_SIZE;
+	}
+
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,10,120)
+	sgt->nents = dma_map_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (!sgt->nents) {
+		pr_err("dma_map_sg_attrs() failed, sgt->nents=%d\n", (int)sgt->nents);
+		ret = -EIO;
+		goto err1;
+	}
+#else
+	ret = dma_map_sgtable(buf->dev, sgt, buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (ret) {
+		pr_err("dma_map_sgtable() failed, err=%d\n", ret);
+		goto err1;
+	}
+#endif
+
+	ret = dmabuf_exp_segs_init_sgt(&buf->segs, sgt);
+	if (ret) {
+		pr_err("dmabuf_exp_segs_init_sgt() failed, err=%d\n", ret);
+		goto err2;
+	}
+
+	return 0;
+
+err2:
+	dma_unmap_sg_attrs(buf->dev, sgt->sgl, sgt->orig_nents,
+		buf->dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+err1:
+	sg_free_table(sgt);
+err0:
+	return ret;
+}
+
+int qdmabuf_dmabuf_segs_vmalloc(struct dma_buf *dmabuf, const struct dmabuf_exp_segs **segs) {
+	struct exp_vmalloc_buffer *buf = dmabuf->priv;
+	int ret = 0;
+
+	if (dmabuf->ops != &exp_vmalloc_buf_ops)
+		return -ENOTTY;
+
+	mutex_lock(&buf->segs_lock);
+	if (!buf->segs.segs)
+		ret = exp_vmalloc_map_segs(buf);
+	mutex_unlock(&buf->segs_lock);
+
+	if (ret)
+		return ret;
+
+	*segs = &buf->segs;
+
+	return 0;
+}
+
+int qdmabuf_dmabuf_sync_vmalloc(struct dma_buf *dmabuf, unsigned long offset, unsigned long len, bool for_cpu) {
+	if (dmabuf->ops != &exp_vmalloc_buf_ops)
+		return -ENOTTY;
+
+	return exp_vmalloc_sync_range(dmabuf->priv, offset, len, for_cpu);
+}
+
+int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, int dma_dir, unsigned int flags, int node) {
 	struct exp_vmalloc_buffer *buf;
 	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
 	size_t size = PAGE_ALIGN(len);
 	struct dma_buf *dmabuf;
 	int ret;
 
-	pr_info("len=%d, fd_flags=%d\n", len, fd_flags);
+	pr_info("len=%d, fd_flags=%d, flags=0x%x, node=%d\n", len, fd_flags, flags, node);
+
+	/* the vmalloc area stays cacheable, see qdmabuf_dmabuf_alloc_dma_sg() */
+	if (flags & QDMABUF_ALLOC_FLAGS_MASK) {
+		pr_err("unexpected value, flags=0x%x\n", flags);
+		ret = -EINVAL;
+		goto err0;
+	}
 
 	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
 	if (!buf) {
@@ -289,15 +483,25 @@ int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, i
 		goto err0;
 	}
 
+	buf->dev = get_device(device);
+	if(!buf->dev) {
+		pr_err("get_device() failed\n");
+		ret = -EINVAL;
+		goto err1;
+	}
+
 	buf->size = size;
-	buf->vaddr = vmalloc_user(buf->size);
+	buf->vaddr = vzalloc_node(buf->size, node);
 	if (!buf->vaddr) {
-		pr_err("vmalloc_user() failed\n");
+		pr_err("vzalloc_node() failed\n");
 		ret = -ENOMEM;
-		goto err1;
+		goto err1_1;
 	}
+	exp_vmalloc_node_stats(buf, true);
 
 	buf->dma_dir = dma_dir;
+	mutex_init(&buf->attachments_lock);
+	mutex_init(&buf->segs_lock);
 
 	buf->handler.refcount = &buf->refcount;
 	buf->handler.put = exp_vmalloc_buffer_put;
@@ -316,6 +520,7 @@ int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, i
 		ret = PTR_ERR(dmabuf);
 		goto err2;
 	}
+	dmabuf_exp_stats_buf_add(&buf->stats, QDMABUF_TYPE_VMALLOC, buf->size);
 
 	ret = dma_buf_fd(dmabuf, fd_flags);
 	if (ret < 0) {
@@ -327,9 +532,14 @@ int qdmabuf_dmabuf_alloc_vmalloc(struct device* device, int len, int fd_flags, i
 	return ret;
 
 err3:
+	/* release() drops the last reference and frees the buffer */
 	dma_buf_put(dmabuf);
+	return ret;
 err2:
+	exp_vmalloc_node_stats(buf, false);
 	vfree(buf->vaddr);
+err1_1:
+	put_device(buf->dev);
 err1:
 	kfree(buf);
 err0:
@@ -36,14 +36,21 @@ static void sgt_dump(struct sg_table *sgt, bool full)
 	}
 }
 
-long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned long arg) {
+long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned int cmd, unsigned long arg) {
 	struct qdmabuf_alloc_args args;
+	/* QDMABUF_IOCTL_ALLOC passes the leading struct qdmabuf_alloc_args_v0 only */
+	size_t size = _IOC_SIZE(cmd);
 	long ret = 0;
 	struct device* dev = &device->pdev->dev;
+	ktime_t start;
+	int node;
+
+	BUILD_BUG_ON(offsetof(struct qdmabuf_alloc_args, flags) != sizeof(struct qdmabuf_alloc_args_v0));
 
 	pr_info("\n");
 
-	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	memset(&args, 0, sizeof(args));
+	ret = copy_from_user(&args, (void __user *)arg, size);
 	if (ret != 0) {
 		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
 
@@ -51,26 +58,60 @@ long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned long arg) {
 		goto err;
 	}
 
+	if ((args.flags & ~QDMABUF_ALLOC_FLAGS_MASK) ||
+		(args.flags & QDMABUF_ALLOC_FLAGS_MASK) == QDMABUF_ALLOC_FLAGS_MASK) {
+		pr_err("unexpected value, args.flags=0x%x\n", args.flags);
+
+		ret = -EINVAL;
+		goto err;
+	}
+
+	if (args.numa_node) {
+		if (args.numa_node > MAX_NUMNODES) {
+			pr_err("unexpected value, args.numa_node=%u\n", args.numa_node);
+
+			ret = -EINVAL;
+			goto err;
+		}
+
+		node = args.numa_node - 1;
+		if (!node_online(node)) {
+			pr_err("unexpected value, args.numa_node=%u\n", args.numa_node);
+
+			ret = -EINVAL;
+			goto err;
+		}
+	} else {
+		node = dev_to_node(dev);
+	}
+
+	start = ktime_get();
 	switch(args.type) {
 	case QDMABUF_TYPE_DMA_CONTIG:
 		ret = qdmabuf_dmabuf_alloc_dma_contig(
-			dev, args.len, args.fd_flags, args.dma_dir);
+			dev, args.len, args.fd_flags, args.dma_dir, args.flags, node);
 		break;
 
 	case QDMABUF_TYPE_DMA_SG:
 		ret = qdmabuf_dmabuf_alloc_dma_sg(
-			dev, args.len, args.fd_flags, args.dma_dir);
+			dev, args.len, args.fd_flags, args.dma_dir, args.flags, node);
 		break;
 
 	case QDMABUF_TYPE_VMALLOC:
 		ret = qdmabuf_dmabuf_alloc_vmalloc(
-			dev, args.len, args.fd_flags, args.dma_dir);
+			dev, args.len, args.fd_flags, args.dma_dir, args.flags, node);
+		break;
+
+	case QDMABUF_TYPE_CARVEOUT:
+		ret = qdmabuf_dmabuf_alloc_carveout(device->carveout,
+			dev, args.len, args.fd_flags, args.dma_dir, args.flags, node);
 		break;
 
 	default:
 		ret = -EINVAL;
 		break;
 	}
+	dmabuf_exp_stats_alloc_done(args.type, start, ret);
 
 	if (ret < 0) {
 		pr_err("qdmabuf_dmabuf_alloc_xxx() failed, err=%d\n", (int)ret);
@@ -79,7 +120,7 @@ long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned long arg) {
 
 	args.fd = (__u32)ret;
 
-	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	ret = copy_to_user((void __user *)arg, &args, size);
 	if (ret != 0) {
 		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
 
@@ -175,3 +216,177 @@ err1:
 err0:
 	return ret;
 }
+
+long qdmabuf_ioctl_query_segs(struct qdmabuf_device* device, unsigned long arg) {
+	long ret;
+	struct qdmabuf_query_segs_args args;
+	struct dma_buf *dmabuf;
+	const struct dmabuf_exp_segs *segs;
+	__u32 nsegs;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	dmabuf = dma_buf_get(args.fd);
+	if (IS_ERR(dmabuf)) {
+		pr_err("dma_buf_get() failed, dmabuf=%p\n", dmabuf);
+
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	ret = dmabuf_exp_get_segs(dmabuf, &segs);
+	if (ret) {
+		pr_err("dmabuf_exp_get_segs() failed, err=%d\n", (int)ret);
+
+		ret = (ret == -ENOTTY) ? -EINVAL : ret;
+		goto err1;
+	}
+
+	nsegs = min_t(__u32, args.nsegs, segs->nsegs);
+	if (args.segs && nsegs) {
+		if (copy_to_user(u64_to_user_ptr(args.segs), segs->segs, nsegs * sizeof(*segs->segs))) {
+			pr_err("copy_to_user() failed\n");
+
+			ret = -EFAULT;
+			goto err1;
+		}
+	}
+
+	args.flags = (segs->nsegs == 1) ? QDMABUF_SEGS_FLAG_CONTIGUOUS : 0;
+	args.size = dmabuf->size;
+	args.nsegs = segs->nsegs;
+
+	if (copy_to_user((void __user *)arg, &args, sizeof(args))) {
+		pr_err("copy_to_user() failed\n");
+
+		ret = -EFAULT;
+		goto err1;
+	}
+
+	dma_buf_put(dmabuf);
+
+	return 0;
+
+err1:
+	dma_buf_put(dmabuf);
+err0:
+	return ret;
+}
+
+long qdmabuf_ioctl_sync(struct qdmabuf_device* device, unsigned long arg) {
+	long ret;
+	struct qdmabuf_sync_args args;
+	struct dma_buf *dmabuf;
+	bool for_cpu;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	if ((args.flags & ~QDMABUF_SYNC_VALID_FLAGS_MASK) || !(args.flags & QDMABUF_SYNC_RW)) {
+		pr_err("unexpected value, args.flags=0x%x\n", args.flags);
+
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	dmabuf = dma_buf_get(args.fd);
+	if (IS_ERR(dmabuf)) {
+		pr_err("dma_buf_get() failed, dmabuf=%p\n", dmabuf);
+
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	if (args.offset >= dmabuf->size || args.len > dmabuf->size - args.offset) {
+		pr_err("unexpected value, args.offset=%llu, args.len=%llu, size=%lu\n",
+			args.offset, args.len, (unsigned long)dmabuf->size);
+
+		ret = -EINVAL;
+		goto err1;
+	}
+
+	if (!args.len)
+		args.len = dmabuf->size - args.offset;
+
+	/* nothing to clean if the CPU only read the range */
+	for_cpu = !(args.flags & QDMABUF_SYNC_END);
+	if (!for_cpu && !(args.flags & QDMABUF_SYNC_WRITE)) {
+		dma_buf_put(dmabuf);
+
+		return 0;
+	}
+
+	ret = dmabuf_exp_sync_range(dmabuf, args.offset, args.len, for_cpu);
+	if (ret) {
+		pr_err("dmabuf_exp_sync_range() failed, err=%d\n", (int)ret);
+
+		ret = (ret == -ENOTTY) ? -EINVAL : ret;
+		goto err1;
+	}
+
+	dma_buf_put(dmabuf);
+
+	return 0;
+
+err1:
+	dma_buf_put(dmabuf);
+err0:
+	return ret;
+}
+
+long qdmabuf_ioctl_import(struct qdmabuf_device* device, unsigned long arg) {
+	struct qdmabuf_import_args args;
+	long ret = 0;
+	struct device* dev = &device->pdev->dev;
+	ktime_t start;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	if (args.flags & ~QDMABUF_IMPORT_FLAG_MEMFD) {
+		pr_err("unexpected value, args.flags=0x%x\n", args.flags);
+
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	start = ktime_get();
+	ret = qdmabuf_dmabuf_import_user(dev, args.addr, args.len,
+		args.memfd, args.flags, args.fd_flags, args.dma_dir);
+	dmabuf_exp_stats_alloc_done(DMABUF_EXP_TYPE_USER, start, ret);
+	if (ret < 0) {
+		pr_err("qdmabuf_dmabuf_import_user() failed, err=%d\n", (int)ret);
+		goto err0;
+	}
+
+	args.fd = (__u32)ret;
+
+	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return ret;
+}
@@ -1,4 +1,7 @@
 #include "device.h"
 
-long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned long arg);
+long qdmabuf_ioctl_alloc(struct qdmabuf_device* device, unsigned int cmd, unsigned long arg);
 long qdmabuf_ioctl_info(struct qdmabuf_device* device, unsigned long arg);
+long qdmabuf_ioctl_query_segs(struct qdmabuf_device* device, unsigned long arg);
+long qdmabuf_ioctl_sync(struct qdmabuf_device* device, unsigned long arg);
+long qdmabuf_ioctl_import(struct qdmabuf_device* device, unsigned long arg);
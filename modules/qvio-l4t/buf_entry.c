@@ -46,6 +46,9 @@ static void __buf_entry_free(struct kref *ref) {
 	// pr_info("self=%px\n", self);
 
 	switch(self->buf.buf_type) {
+	case QVIO_BUF_TYPE_EXTERNAL:
+		break;
+
 	case QVIO_BUF_TYPE_MMAP:
 		dma_sync_sgtable_for_cpu(self->dev, self->u.userptr.sgt, self->dma_dir);
 		dma_unmap_sg(self->dev, self->u.mmap.sgt->sgl, self->u.mmap.sgt->nents, self->dma_dir);
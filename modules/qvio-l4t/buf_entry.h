@@ -7,8 +7,12 @@
 #include "dma_block.h"
 #include "uapi/qvio-l4t.h"
 
-#define QVIO_MAX_DESC_BLOCKS	16
+#define QVIO_MAX_DESC_BLOCKS	32
 #define QVIO_MAX_PLANES			4
+#define QVIO_MAX_STRIPES		4
+
+// buf.buf_type of entries whose memory is owned by the caller (e.g. vb2)
+#define QVIO_BUF_TYPE_EXTERNAL	0
 
 struct qvio_buf_entry {
 	struct kref ref;
@@ -41,6 +45,31 @@ struct qvio_buf_entry {
 	// vars for XDMA/QDMA regs
 	dma_addr_t dsc_adr;
 	u16 dsc_adj;
+
+	// descriptor chains of a frame striped over several channels, stripes[0] is dsc_adr/dsc_adj
+	struct {
+		dma_addr_t dsc_adr;
+		u16 dsc_adj;
+		u32 descs;
+		size_t bytes;
+	} stripes[QVIO_MAX_STRIPES];
+	int nstripes;
+
+	// filled by the descriptor builder of the engine
+	int descs;
+	size_t bytes;
+
+	// owner cookie, e.g. the vb2 buffer of a V4L2 node
+	void* private_data;
+
+	// timing of the last run, ktime_get_ns() at QBUF, ap_start and completion
+	u64 qbuf_ns;
+	u64 start_ns;
+	u64 done_ns;
+	u32 sequence; // completion count of the video queue
+
+	// paced engines start no earlier than this, ns of CLOCK_MONOTONIC, 0 for as soon as possible
+	u64 pts_ns;
 };
 
 struct qvio_buf_entry* qvio_buf_entry_new(void);
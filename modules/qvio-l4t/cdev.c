@@ -77,6 +77,7 @@ int qvio_cdev_start(struct qvio_cdev* self, struct qvio_cdev_class* cls) {
 		goto err1;
 	}
 
+	self->device = new_device;
 	cls->next_minor++;
 
 	return 0;
@@ -16,8 +16,10 @@ struct qvio_cdev_class {
 struct qvio_cdev {
 	dev_t cdevno;
 	struct cdev cdev;
+	struct device* device; // sysfs node, valid between start and stop
 
 	void* private_data;
+	void* attr_data; // of the sysfs attributes of device, e.g. desc_policy/
 	const struct file_operations* fops;
 };
 
@@ -0,0 +1,260 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include "meta.h"
+
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/module.h>
+#include <media/videobuf2-v4l2.h>
+#include <media/videobuf2-vmalloc.h>
+#include <media/v4l2-dev.h>
+#include <media/v4l2-ioctl.h>
+
+struct __meta_buffer {
+	struct vb2_v4l2_buffer vb;
+	struct list_head node;
+};
+
+static int __ioctl_querycap(struct file *file, void *fh, struct v4l2_capability *capability);
+static int __ioctl_enum_fmt(struct file *file, void *fh, struct v4l2_fmtdesc *format);
+static int __ioctl_g_fmt(struct file *file, void *fh, struct v4l2_format *format);
+
+static const struct v4l2_file_operations __meta_fops = {
+	.owner          = THIS_MODULE    ,
+	.open           = v4l2_fh_open   ,
+	.release        = vb2_fop_release,
+	.unlocked_ioctl = video_ioctl2   ,
+	.read           = vb2_fop_read   ,
+	.mmap           = vb2_fop_mmap   ,
+	.poll           = vb2_fop_poll   ,
+};
+
+static const struct v4l2_ioctl_ops __meta_ioctl_ops = {
+	.vidioc_querycap               = __ioctl_querycap,
+	.vidioc_enum_fmt_meta_cap      = __ioctl_enum_fmt,
+	.vidioc_g_fmt_meta_cap         = __ioctl_g_fmt,
+	.vidioc_s_fmt_meta_cap         = __ioctl_g_fmt, // fixed layout
+	.vidioc_try_fmt_meta_cap       = __ioctl_g_fmt,
+	.vidioc_reqbufs                = vb2_ioctl_reqbufs,
+	.vidioc_querybuf               = vb2_ioctl_querybuf,
+	.vidioc_qbuf                   = vb2_ioctl_qbuf,
+	.vidioc_expbuf                 = vb2_ioctl_expbuf,
+	.vidioc_dqbuf                  = vb2_ioctl_dqbuf,
+	.vidioc_create_bufs            = vb2_ioctl_create_bufs,
+	.vidioc_prepare_buf            = vb2_ioctl_prepare_buf,
+	.vidioc_streamon               = vb2_ioctl_streamon,
+	.vidioc_streamoff              = vb2_ioctl_streamoff,
+};
+
+void qvio_meta_init(struct qvio_meta* self) {
+	mutex_init(&self->queue_mutex);
+	mutex_init(&self->device_mutex);
+	spin_lock_init(&self->lock);
+	INIT_LIST_HEAD(&self->buffers);
+}
+
+static int __queue_setup(struct vb2_queue *queue,
+	unsigned int *num_buffers, unsigned int *num_planes,
+	unsigned int sizes[], struct device *alloc_devs[]) {
+
+	if(*num_planes) {
+		if(*num_planes != 1 || sizes[0] < sizeof(struct qvio_frame_meta)) {
+			pr_err("unexpected value, *num_planes=%u sizes[0]=%u\n", *num_planes, sizes[0]);
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	*num_planes = 1;
+	sizes[0] = sizeof(struct qvio_frame_meta);
+
+	return 0;
+}
+
+static int __buf_prepare(struct vb2_buffer *buffer) {
+	if(vb2_plane_size(buffer, 0) < sizeof(struct qvio_frame_meta)) {
+		pr_err("unexpected value, vb2_plane_size()=%lu\n", vb2_plane_size(buffer, 0));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void __buf_queue(struct vb2_buffer *buffer) {
+	struct qvio_meta* self = vb2_get_drv_priv(buffer->vb2_queue);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
+	struct __meta_buffer* buf = container_of(vbuf, struct __meta_buffer, vb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	list_add_tail(&buf->node, &self->buffers);
+	spin_unlock_irqrestore(&self->lock, flags);
+}
+
+static int __start_streaming(struct vb2_queue *queue, unsigned int count) {
+	struct qvio_meta* self = vb2_get_drv_priv(queue);
+
+	// frames arrive whenever the image node is streaming
+	self->drops = 0;
+
+	return 0;
+}
+
+static void __stop_streaming(struct vb2_queue *queue) {
+	struct qvio_meta* self = vb2_get_drv_priv(queue);
+	struct __meta_buffer* buf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	while(! list_empty(&self->buffers)) {
+		buf = list_first_entry(&self->buffers, struct __meta_buffer, node);
+		list_del(&buf->node);
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
+	}
+	spin_unlock_irqrestore(&self->lock, flags);
+}
+
+static const struct vb2_ops __meta_vb2_ops = {
+	.queue_setup     = __queue_setup,
+	.buf_prepare     = __buf_prepare,
+	.buf_queue       = __buf_queue,
+	.start_streaming = __start_streaming,
+	.stop_streaming  = __stop_streaming,
+	.wait_prepare    = vb2_ops_wait_prepare,
+	.wait_finish     = vb2_ops_wait_finish,
+};
+
+static void __vdev_release(struct video_device *vdev) {
+	struct qvio_meta* self = video_get_drvdata(vdev);
+
+	pr_info("self=%p\n", self);
+
+	// the queue and the files are gone, self may go with the release() below
+	mutex_lock(&self->queue_mutex);
+	vb2_queue_release(&self->queue);
+	mutex_unlock(&self->queue_mutex);
+	video_device_release(vdev);
+
+	if(self->release)
+		self->release(self);
+}
+
+int qvio_meta_start(struct qvio_meta* self, struct v4l2_device* v4l2_dev, const char* bus_info) {
+	int err;
+
+	pr_info("self=%p\n", self);
+
+	snprintf(self->bus_info, sizeof(self->bus_info), "%s", bus_info);
+
+	self->queue.type = V4L2_BUF_TYPE_META_CAPTURE;
+	self->queue.io_modes = VB2_MMAP | VB2_USERPTR | VB2_READ;
+	self->queue.drv_priv = self;
+	self->queue.lock = &self->queue_mutex;
+	self->queue.buf_struct_size = sizeof(struct __meta_buffer);
+	self->queue.mem_ops = &vb2_vmalloc_memops;
+	self->queue.ops = &__meta_vb2_ops;
+	self->queue.timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	err = vb2_queue_init(&self->queue);
+	if(err) {
+		pr_err("vb2_queue_init() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	self->vdev = video_device_alloc();
+	if(! self->vdev) {
+		pr_err("video_device_alloc() failed\n");
+		err = -ENOMEM;
+		goto err0;
+	}
+
+	snprintf(self->vdev->name, sizeof(self->vdev->name), "%s-meta", v4l2_dev->name);
+	self->vdev->v4l2_dev = v4l2_dev;
+	self->vdev->vfl_dir = VFL_DIR_RX;
+	self->vdev->fops = &__meta_fops;
+	self->vdev->ioctl_ops = &__meta_ioctl_ops;
+	self->vdev->release = __vdev_release; // at the last close after video_unregister_device()
+	self->vdev->queue = &self->queue;
+	self->vdev->lock = &self->device_mutex;
+	video_set_drvdata(self->vdev, self);
+	self->vdev->device_caps = V4L2_CAP_META_CAPTURE | V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
+	err = video_register_device(self->vdev, VFL_TYPE_VIDEO, -1);
+	if(err) {
+		pr_err("video_register_device() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	return 0;
+
+err1:
+	video_device_release(self->vdev);
+	self->vdev = NULL;
+err0:
+	return err;
+}
+
+void qvio_meta_stop(struct qvio_meta* self) {
+	pr_info("\n");
+
+	if(! self->vdev)
+		return;
+
+	// released by __vdev_release() once the files still open are closed
+	video_unregister_device(self->vdev);
+	self->vdev = NULL;
+}
+
+void qvio_meta_frame_done(struct qvio_meta* self, struct qvio_frame_meta* frame_meta) {
+	struct __meta_buffer* buf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	if(list_empty(&self->buffers)) {
+		self->drops++;
+		spin_unlock_irqrestore(&self->lock, flags);
+		return;
+	}
+
+	buf = list_first_entry(&self->buffers, struct __meta_buffer, node);
+	list_del(&buf->node);
+	frame_meta->meta_drops = self->drops;
+	spin_unlock_irqrestore(&self->lock, flags);
+
+	memcpy(vb2_plane_vaddr(&buf->vb.vb2_buf, 0), frame_meta, sizeof(struct qvio_frame_meta));
+	vb2_set_plane_payload(&buf->vb.vb2_buf, 0, sizeof(struct qvio_frame_meta));
+	buf->vb.vb2_buf.timestamp = frame_meta->timestamp;
+	buf->vb.sequence = frame_meta->sequence;
+	buf->vb.field = V4L2_FIELD_NONE;
+	vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
+}
+
+static int __ioctl_querycap(struct file *file, void *fh, struct v4l2_capability *capability) {
+	struct qvio_meta* self = video_drvdata(file);
+	struct video_device* vdev = video_devdata(file);
+
+	memset(capability, 0, sizeof(struct v4l2_capability));
+	capability->version = LINUX_VERSION_CODE;
+	snprintf(capability->driver, sizeof(capability->driver), "qvio");
+	snprintf(capability->card, sizeof(capability->card), "qvio");
+	strscpy(capability->bus_info, self->bus_info, sizeof(capability->bus_info));
+	capability->capabilities = vdev->device_caps | V4L2_CAP_DEVICE_CAPS;
+	capability->device_caps = vdev->device_caps;
+
+	return 0;
+}
+
+static int __ioctl_enum_fmt(struct file *file, void *fh, struct v4l2_fmtdesc *format) {
+	if(format->index != 0)
+		return -EINVAL;
+
+	format->pixelformat = QVIO_META_FMT_FRAME;
+
+	return 0;
+}
+
+static int __ioctl_g_fmt(struct file *file, void *fh, struct v4l2_format *format) {
+	format->fmt.meta.dataformat = QVIO_META_FMT_FRAME;
+	format->fmt.meta.buffersize = sizeof(struct qvio_frame_meta);
+
+	return 0;
+}
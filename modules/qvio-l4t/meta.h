@@ -0,0 +1,35 @@
+#ifndef __QVIO_META_H__
+#define __QVIO_META_H__
+
+#include <media/videobuf2-core.h>
+#include <media/v4l2-device.h>
+#include <linux/videodev2.h>
+#include <linux/spinlock.h>
+
+#include "uapi/qvio-l4t.h"
+
+// companion V4L2_BUF_TYPE_META_CAPTURE node, one qvio_frame_meta per frame
+struct qvio_meta {
+	struct vb2_queue queue;
+	struct mutex queue_mutex;
+	struct mutex device_mutex;
+	struct video_device *vdev;
+	char bus_info[32];
+
+	spinlock_t lock;
+	struct list_head buffers; // queued, filled by qvio_meta_frame_done()
+	u32 drops;
+
+	// called once the node is unregistered and its last file closed
+	void (*release)(struct qvio_meta* self);
+};
+
+void qvio_meta_init(struct qvio_meta* self);
+
+int qvio_meta_start(struct qvio_meta* self, struct v4l2_device* v4l2_dev, const char* bus_info);
+void qvio_meta_stop(struct qvio_meta* self);
+
+// completion path, any context
+void qvio_meta_frame_done(struct qvio_meta* self, struct qvio_frame_meta* frame_meta);
+
+#endif // __QVIO_META_H__
@@ -7,6 +7,8 @@
 #include "cdev.h"
 #include "platform_device.h"
 #include "pci_device.h"
+#include "stats.h"
+#include "selftest.h"
 
 #define DRV_MODULE_DESC		"QCAP Video I/O Driver"
 
@@ -25,6 +27,9 @@ static int __init qvio_mod_init(void)
 
 	pr_info("%s\n", version);
 
+	qvio_stats_register();
+	qvio_selftest_register();
+
 #if 0
 	err = qvio_platform_device_register();
 	if (err != 0) {
@@ -46,6 +51,8 @@ err1:
 	qvio_platform_device_unregister();
 err0:
 #endif
+	qvio_selftest_unregister();
+	qvio_stats_unregister();
 	return err;
 }
 
@@ -58,6 +65,9 @@ static void __exit qvio_mod_exit(void)
 #if 0
 	qvio_platform_device_unregister();
 #endif
+
+	qvio_selftest_unregister();
+	qvio_stats_unregister();
 }
 
 module_init(qvio_mod_init);
@@ -5,10 +5,13 @@
 #include <linux/aer.h>
 #include <linux/pci.h>
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/iommu.h>
 
 #include "pci_device.h"
 #include "pci_device_7024.h"
 #include "pci_device_e382.h"
+#include "xdma_desc.h"
 
 #if defined(RHEL_RELEASE_CODE)
 #	define PCI_AER_NAMECHANGE (RHEL_RELEASE_CODE >= RHEL_RELEASE_VERSION(8, 3))
@@ -16,6 +19,18 @@
 #	define PCI_AER_NAMECHANGE (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0))
 #endif
 
+static int iommu_contig = 1;
+module_param(iommu_contig, int, 0444);
+MODULE_PARM_DESC(iommu_contig, "map each buffer to a single IOVA segment behind an IOMMU, 0 to keep the 64KB default segments");
+
+static int pcie_mrrs = 4096;
+module_param(pcie_mrrs, int, 0444);
+MODULE_PARM_DESC(pcie_mrrs, "PCIe Max Read Request Size set at probe, 128 to 4096");
+
+static int pcie_no_snoop = 0;
+module_param(pcie_no_snoop, int, 0444);
+MODULE_PARM_DESC(pcie_no_snoop, "enable PCIe no-snoop at probe, only safe when the buffers are synced by the DMA API");
+
 static ssize_t dma_block_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t dma_block_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t dma_sync_show(struct device *dev, struct device_attribute *attr, char *buf);
@@ -26,17 +41,35 @@ static ssize_t test_case_show(struct device *dev, struct device_attribute *attr,
 static ssize_t test_case_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t zdev_ver_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t zdev_ticks_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t zdev_clock_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t zdev_value0_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t zdev_value0_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_mps_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t pcie_mps_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_mrrs_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t pcie_mrrs_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_relaxed_ordering_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t pcie_relaxed_ordering_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_ext_tags_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t pcie_ext_tags_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_no_snoop_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t pcie_no_snoop_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pcie_link_show(struct device *dev, struct device_attribute *attr, char *buf);
 static int map_single_bar(struct qvio_pci_device *self, int idx);
 static int map_bars(struct qvio_pci_device* self);
 static void unmap_bars(struct qvio_pci_device *self);
 static void pci_enable_capability(struct pci_dev *pdev, int cap);
+static int pcie_mps_allowed(struct pci_dev *pdev);
+static bool pcie_ro_allowed(struct pci_dev *pdev);
+static bool pcie_ext_tags_allowed(struct pci_dev *pdev);
+static void pcie_tune(struct pci_dev *pdev);
+static void pcie_log_link(struct pci_dev *pdev);
 static void pci_check_intr_pend(struct pci_dev *pdev);
 static void pci_keep_intx_enabled(struct pci_dev *pdev);
 static int request_regions(struct qvio_pci_device *self);
 static void release_regions(struct qvio_pci_device *self, struct pci_dev* pdev);
 static int set_dma_mask(struct pci_dev *pdev);
+static void set_dma_segments(struct pci_dev *pdev);
 #ifndef arch_msi_check_device
 static int arch_msi_check_device(struct pci_dev *dev, int nvec, int type);
 #endif
@@ -253,6 +286,13 @@ static ssize_t zdev_ticks_show(struct device *dev, struct device_attribute *attr
 	return qvio_zdev_attr_ticks_show(zdev, buf);
 }
 
+static ssize_t zdev_clock_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct qvio_pci_device* self = dev_get_drvdata(dev);
+	struct qvio_zdev* zdev = self->zdev;
+
+	return qvio_zdev_attr_clock_show(zdev, buf);
+}
+
 static ssize_t zdev_value0_show(struct device *dev, struct device_attribute *attr, char *buf) {
 	struct qvio_pci_device* self = dev_get_drvdata(dev);
 	struct qvio_zdev* zdev = self->zdev;
@@ -267,13 +307,229 @@ static ssize_t zdev_value0_store(struct device *dev, struct device_attribute *at
 	return qvio_zdev_attr_value0_store(zdev, buf, count);
 }
 
+// claim every engine queue, fails with -EBUSY while one of them is streaming
+static int pcie_engines_claim(struct qvio_pci_device* self, struct qvio_video_queue** queues, int count)
+{
+	int claimed;
+	int err;
+
+	for (claimed = 0; claimed < count; claimed++) {
+		if (!queues[claimed])
+			continue;
+
+		err = qvio_video_queue_claim(queues[claimed], self, NULL);
+		if (err) {
+			pr_err("qvio_video_queue_claim() failed, err=%d\n", err);
+			goto err0;
+		}
+	}
+
+	return 0;
+
+err0:
+	while (claimed--) {
+		if (queues[claimed])
+			qvio_video_queue_release(queues[claimed], self);
+	}
+
+	return err;
+}
+
+static void pcie_engines_release(struct qvio_pci_device* self, struct qvio_video_queue** queues, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (queues[i])
+			qvio_video_queue_release(queues[i], self);
+	}
+}
+
+#define PCIE_ENGINES_MAX 7
+
+static int pcie_engines_queues(struct qvio_pci_device* self, struct qvio_video_queue** queues)
+{
+	int count = 0;
+
+	queues[count++] = self->xdma_wr ? self->xdma_wr->video_queue : NULL;
+	queues[count++] = self->xdma_rd ? self->xdma_rd->video_queue : NULL;
+	queues[count++] = self->qdma_wr_0 ? self->qdma_wr_0->video_queue : NULL;
+	queues[count++] = self->qdma_wr_1 ? self->qdma_wr_1->video_queue : NULL;
+	queues[count++] = self->qdma_wr_2 ? self->qdma_wr_2->video_queue : NULL;
+	queues[count++] = self->qdma_gang ? self->qdma_gang->video_queue : NULL;
+	queues[count++] = self->qdma_rd ? self->qdma_rd->video_queue : NULL;
+
+	return count;
+}
+
+static ssize_t pcie_devctl_show(struct device *dev, u16 bit, char *buf)
+{
+	u16 devctl = 0;
+
+	pcie_capability_read_word(to_pci_dev(dev), PCI_EXP_DEVCTL, &devctl);
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", !!(devctl & bit));
+}
+
+static ssize_t pcie_devctl_store(struct device *dev, u16 bit, bool allowed, const char *buf, size_t count)
+{
+	struct pci_dev *pdev = to_pci_dev(dev);
+	int value;
+	int err;
+
+	err = kstrtoint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value && !allowed) {
+		pr_err("unexpected value, PCI_EXP_DEVCTL bit 0x%x not allowed\n", bit);
+		return -EINVAL;
+	}
+
+	if (value)
+		err = pcie_capability_set_word(pdev, PCI_EXP_DEVCTL, bit);
+	else
+		err = pcie_capability_clear_word(pdev, PCI_EXP_DEVCTL, bit);
+	if (err) {
+		pr_err("pcie_capability_set/clear_word() failed, err=%d\n", err);
+		return pcibios_err_to_errno(err);
+	}
+
+	return count;
+}
+
+static ssize_t pcie_mps_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", pcie_get_mps(to_pci_dev(dev)));
+}
+
+static ssize_t pcie_mps_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct qvio_pci_device* self = dev_get_drvdata(dev);
+	struct pci_dev *pdev = to_pci_dev(dev);
+	struct qvio_video_queue* queues[PCIE_ENGINES_MAX];
+	int queues_count;
+	int mps;
+	int err;
+
+	err = kstrtoint(buf, 0, &mps);
+	if (err)
+		return err;
+
+	if (mps > pcie_mps_allowed(pdev)) {
+		pr_err("unexpected value, mps=%d > %d\n", mps, pcie_mps_allowed(pdev));
+		return -EINVAL;
+	}
+
+	// no TLPs in flight while the link is retuned
+	queues_count = pcie_engines_queues(self, queues);
+	err = pcie_engines_claim(self, queues, queues_count);
+	if (err)
+		return err;
+
+	err = pcie_set_mps(pdev, mps);
+	pcie_engines_release(self, queues, queues_count);
+	if (err) {
+		pr_err("pcie_set_mps() failed, err=%d\n", err);
+		return err;
+	}
+
+	return count;
+}
+
+static ssize_t pcie_mrrs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", pcie_get_readrq(to_pci_dev(dev)));
+}
+
+static ssize_t pcie_mrrs_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct qvio_pci_device* self = dev_get_drvdata(dev);
+	struct qvio_video_queue* queues[PCIE_ENGINES_MAX];
+	int queues_count;
+	int mrrs;
+	int err;
+
+	err = kstrtoint(buf, 0, &mrrs);
+	if (err)
+		return err;
+
+	queues_count = pcie_engines_queues(self, queues);
+	err = pcie_engines_claim(self, queues, queues_count);
+	if (err)
+		return err;
+
+	err = pcie_set_readrq(to_pci_dev(dev), mrrs);
+	pcie_engines_release(self, queues, queues_count);
+	if (err) {
+		pr_err("pcie_set_readrq() failed, err=%d\n", err);
+		return err;
+	}
+
+	return count;
+}
+
+static ssize_t pcie_relaxed_ordering_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return pcie_devctl_show(dev, PCI_EXP_DEVCTL_RELAX_EN, buf);
+}
+
+static ssize_t pcie_relaxed_ordering_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	// relaxed ordering must be allowed by the root port
+	return pcie_devctl_store(dev, PCI_EXP_DEVCTL_RELAX_EN,
+		pcie_ro_allowed(to_pci_dev(dev)), buf, count);
+}
+
+static ssize_t pcie_ext_tags_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return pcie_devctl_show(dev, PCI_EXP_DEVCTL_EXT_TAG, buf);
+}
+
+static ssize_t pcie_ext_tags_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return pcie_devctl_store(dev, PCI_EXP_DEVCTL_EXT_TAG,
+		pcie_ext_tags_allowed(to_pci_dev(dev)), buf, count);
+}
+
+static ssize_t pcie_no_snoop_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return pcie_devctl_show(dev, PCI_EXP_DEVCTL_NOSNOOP_EN, buf);
+}
+
+static ssize_t pcie_no_snoop_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	return pcie_devctl_store(dev, PCI_EXP_DEVCTL_NOSNOOP_EN, true, buf, count);
+}
+
+static ssize_t pcie_link_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct pci_dev *pdev = to_pci_dev(dev);
+	u32 lnkcap = 0;
+	u16 lnksta = 0;
+
+	pcie_capability_read_dword(pdev, PCI_EXP_LNKCAP, &lnkcap);
+	pcie_capability_read_word(pdev, PCI_EXP_LNKSTA, &lnksta);
+
+	return snprintf(buf, PAGE_SIZE, "Gen%d x%d (Gen%d x%d)\n",
+		lnksta & PCI_EXP_LNKSTA_CLS, (lnksta & PCI_EXP_LNKSTA_NLW) >> PCI_EXP_LNKSTA_NLW_SHIFT,
+		lnkcap & PCI_EXP_LNKCAP_SLS, (lnkcap & PCI_EXP_LNKCAP_MLW) >> 4);
+}
+
 static DEVICE_ATTR(dma_block, 0644, dma_block_show, dma_block_store);
 static DEVICE_ATTR(dma_sync, 0664, dma_sync_show, dma_sync_store);
 static DEVICE_ATTR(dma_block_index, 0644, dma_block_index_show, dma_block_index_store);
 static DEVICE_ATTR(test_case, 0644, test_case_show, test_case_store);
 static DEVICE_ATTR(zdev_ver, 0444, zdev_ver_show, NULL);
 static DEVICE_ATTR(zdev_ticks, 0444, zdev_ticks_show, NULL);
+static DEVICE_ATTR(zdev_clock, 0444, zdev_clock_show, NULL);
 static DEVICE_ATTR(zdev_value0, 0644, zdev_value0_show, zdev_value0_store);
+static DEVICE_ATTR(pcie_mps, 0644, pcie_mps_show, pcie_mps_store);
+static DEVICE_ATTR(pcie_mrrs, 0644, pcie_mrrs_show, pcie_mrrs_store);
+static DEVICE_ATTR(pcie_relaxed_ordering, 0644, pcie_relaxed_ordering_show, pcie_relaxed_ordering_store);
+static DEVICE_ATTR(pcie_ext_tags, 0644, pcie_ext_tags_show, pcie_ext_tags_store);
+static DEVICE_ATTR(pcie_no_snoop, 0644, pcie_no_snoop_show, pcie_no_snoop_store);
+static DEVICE_ATTR(pcie_link, 0444, pcie_link_show, NULL);
 
 static int map_single_bar(struct qvio_pci_device *self, int idx)
 {
@@ -376,6 +632,130 @@ static void pci_enable_capability(struct pci_dev *pdev, int cap)
 }
 #endif
 
+/* largest MPS of the device within the current MPS of its upstream ports */
+static int pcie_mps_allowed(struct pci_dev *pdev)
+{
+	struct pci_dev *bridge;
+	int mps = 128 << pdev->pcie_mpss;
+
+	for (bridge = pci_upstream_bridge(pdev); bridge; bridge = pci_upstream_bridge(bridge)) {
+		if (!pci_is_pcie(bridge))
+			break;
+
+		mps = min(mps, pcie_get_mps(bridge));
+	}
+
+	return mps;
+}
+
+/* the PCI core quirks root ports known to mishandle relaxed ordering TLPs */
+static bool pcie_ro_allowed(struct pci_dev *pdev)
+{
+#if KERNEL_VERSION(4, 13, 0) <= LINUX_VERSION_CODE
+	struct pci_dev *bridge;
+
+	for (bridge = pci_upstream_bridge(pdev); bridge; bridge = pci_upstream_bridge(bridge)) {
+		if (bridge->dev_flags & PCI_DEV_FLAGS_NO_RELAXED_ORDERING)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+static bool pcie_ext_tags_allowed(struct pci_dev *pdev)
+{
+	u32 devcap = 0;
+
+	pcie_capability_read_dword(pdev, PCI_EXP_DEVCAP, &devcap);
+	if (!(devcap & PCI_EXP_DEVCAP_EXT_TAG))
+		return false;
+
+#if KERNEL_VERSION(4, 13, 0) <= LINUX_VERSION_CODE
+	if (pci_find_host_bridge(pdev->bus)->no_ext_tags)
+		return false;
+#endif
+
+	return true;
+}
+
+/*
+ * MPS, MRRS, relaxed ordering, extended tags and no-snoop, each within what
+ * the device and its upstream ports allow; all of them can be changed later
+ * in sysfs, with the engines stopped.
+ */
+static void pcie_tune(struct pci_dev *pdev)
+{
+	int err;
+	int mps;
+
+	if (!pci_is_pcie(pdev)) {
+		pr_warn("device %s, not a PCIe device\n", dev_name(&pdev->dev));
+		return;
+	}
+
+	/* the PCI core may leave the device below the MPS of the path */
+	mps = pcie_mps_allowed(pdev);
+	if (pcie_get_mps(pdev) < mps) {
+		err = pcie_set_mps(pdev, mps);
+		if (err)
+			pr_info("device %s, error set MPS %d: %d.\n",
+				dev_name(&pdev->dev), mps, err);
+	}
+
+	err = pcie_set_readrq(pdev, pcie_mrrs);
+	if (err)
+		pr_info("device %s, error set PCI_EXP_DEVCTL_READRQ: %d.\n",
+			dev_name(&pdev->dev), err);
+
+	if (pcie_ro_allowed(pdev))
+		pci_enable_capability(pdev, PCI_EXP_DEVCTL_RELAX_EN);
+	else
+		pr_info("device %s, relaxed ordering disabled by the root port\n", dev_name(&pdev->dev));
+
+	if (pcie_ext_tags_allowed(pdev))
+		pci_enable_capability(pdev, PCI_EXP_DEVCTL_EXT_TAG);
+
+	if (pcie_no_snoop)
+		pci_enable_capability(pdev, PCI_EXP_DEVCTL_NOSNOOP_EN);
+	else
+		pcie_capability_clear_word(pdev, PCI_EXP_DEVCTL, PCI_EXP_DEVCTL_NOSNOOP_EN);
+}
+
+static void pcie_log_link(struct pci_dev *pdev)
+{
+	u32 lnkcap = 0;
+	u16 lnksta = 0;
+	u16 devctl = 0;
+	int speed, width, max_speed, max_width;
+
+	if (!pci_is_pcie(pdev))
+		return;
+
+	pcie_capability_read_dword(pdev, PCI_EXP_LNKCAP, &lnkcap);
+	pcie_capability_read_word(pdev, PCI_EXP_LNKSTA, &lnksta);
+	pcie_capability_read_word(pdev, PCI_EXP_DEVCTL, &devctl);
+
+	speed = lnksta & PCI_EXP_LNKSTA_CLS;
+	width = (lnksta & PCI_EXP_LNKSTA_NLW) >> PCI_EXP_LNKSTA_NLW_SHIFT;
+	max_speed = lnkcap & PCI_EXP_LNKCAP_SLS;
+	max_width = (lnkcap & PCI_EXP_LNKCAP_MLW) >> 4;
+
+	pr_info("device %s, link Gen%d x%d, MPS %d, MRRS %d, RO %d, ext tags %d, no-snoop %d\n",
+		dev_name(&pdev->dev), speed, width, pcie_get_mps(pdev), pcie_get_readrq(pdev),
+		!!(devctl & PCI_EXP_DEVCTL_RELAX_EN), !!(devctl & PCI_EXP_DEVCTL_EXT_TAG),
+		!!(devctl & PCI_EXP_DEVCTL_NOSNOOP_EN));
+
+	if (speed < max_speed || width < max_width)
+		pr_warn("device %s, link Gen%d x%d below its capability Gen%d x%d, check the slot\n",
+			dev_name(&pdev->dev), speed, width, max_speed, max_width);
+
+#if KERNEL_VERSION(4, 17, 0) <= LINUX_VERSION_CODE
+	/* also reports a slower link upstream */
+	pcie_print_link_status(pdev);
+#endif
+}
+
 static void pci_check_intr_pend(struct pci_dev *pdev)
 {
 	u16 v;
@@ -476,6 +856,42 @@ static int set_dma_mask(struct pci_dev *pdev)
 	return 0;
 }
 
+static bool __iommu_merges(struct device *dev)
+{
+#if KERNEL_VERSION(5, 8, 0) <= LINUX_VERSION_CODE
+	return dma_get_merge_boundary(dev) != 0;
+#else
+	return iommu_get_domain_for_dev(dev) != NULL;
+#endif
+}
+
+/*
+ * Behind an IOMMU DMA domain, dma_map_sgtable() puts the whole sg list in
+ * one IOVA allocation and merges the segments up to the max segment size
+ * (64KB by default). Lifting the limit gives a single segment per buffer,
+ * so a frame takes one descriptor per max_len/boundary of the engine's
+ * desc_policy whatever the page layout. Without an IOMMU the segments stay
+ * those of the physical pages.
+ */
+static void set_dma_segments(struct pci_dev *pdev)
+{
+	if (!__iommu_merges(&pdev->dev)) {
+		pr_info("device %s, no IOMMU DMA domain, per-page segments\n", dev_name(&pdev->dev));
+		return;
+	}
+
+	if (!iommu_contig) {
+		pr_info("device %s, IOMMU DMA domain, contiguous IOVA disabled\n", dev_name(&pdev->dev));
+		return;
+	}
+
+	// PCI devices always have dma_parms, the return value (void on recent kernels) is not needed
+	dma_set_max_seg_size(&pdev->dev, XDMA_DESC_BLEN_MAX & PAGE_MASK);
+
+	pr_info("device %s, IOMMU DMA domain, max_seg_size=%u\n", dev_name(&pdev->dev),
+		dma_get_max_seg_size(&pdev->dev));
+}
+
 #ifndef arch_msi_check_device
 static int arch_msi_check_device(struct pci_dev *dev, int nvec, int type)
 {
@@ -678,9 +1094,65 @@ static int create_dev_attrs(struct device* dev) {
 		goto err6;
 	}
 
+	err = device_create_file(dev, &dev_attr_pcie_mps);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err7;
+	}
+
+	err = device_create_file(dev, &dev_attr_pcie_mrrs);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err8;
+	}
+
+	err = device_create_file(dev, &dev_attr_pcie_relaxed_ordering);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err9;
+	}
+
+	err = device_create_file(dev, &dev_attr_pcie_ext_tags);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err10;
+	}
+
+	err = device_create_file(dev, &dev_attr_pcie_no_snoop);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err11;
+	}
+
+	err = device_create_file(dev, &dev_attr_pcie_link);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err12;
+	}
+
+	err = device_create_file(dev, &dev_attr_zdev_clock);
+	if (err) {
+		pr_err("device_create_file() failed, err=%d\n", err);
+		goto err13;
+	}
+
 	return 0;
 
 
+err13:
+	device_remove_file(dev, &dev_attr_pcie_link);
+err12:
+	device_remove_file(dev, &dev_attr_pcie_no_snoop);
+err11:
+	device_remove_file(dev, &dev_attr_pcie_ext_tags);
+err10:
+	device_remove_file(dev, &dev_attr_pcie_relaxed_ordering);
+err9:
+	device_remove_file(dev, &dev_attr_pcie_mrrs);
+err8:
+	device_remove_file(dev, &dev_attr_pcie_mps);
+err7:
+	device_remove_file(dev, &dev_attr_zdev_value0);
 err6:
 	device_remove_file(dev, &dev_attr_zdev_ticks);
 err5:
@@ -698,6 +1170,13 @@ err0:
 }
 
 static void remove_dev_attrs(struct device* dev) {
+	device_remove_file(dev, &dev_attr_zdev_clock);
+	device_remove_file(dev, &dev_attr_pcie_link);
+	device_remove_file(dev, &dev_attr_pcie_no_snoop);
+	device_remove_file(dev, &dev_attr_pcie_ext_tags);
+	device_remove_file(dev, &dev_attr_pcie_relaxed_ordering);
+	device_remove_file(dev, &dev_attr_pcie_mrrs);
+	device_remove_file(dev, &dev_attr_pcie_mps);
 	device_remove_file(dev, &dev_attr_zdev_value0);
 	device_remove_file(dev, &dev_attr_zdev_ticks);
 	device_remove_file(dev, &dev_attr_zdev_ver);
@@ -740,17 +1219,9 @@ static int __pci_probe(struct pci_dev *pdev, const struct pci_device_id *id) {
 	/* keep INTx enabled */
 	pci_check_intr_pend(pdev);
 
-	/* enable relaxed ordering */
-	pci_enable_capability(pdev, PCI_EXP_DEVCTL_RELAX_EN);
-
-	/* enable extended tag */
-	pci_enable_capability(pdev, PCI_EXP_DEVCTL_EXT_TAG);
-
-	/* force MRRS to be 512 */
-	err = pcie_set_readrq(pdev, 512);
-	if (err)
-		pr_info("device %s, error set PCI_EXP_DEVCTL_READRQ: %d.\n",
-			dev_name(&pdev->dev), err);
+	/* MPS, MRRS, relaxed ordering, extended tag and no-snoop */
+	pcie_tune(pdev);
+	pcie_log_link(pdev);
 
 	/* enable bus master capability */
 	pci_set_master(pdev);
@@ -773,6 +1244,8 @@ static int __pci_probe(struct pci_dev *pdev, const struct pci_device_id *id) {
 		goto err3;
 	}
 
+	set_dma_segments(pdev);
+
 	err = enable_msi_msix(self, pdev);
 	if(err) {
 		pr_err("enable_msi_msix() failed, err=%d\n", err);
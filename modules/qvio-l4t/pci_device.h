@@ -9,9 +9,11 @@
 #include "zdev.h"
 #include "qdma_wr.h"
 #include "qdma_rd.h"
+#include "qdma_gang.h"
 #include "tpg.h"
 #include "xdma_wr.h"
 #include "xdma_rd.h"
+#include "video.h"
 
 #define QVIO_DRV_MODULE_NAME "qvio-l4t"
 
@@ -46,6 +48,8 @@ struct qvio_pci_device {
 	struct qvio_qdma_wr* qdma_wr_0;
 	struct qvio_qdma_wr* qdma_wr_1;
 	struct qvio_qdma_wr* qdma_wr_2;
+	struct qvio_video* qdma_wr_video[3]; // V4L2 capture nodes in engine mode
+	struct qvio_qdma_gang* qdma_gang; // qdma_wr_0/1/2 ganged, one band each
 	struct qvio_qdma_rd* qdma_rd;
 	struct qvio_tpg* tpg;
 	void __iomem* qvio_axis_src;
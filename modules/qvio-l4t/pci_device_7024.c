@@ -6,6 +6,7 @@
 static const int c_total_irq_handlers = 4;
 
 static irqreturn_t __irq_handler(int irq, void *dev_id);
+static struct qvio_video* __qdma_wr_video_new(struct qvio_pci_device* self, struct qvio_qdma_wr* qdma_wr, const char* name);
 
 int device_7024_probe(struct qvio_pci_device* self) {
 	int err;
@@ -129,10 +130,71 @@ int device_7024_probe(struct qvio_pci_device* self) {
 		pr_err("qvio_qdma_wr_probe() failed, err=%d\n", err);
 		goto err9;
 	}
+
+	self->qdma_wr_video[0] = __qdma_wr_video_new(self, self->qdma_wr_0, "qvio-qdma_wr_0");
+	if(! self->qdma_wr_video[0]) {
+		pr_err("__qdma_wr_video_new() failed\n");
+		err = -ENOMEM;
+		goto err10;
+	}
+
+	self->qdma_wr_video[1] = __qdma_wr_video_new(self, self->qdma_wr_1, "qvio-qdma_wr_1");
+	if(! self->qdma_wr_video[1]) {
+		pr_err("__qdma_wr_video_new() failed\n");
+		err = -ENOMEM;
+		goto err10_1;
+	}
+
+	self->qdma_wr_video[2] = __qdma_wr_video_new(self, self->qdma_wr_2, "qvio-qdma_wr_2");
+	if(! self->qdma_wr_video[2]) {
+		pr_err("__qdma_wr_video_new() failed\n");
+		err = -ENOMEM;
+		goto err10_2;
+	}
+
+	err = qvio_qdma_gang_register();
+	if(err) {
+		pr_err("qvio_qdma_gang_register() failed\n");
+		goto err11;
+	}
+
+	self->qdma_gang = qvio_qdma_gang_new();
+	if(! self->qdma_gang) {
+		pr_err("qvio_qdma_gang_new() failed\n");
+		err = -ENOMEM;
+		goto err12;
+	}
+
+	self->qdma_gang->dev = self->dev;
+	self->qdma_gang->device_id = self->device_id;
+	self->qdma_gang->engines[0] = qvio_qdma_wr_get(self->qdma_wr_0);
+	self->qdma_gang->engines[1] = qvio_qdma_wr_get(self->qdma_wr_1);
+	self->qdma_gang->engines[2] = qvio_qdma_wr_get(self->qdma_wr_2);
+	self->qdma_gang->engines_count = 3;
+	err = qvio_qdma_gang_probe(self->qdma_gang);
+	if(err) {
+		pr_err("qvio_qdma_gang_probe() failed, err=%d\n", err);
+		goto err13;
+	}
 #endif
 
 	return 0;
 
+err13:
+	qvio_qdma_gang_put(self->qdma_gang);
+err12:
+	qvio_qdma_gang_unregister();
+err11:
+	qvio_video_stop(self->qdma_wr_video[2]);
+	qvio_video_put(self->qdma_wr_video[2]);
+err10_2:
+	qvio_video_stop(self->qdma_wr_video[1]);
+	qvio_video_put(self->qdma_wr_video[1]);
+err10_1:
+	qvio_video_stop(self->qdma_wr_video[0]);
+	qvio_video_put(self->qdma_wr_video[0]);
+err10:
+	qvio_tpg_remove(self->tpg);
 err9:
 	qvio_qdma_rd_remove(self->qdma_rd);
 err8:
@@ -164,7 +226,18 @@ err0:
 }
 
 void device_7024_remove(struct qvio_pci_device* self) {
+	int i;
+
 #if 1
+	qvio_qdma_gang_remove(self->qdma_gang);
+	qvio_qdma_gang_put(self->qdma_gang);
+	qvio_qdma_gang_unregister();
+
+	for(i = 0;i < ARRAY_SIZE(self->qdma_wr_video);i++) {
+		qvio_video_stop(self->qdma_wr_video[i]);
+		qvio_video_put(self->qdma_wr_video[i]);
+	}
+
 	qvio_tpg_remove(self->tpg);
 	qvio_qdma_rd_remove(self->qdma_rd);
 	qvio_qdma_wr_remove(self->qdma_wr_2);
@@ -332,4 +405,34 @@ static irqreturn_t __irq_handler(int irq, void *dev_id) {
 		return ret;
 
 	return ret;
-}
\ No newline at end of file
+}
+static struct qvio_video* __qdma_wr_video_new(struct qvio_pci_device* self, struct qvio_qdma_wr* qdma_wr, const char* name) {
+	int err;
+	struct qvio_video* video;
+
+	video = qvio_video_new();
+	if(! video) {
+		pr_err("qvio_video_new() failed\n");
+		goto err0;
+	}
+
+	video->qdma_wr = qvio_qdma_wr_get(qdma_wr);
+	video->vfl_dir = VFL_DIR_RX;
+	video->buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	video->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+	snprintf(video->bus_info, sizeof(video->bus_info), "PCI:%s", pci_name(self->pci_dev));
+	snprintf(video->v4l2_dev.name, sizeof(video->v4l2_dev.name), "%s", name);
+
+	err = qvio_video_start(video);
+	if(err) {
+		pr_err("qvio_video_start() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	return video;
+
+err1:
+	qvio_video_put(video);
+err0:
+	return NULL;
+}
@@ -5,6 +5,8 @@
 #include "xdma_desc.h"
 
 static irqreturn_t __irq_handler(int irq, void *dev_id);
+static int __xdma_channels(struct qvio_pci_device* self, int target);
+static void __xdma_channel_vectors(struct qvio_pci_device* self, int h2c_vector, int c2h_vector);
 
 int device_e382_probe(struct qvio_pci_device* self) {
 	int err;
@@ -60,6 +62,12 @@ int device_e382_probe(struct qvio_pci_device* self) {
 	}
 
 #if 1
+	self->xdma_rd->channels = __xdma_channels(self, 0x0);
+	self->xdma_wr->channels = __xdma_channels(self, 0x1);
+	self->xdma_rd->irq_bit = 0;
+	self->xdma_wr->irq_bit = self->xdma_rd->channels; // channel_int[], C2H bits follow the H2C ones
+	pr_info("XDMA channels: H2C %d, C2H %d\n", self->xdma_rd->channels, self->xdma_wr->channels);
+
 	self->xdma_wr->dev = self->dev;
 	self->xdma_wr->device_id = self->device_id;
 	self->xdma_wr->reg = (void __iomem *)self->bar[1];
@@ -209,12 +217,8 @@ int device_e382_irq_setup(struct qvio_pci_device* self, struct pci_dev* pdev) {
 				self->irq_lines[i] = vector;
 			}
 
-			// IRQ Block Channel Vector Number
-			value = io_read_reg(irq_block, 0xA0);
-			value = (value & ~(0x1F << 0)) | (0 << 0); // Map channel_int[0] to MSI-X Vector 0
-			value = (value & ~(0x1F << 8)) | (1 << 8); // Map channel_int[1] to MSI-X Vector 1
-			pr_info("channel_int=0x%X\n", value);
-			io_write_reg(irq_block, 0xA0, value);
+			// IRQ Block Channel Vector Number, H2C channels to MSI-X Vector 0, C2H channels to MSI-X Vector 1
+			__xdma_channel_vectors(self, 0, 1);
 		} else if(irq_count >= 1) {
 			i = 0;
 			vector = pci_irq_vector(pdev, i);
@@ -232,11 +236,8 @@ int device_e382_irq_setup(struct qvio_pci_device* self, struct pci_dev* pdev) {
 			}
 			self->irq_lines[i] = vector;
 
-			// IRQ Block Channel Vector Number
-			value = io_read_reg(irq_block, 0xA0);
-			value = (value & ~(0x1F << 0)) | (0 << 0); // Map channel_int[0] to MSI-X Vector 0
-			value = (value & ~(0x1F << 8)) | (0 << 8); // Map channel_int[1] to MSI-X Vector 0
-			io_write_reg(irq_block, 0xA0, value);
+			// IRQ Block Channel Vector Number, all channels to MSI-X Vector 0
+			__xdma_channel_vectors(self, 0, 0);
 		}
 	}
 #endif
@@ -292,3 +293,43 @@ static irqreturn_t __irq_handler(int irq, void *dev_id) {
 
 	return ret;
 }
+
+// count the channels of target (0x0 H2C, 0x1 C2H) by their identifier registers
+static int __xdma_channels(struct qvio_pci_device* self, int target) {
+	uintptr_t channel;
+	u32 value;
+	int i;
+
+	for(i = 0;i < QVIO_MAX_STRIPES;i++) {
+		channel = (uintptr_t)((u64)self->bar[1] + xdma_mkaddr(target, i, 0));
+		value = io_read_reg(channel, 0x00); // Channel Identifier
+		if((value & 0xFFF00000) != 0x1FC00000 || ((value >> 16) & 0xF) != target || ((value >> 8) & 0xF) != i)
+			break;
+	}
+
+	if(! i) {
+		pr_warn("no XDMA channel found, target=%d\n", target);
+		i = 1;
+	}
+
+	return i;
+}
+
+// channel_int[] bits, H2C channels first, 4 bits per Channel Vector Number register
+static void __xdma_channel_vectors(struct qvio_pci_device* self, int h2c_vector, int c2h_vector) {
+	uintptr_t irq_block = (uintptr_t)((u64)self->bar[1] + xdma_mkaddr(0x2, 0, 0));
+	int channels = self->xdma_rd->channels + self->xdma_wr->channels;
+	int i, vector, offset, shift;
+	u32 value;
+
+	for(i = 0;i < channels;i++) {
+		vector = (i < self->xdma_rd->channels) ? h2c_vector : c2h_vector;
+		offset = 0xA0 + (i / 4) * 4;
+		shift = (i % 4) * 8;
+
+		value = io_read_reg(irq_block, offset);
+		value = (value & ~(0x1F << shift)) | (vector << shift); // Map channel_int[i] to MSI-X Vector
+		io_write_reg(irq_block, offset, value);
+	}
+	pr_info("channel_int=0x%X 0x%X\n", io_read_reg(irq_block, 0xA0), io_read_reg(irq_block, 0xA4));
+}
@@ -0,0 +1,359 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/timekeeping.h>
+
+#include "qdma_gang.h"
+#include "uapi/qvio-l4t.h"
+#include "utils.h"
+#include "trace.h"
+
+static struct qvio_cdev_class __cdev_class;
+
+static void __free(struct kref *ref);
+static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg);
+static __poll_t __file_poll(struct file *filp, struct poll_table_struct *wait);
+static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table* sgt, struct qvio_buffer* buf, struct qvio_buf_entry* buf_entry);
+static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry);
+static int __streamon(struct qvio_video_queue* self);
+static int __streamoff(struct qvio_video_queue* self);
+static void __band_done(void* owner, int band);
+
+static const struct file_operations __fops = {
+	.owner = THIS_MODULE,
+	.open = qvio_cdev_open,
+	.release = qvio_cdev_release,
+	.poll = __file_poll,
+	.llseek = noop_llseek,
+	.unlocked_ioctl = __file_ioctl,
+};
+
+int qvio_qdma_gang_register(void) {
+	int err;
+
+	pr_info("\n");
+
+	err = qvio_cdev_register(&__cdev_class, 0, 255, "qdma_gang");
+	if(err) {
+		pr_err("qvio_cdev_register() failed\n");
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return err;
+}
+
+void qvio_qdma_gang_unregister(void) {
+	pr_info("\n");
+
+	qvio_cdev_unregister(&__cdev_class);
+}
+
+struct qvio_qdma_gang* qvio_qdma_gang_new(void) {
+	int err;
+	struct qvio_qdma_gang* self = kzalloc(sizeof(struct qvio_qdma_gang), GFP_KERNEL);
+
+	if(! self) {
+		pr_err("kzalloc() failed\n");
+		err = -ENOMEM;
+		goto err0;
+	}
+
+	kref_init(&self->ref);
+	spin_lock_init(&self->lock);
+
+	self->video_queue = qvio_video_queue_new();
+	if(! self->video_queue) {
+		pr_err("qvio_video_queue_new() failed\n");
+		err = -ENOMEM;
+		goto err1;
+	}
+
+	self->video_queue->parent = self;
+	self->video_queue->buf_entry_from_sgt = __buf_entry_from_sgt;
+	self->video_queue->start_buf_entry = __start_buf_entry;
+	self->video_queue->streamon = __streamon;
+	self->video_queue->streamoff = __streamoff;
+
+	return self;
+
+err1:
+	kfree(self);
+err0:
+	return NULL;
+}
+
+struct qvio_qdma_gang* qvio_qdma_gang_get(struct qvio_qdma_gang* self) {
+	if (self)
+		kref_get(&self->ref);
+
+	return self;
+}
+
+static void __free(struct kref *ref) {
+	struct qvio_qdma_gang* self = container_of(ref, struct qvio_qdma_gang, ref);
+	int i;
+
+	// pr_info("\n");
+
+	for(i = 0;i < self->engines_count;i++)
+		qvio_qdma_wr_put(self->engines[i]);
+
+	qvio_video_queue_put(self->video_queue);
+	kfree(self);
+}
+
+void qvio_qdma_gang_put(struct qvio_qdma_gang* self) {
+	if (self)
+		kref_put(&self->ref, __free);
+}
+
+int qvio_qdma_gang_probe(struct qvio_qdma_gang* self) {
+	int err;
+
+	if(self->engines_count < 1 || self->engines_count > QVIO_MAX_STRIPES) {
+		pr_err("unexpected value, self->engines_count=%d\n", self->engines_count);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	self->video_queue->dev = self->dev;
+	self->video_queue->device_id = self->device_id;
+
+	self->desc_pool = dma_pool_create("qdma_gang", self->dev, PAGE_SIZE, 32, 0);
+	if(!self->desc_pool) {
+		pr_err("dma_pool_create() failed\n");
+		err = -ENOMEM;
+		goto err0;
+	}
+
+	self->cdev.fops = &__fops;
+	self->cdev.private_data = self;
+	err = qvio_cdev_start(&self->cdev, &__cdev_class);
+	if(err) {
+		pr_err("qvio_cdev_start() failed, err=%d\n", err);
+		goto err1;
+	}
+	snprintf(self->video_queue->name, sizeof(self->video_queue->name), "qdma_gang%d", MINOR(self->cdev.cdevno));
+	qvio_stats_start(&self->video_queue->stats, self->video_queue->name);
+
+	return 0;
+
+err1:
+	dma_pool_destroy(self->desc_pool);
+err0:
+	return err;
+}
+
+void qvio_qdma_gang_remove(struct qvio_qdma_gang* self) {
+	qvio_stats_stop(&self->video_queue->stats);
+	qvio_cdev_stop(&self->cdev, &__cdev_class);
+	dma_pool_destroy(self->desc_pool);
+}
+
+static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg) {
+	long ret;
+	struct qvio_qdma_gang* self = filp->private_data;
+
+	ret = qvio_video_queue_file_ioctl(self->video_queue, filp, cmd, arg);
+	if(ret == -ENOSYS) {
+		pr_err("unexpected, cmd=%d\n", cmd);
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+static __poll_t __file_poll(struct file *filp, struct poll_table_struct *wait) {
+	struct qvio_qdma_gang* self = filp->private_data;
+
+	return qvio_video_queue_file_poll(self->video_queue, filp, wait);
+}
+
+static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table* sgt, struct qvio_buffer* buf, struct qvio_buf_entry* buf_entry) {
+	int err;
+	struct qvio_qdma_gang* gang = self->parent;
+	size_t buffer_size;
+	size_t band_size;
+	size_t offset, size;
+	int i, block, blocks;
+
+	buf_entry->dev = gang->dev;
+	buf_entry->desc_pool = gang->desc_pool;
+	buf_entry->descs = 0;
+
+	err = utils_calc_buf_size(&self->format, buf->offset, buf->stride, &buffer_size);
+	if(err < 0) {
+		pr_err("utils_calc_buf_size() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	// bands of whole lines, the last one takes the remainder
+	band_size = roundup(DIV_ROUND_UP(buffer_size, gang->engines_count), max_t(size_t, buf->stride[0], 1));
+#if 0
+	pr_info("buffer_size=%lu, band_size=%lu\n", buffer_size, band_size);
+#endif
+
+	block = 0;
+	offset = 0;
+	for(i = 0;i < gang->engines_count && offset < buffer_size;i++) {
+		size = min(band_size, buffer_size - offset);
+
+		blocks = qvio_qdma_wr_build_chain(gang->engines[i], sgt, offset, size, buf_entry, block, i);
+		if(blocks < 0) {
+			err = blocks;
+			pr_err("qvio_qdma_wr_build_chain() failed, err=%d\n", err);
+			goto err0;
+		}
+
+		block += blocks;
+		offset += size;
+	}
+
+	buf_entry->nstripes = i;
+	buf_entry->dsc_adr = buf_entry->stripes[0].dsc_adr;
+	buf_entry->dsc_adj = buf_entry->stripes[0].dsc_adj;
+	buf_entry->bytes = buffer_size;
+	trace_qvio_build_descs(self, buf_entry, buf_entry->descs, block, buf_entry->bytes);
+
+	return 0;
+
+err0:
+	return err;
+}
+
+static void __start_bands(struct qvio_qdma_gang* self, struct qvio_buf_entry* buf_entry) {
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&self->lock, flags);
+	self->pending = GENMASK(buf_entry->nstripes - 1, 0);
+	spin_unlock_irqrestore(&self->lock, flags);
+
+	buf_entry->start_ns = ktime_get_ns();
+	for(i = 0;i < buf_entry->nstripes;i++) {
+		qvio_qdma_wr_start(self->engines[i], buf_entry->stripes[i].dsc_adr,
+			buf_entry->stripes[i].dsc_adj, buf_entry->stripes[i].bytes);
+	}
+}
+
+static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry) {
+	struct qvio_qdma_gang* gang = self->parent;
+
+	__start_bands(gang, buf_entry);
+	trace_qvio_ap_start(self, buf_entry, self->sequence);
+
+	pr_debug("QDMA gang started... bands %d\n", buf_entry->nstripes);
+
+	return 0;
+}
+
+// called from the IRQ handler of engines[band]
+static void __band_done(void* owner, int band) {
+	int err;
+	struct qvio_qdma_gang* self = owner;
+	struct qvio_buf_entry* buf_entry;
+	unsigned long pending;
+
+	spin_lock(&self->lock);
+	if(! (self->pending & BIT(band))) {
+		spin_unlock(&self->lock);
+
+		pr_warn("unexpected value, band=%d, self->pending=0x%lx\n", band, self->pending);
+		return;
+	}
+
+	self->pending &= ~BIT(band);
+	pending = self->pending;
+	spin_unlock(&self->lock);
+
+	// wait for the other bands of the frame
+	if(pending)
+		return;
+
+	err = qvio_video_queue_done(self->video_queue, &buf_entry);
+	if(err) {
+		pr_err("qvio_video_queue_done() failed, err=%d\n", err);
+		return;
+	}
+
+	if(! buf_entry)
+		return;
+
+	// try to do another job
+	__start_bands(self, buf_entry);
+	trace_qvio_ap_start(self->video_queue, buf_entry, self->video_queue->sequence);
+}
+
+static void __release_engine(struct qvio_qdma_gang* self, struct qvio_qdma_wr* qdma_wr) {
+	qdma_wr->band_done = NULL;
+	qdma_wr->band_owner = NULL;
+	qvio_video_queue_release(qdma_wr->video_queue, self);
+}
+
+static int __streamon(struct qvio_video_queue* self) {
+	int err;
+	struct qvio_qdma_gang* gang = self->parent;
+	struct qvio_qdma_wr* qdma_wr;
+	int i;
+
+	gang->pending = 0;
+
+	for(i = 0;i < gang->engines_count;i++) {
+		qdma_wr = gang->engines[i];
+
+		// the engine nodes stay busy while ganged
+		err = qvio_video_queue_claim(qdma_wr->video_queue, gang, NULL);
+		if(err) {
+			pr_err("qvio_video_queue_claim() failed, err=%d\n", err);
+			goto err0;
+		}
+
+		qdma_wr->band = i;
+		qdma_wr->band_owner = gang;
+		qdma_wr->band_done = __band_done;
+
+		err = qdma_wr->video_queue->streamon(qdma_wr->video_queue);
+		if(err) {
+			pr_err("streamon() failed, err=%d\n", err);
+			__release_engine(gang, qdma_wr);
+			goto err0;
+		}
+	}
+
+	return 0;
+
+err0:
+	for(i--;i >= 0;i--) {
+		qdma_wr = gang->engines[i];
+
+		qdma_wr->video_queue->streamoff(qdma_wr->video_queue);
+		__release_engine(gang, qdma_wr);
+	}
+
+	return err;
+}
+
+static int __streamoff(struct qvio_video_queue* self) {
+	int err;
+	struct qvio_qdma_gang* gang = self->parent;
+	struct qvio_qdma_wr* qdma_wr;
+	int i;
+
+	for(i = 0;i < gang->engines_count;i++) {
+		qdma_wr = gang->engines[i];
+
+		err = qdma_wr->video_queue->streamoff(qdma_wr->video_queue);
+		if(err) {
+			pr_err("streamoff() failed, err=%d\n", err);
+		}
+
+		__release_engine(gang, qdma_wr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __QVIO_QDMA_GANG_H__
+#define __QVIO_QDMA_GANG_H__
+
+#include <linux/platform_device.h>
+
+#include "cdev.h"
+#include "qdma_wr.h"
+#include "video_queue.h"
+
+// one capture node over several qdma_wr engines, each of them writes a horizontal band of the frame
+struct qvio_qdma_gang {
+	struct kref ref;
+
+	struct device *dev;
+	uint32_t device_id;
+	struct qvio_cdev cdev;
+
+	struct qvio_qdma_wr* engines[QVIO_MAX_STRIPES];
+	int engines_count;
+	struct qvio_video_queue* video_queue;
+	struct dma_pool* desc_pool;
+
+	spinlock_t lock;
+	unsigned long pending; // bands of the running frame
+};
+
+// register
+int qvio_qdma_gang_register(void);
+void qvio_qdma_gang_unregister(void);
+
+// object alloc
+struct qvio_qdma_gang* qvio_qdma_gang_new(void);
+struct qvio_qdma_gang* qvio_qdma_gang_get(struct qvio_qdma_gang* self);
+void qvio_qdma_gang_put(struct qvio_qdma_gang* self);
+
+// device probe, engines[] must be probed already
+int qvio_qdma_gang_probe(struct qvio_qdma_gang* self);
+void qvio_qdma_gang_remove(struct qvio_qdma_gang* self);
+
+#endif // __QVIO_QDMA_GANG_H__
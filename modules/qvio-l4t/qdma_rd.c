@@ -4,11 +4,17 @@
 #include <linux/slab.h>
 #include <linux/fs.h>
 #include <linux/delay.h>
+#include <linux/timekeeping.h>
 
 #include "qdma_rd.h"
 #include "uapi/qvio-l4t.h"
 #include "xdma_desc.h"
 #include "utils.h"
+#include "trace.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+#define HRTIMER_MODE_ABS_HARD HRTIMER_MODE_ABS
+#endif
 
 static struct qvio_cdev_class __cdev_class;
 static const unsigned int __reset_delay = 100;
@@ -21,6 +27,9 @@ static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entr
 static int __streamon(struct qvio_video_queue* self);
 static int __streamoff(struct qvio_video_queue* self);
 static int __reset_cores(struct qvio_qdma_rd* self);
+static long __file_ioctl_qbuf_timed(struct qvio_qdma_rd* self, struct file * filp, unsigned long arg);
+static void __start(struct qvio_qdma_rd* self, struct qvio_buf_entry* buf_entry);
+static enum hrtimer_restart __pts_timer(struct hrtimer* timer);
 
 static const struct file_operations __fops = {
 	.owner = THIS_MODULE,
@@ -65,6 +74,12 @@ struct qvio_qdma_rd* qvio_qdma_rd_new(void) {
 	}
 
 	kref_init(&self->ref);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&self->pts_timer, __pts_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+#else
+	hrtimer_init(&self->pts_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+	self->pts_timer.function = __pts_timer;
+#endif
 
 	self->video_queue = qvio_video_queue_new();
 	if(! self->video_queue) {
@@ -134,6 +149,8 @@ int qvio_qdma_rd_probe(struct qvio_qdma_rd* self) {
 		pr_err("qvio_cdev_start() failed, err=%d\n", err);
 		goto err2;
 	}
+	snprintf(self->video_queue->name, sizeof(self->video_queue->name), "qdma_rd%d", MINOR(self->cdev.cdevno));
+	qvio_stats_start(&self->video_queue->stats, self->video_queue->name);
 
 	return 0;
 
@@ -145,6 +162,7 @@ err0:
 }
 
 void qvio_qdma_rd_remove(struct qvio_qdma_rd* self) {
+	qvio_stats_stop(&self->video_queue->stats);
 	qvio_cdev_stop(&self->cdev, &__cdev_class);
 	dma_pool_destroy(self->desc_pool);
 }
@@ -156,7 +174,9 @@ static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg
 	ret = qvio_video_queue_file_ioctl(self->video_queue, filp, cmd, arg);
 	if(ret == -ENOSYS) {
 		switch(cmd) {
-		// TODO:
+		case QVIO_IOC_QBUF_TIMED:
+			ret = __file_ioctl_qbuf_timed(self, filp, arg);
+			break;
 
 		default:
 			pr_err("unexpected, cmd=%d\n", cmd);
@@ -174,6 +194,58 @@ static __poll_t __file_poll(struct file *filp, struct poll_table_struct *wait) {
 	return qvio_video_queue_file_poll(self->video_queue, filp, wait);
 }
 
+static long __file_ioctl_qbuf_timed(struct qvio_qdma_rd* self, struct file * filp, unsigned long arg) {
+	long ret;
+	struct qvio_timed_buffer args;
+	u64 pts_ns;
+	u64 ticks;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	switch(args.clock) {
+	case QVIO_PTS_CLOCK_MONOTONIC:
+		pts_ns = args.pts;
+		break;
+
+	case QVIO_PTS_CLOCK_TICKS:
+		// no ticks clock to convert from, there is no module parameter fallback
+		if(! self->zdev) {
+			pr_err("unexpected value, self->zdev=%p\n", self->zdev);
+			ret = -EOPNOTSUPP;
+			goto err0;
+		}
+
+		// raw counter values are taken within +/-2^31 ticks of now
+		ticks = args.pts;
+		if(ticks <= U32_MAX)
+			ticks = qvio_zdev_ticks_extend(self->zdev, (u32)ticks);
+
+		ret = qvio_zdev_ticks_to_ns(self->zdev, ticks, &pts_ns);
+		if(ret) {
+			pr_err("qvio_zdev_ticks_to_ns() failed, err=%d\n", (int)ret);
+			goto err0;
+		}
+		break;
+
+	default:
+		pr_err("unexpected value, args.clock=%u\n", args.clock);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	// 0 means unpaced
+	return qvio_video_queue_file_qbuf(self->video_queue, filp, &args.buf, max_t(u64, pts_ns, 1));
+
+err0:
+	return ret;
+}
+
 irqreturn_t qvio_qdma_rd_irq_handler(int irq, void *dev_id) {
 	int err;
 	struct qvio_qdma_rd* self = dev_id;
@@ -189,6 +261,8 @@ irqreturn_t qvio_qdma_rd_irq_handler(int irq, void *dev_id) {
 	}
 
 	io_write_reg(reg, 0x0C, value & 0x01); // ap_done, TOW
+	trace_qvio_irq(self->video_queue, irq, value, self->zdev);
+	atomic64_inc(&self->video_queue->stats.irqs);
 
 #if 0
 	pr_info("QDMA-RD, IRQ[%d]: irq_counter=%d\n", irq, self->irq_counter);
@@ -208,10 +282,7 @@ irqreturn_t qvio_qdma_rd_irq_handler(int irq, void *dev_id) {
 
 #if 1
 	// try to do another job
-	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
-	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
-	io_write_reg(reg, 0x18, buf_entry->dsc_adj);
-	io_write_reg(reg, 0x00, 0x01); // ap_start
+	__start(self, buf_entry);
 #endif
 #endif
 
@@ -303,12 +374,53 @@ static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table*
 
 	dma_sync_single_for_device(buf_entry->dev, pDmaBlock->dma_handle, PAGE_SIZE, DMA_FROM_DEVICE);
 
+	buf_entry->descs = i;
+	buf_entry->bytes = buffer_size;
+	trace_qvio_build_descs(self, buf_entry, buf_entry->descs, 1, buf_entry->bytes);
+
 	return 0;
 
 err0:
 	return err;
 }
 
+static void __ap_start(struct qvio_qdma_rd* self, struct qvio_buf_entry* buf_entry) {
+	uintptr_t reg = (uintptr_t)self->reg;
+
+	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
+	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
+	io_write_reg(reg, 0x18, buf_entry->dsc_adj);
+	buf_entry->start_ns = ktime_get_ns();
+	io_write_reg(reg, 0x00, 0x01); // ap_start
+	trace_qvio_ap_start(self->video_queue, buf_entry, self->video_queue->sequence);
+
+	if(buf_entry->pts_ns)
+		qvio_stats_lat(&self->video_queue->stats, QVIO_STATS_LAT_PTS_START, buf_entry->pts_ns, buf_entry->start_ns);
+}
+
+// ap_start at the presentation time of buf_entry, from the IRQ or process context
+static void __start(struct qvio_qdma_rd* self, struct qvio_buf_entry* buf_entry) {
+	if(buf_entry->pts_ns > ktime_get_ns()) {
+		// the previous frame is done, nothing else can start the engine meanwhile
+		self->pts_entry = buf_entry;
+		hrtimer_start(&self->pts_timer, ns_to_ktime(buf_entry->pts_ns), HRTIMER_MODE_ABS_HARD);
+		return;
+	}
+
+	if(buf_entry->pts_ns)
+		atomic64_inc(&self->video_queue->stats.late);
+
+	__ap_start(self, buf_entry);
+}
+
+static enum hrtimer_restart __pts_timer(struct hrtimer* timer) {
+	struct qvio_qdma_rd* self = container_of(timer, struct qvio_qdma_rd, pts_timer);
+
+	__ap_start(self, self->pts_entry);
+
+	return HRTIMER_NORESTART;
+}
+
 static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry) {
 	struct qvio_qdma_rd* qdma_rd = self->parent;
 	uintptr_t reg = (uintptr_t)qdma_rd->reg;
@@ -318,17 +430,14 @@ static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entr
 	pDmaBlock = &buf_entry->desc_blocks[0];
 	pSgdmaDesc = pDmaBlock->cpu_addr;
 
-	pr_info("%d x %d, %x:%x\n", self->format.width, self->format.height,
+	pr_debug("%d x %d, %x:%x\n", self->format.width, self->format.height,
 		(u32)pSgdmaDesc->dst_addr_hi, (u32)pSgdmaDesc->dst_addr_lo);
 
-	pr_info("reg[0x00]=0x%x\n", io_read_reg(reg, 0x00));
-	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
-	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
-	io_write_reg(reg, 0x18, buf_entry->dsc_adj);
+	pr_debug("reg[0x00]=0x%x\n", io_read_reg(reg, 0x00));
 	io_write_reg(reg, 0x1C, self->format.width * self->format.height);
-	io_write_reg(reg, 0x00, 0x01); // ap_start
+	__start(qdma_rd, buf_entry);
 
-	pr_info("QDMA RD started...\n");
+	pr_debug("QDMA RD started...\n");
 
 	return 0;
 }
@@ -362,6 +471,9 @@ static int __streamoff(struct qvio_video_queue* self) {
 	u32 value;
 	int i;
 
+	// a paced frame not started yet stays in the job list
+	hrtimer_cancel(&qdma_rd->pts_timer);
+
 	io_write_reg(reg, 0x04, 0x00); // GIE
 	io_write_reg(reg, 0x08, 0x00); // IER (ap_done)
 
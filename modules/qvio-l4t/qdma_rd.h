@@ -3,6 +3,7 @@
 
 #include <linux/platform_device.h>
 #include <linux/irqreturn.h>
+#include <linux/hrtimer.h>
 
 #include "cdev.h"
 #include "zdev.h"
@@ -21,6 +22,10 @@ struct qvio_qdma_rd {
 	struct qvio_video_queue* video_queue;
 	int irq_counter;
 	struct dma_pool* desc_pool;
+
+	// paced playback, the entry waiting for its presentation time
+	struct hrtimer pts_timer;
+	struct qvio_buf_entry* pts_entry;
 };
 
 // register
@@ -4,11 +4,13 @@
 #include <linux/slab.h>
 #include <linux/fs.h>
 #include <linux/delay.h>
+#include <linux/timekeeping.h>
 
 #include "qdma_wr.h"
 #include "uapi/qvio-l4t.h"
 #include "xdma_desc.h"
 #include "utils.h"
+#include "trace.h"
 
 static struct qvio_cdev_class __cdev_class;
 static const unsigned int __reset_delay = 100;
@@ -65,6 +67,7 @@ struct qvio_qdma_wr* qvio_qdma_wr_new(void) {
 	}
 
 	kref_init(&self->ref);
+	xdma_desc_policy_init(&self->desc_policy);
 
 	self->video_queue = qvio_video_queue_new();
 	if(! self->video_queue) {
@@ -135,8 +138,19 @@ int qvio_qdma_wr_probe(struct qvio_qdma_wr* self) {
 		goto err2;
 	}
 
+	err = xdma_desc_policy_start(&self->desc_policy, &self->cdev);
+	if(err) {
+		pr_err("xdma_desc_policy_start() failed, err=%d\n", err);
+		goto err3;
+	}
+
+	snprintf(self->video_queue->name, sizeof(self->video_queue->name), "qdma_wr%d", MINOR(self->cdev.cdevno));
+	qvio_stats_start(&self->video_queue->stats, self->video_queue->name);
+
 	return 0;
 
+err3:
+	qvio_cdev_stop(&self->cdev, &__cdev_class);
 err2:
 err1:
 	dma_pool_destroy(self->desc_pool);
@@ -145,6 +159,8 @@ err0:
 }
 
 void qvio_qdma_wr_remove(struct qvio_qdma_wr* self) {
+	qvio_stats_stop(&self->video_queue->stats);
+	xdma_desc_policy_stop(&self->desc_policy);
 	qvio_cdev_stop(&self->cdev, &__cdev_class);
 	dma_pool_destroy(self->desc_pool);
 }
@@ -189,6 +205,13 @@ irqreturn_t qvio_qdma_wr_irq_handler(int irq, void *dev_id) {
 	}
 
 	io_write_reg(reg, 0x0C, value & 0x01); // ap_done, TOW
+	trace_qvio_irq(self->video_queue, irq, value, self->zdev);
+	atomic64_inc(&self->video_queue->stats.irqs);
+
+	if(self->band_done) {
+		self->band_done(self->band_owner, self->band);
+		goto err0;
+	}
 
 #if 0
 	pr_info("QDMA-WR, IRQ[%d]: irq_counter=%d\n", irq, self->irq_counter);
@@ -223,7 +246,9 @@ irqreturn_t qvio_qdma_wr_irq_handler(int irq, void *dev_id) {
 	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
 	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
 	io_write_reg(reg, 0x18, buf_entry->dsc_adj);
+	buf_entry->start_ns = ktime_get_ns();
 	io_write_reg(reg, 0x00, 0x01); // ap_start
+	trace_qvio_ap_start(self->video_queue, buf_entry, self->video_queue->sequence);
 #endif
 #endif
 
@@ -234,29 +259,7 @@ err0:
 static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table* sgt, struct qvio_buffer* buf, struct qvio_buf_entry* buf_entry) {
 	int err;
 	struct qvio_qdma_wr* qdma_wr = self->parent;
-	struct scatterlist* sg;
-	int nents;
 	size_t buffer_size;
-	struct dma_block_t* pDmaBlock;
-	struct xdma_desc* pSgdmaDesc;
-	dma_addr_t src_addr;
-	dma_addr_t dst_addr;
-	dma_addr_t nxt_addr;
-	ssize_t dma_len;
-	ssize_t sg_bytes;
-	int i, adj_descs;
-
-	buf_entry->dev = qdma_wr->dev;
-	buf_entry->desc_pool = qdma_wr->desc_pool;
-
-	sg = sgt->sgl;
-	nents = sgt->nents;
-
-	if(nents >= PAGE_SIZE / sizeof(struct xdma_desc)) {
-		err = -EINVAL;
-		pr_err("unexpected value, nents=%d\n", nents);
-		goto err0;
-	}
 
 	err = utils_calc_buf_size(&self->format, buf->offset, buf->stride, &buffer_size);
 	if(err < 0) {
@@ -267,21 +270,113 @@ static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table*
 	pr_info("buffer_size=%lu\n", buffer_size);
 #endif
 
-	pDmaBlock = &buf_entry->desc_blocks[0];
-	err = qvio_dma_block_alloc(pDmaBlock, buf_entry->desc_pool, GFP_KERNEL | GFP_DMA);
-	if(err) {
-		pr_err("qvio_dma_block_alloc() failed, ret=%d\n", err);
+	err = qvio_qdma_wr_build_descs(qdma_wr, sgt, buffer_size, buf_entry);
+	if(err < 0) {
+		pr_err("qvio_qdma_wr_build_descs() failed, err=%d\n", err);
 		goto err0;
 	}
 
-	pSgdmaDesc = pDmaBlock->cpu_addr;
-	src_addr = 0xA0000000;
+	return 0;
+
+err0:
+	return err;
+}
+
+int qvio_qdma_wr_build_descs(struct qvio_qdma_wr* self, struct sg_table* sgt, size_t buffer_size, struct qvio_buf_entry* buf_entry) {
+	int err;
+	int blocks;
+
+	buf_entry->dev = self->dev;
+	buf_entry->desc_pool = self->desc_pool;
+	buf_entry->descs = 0;
+
+	blocks = qvio_qdma_wr_build_chain(self, sgt, 0, buffer_size, buf_entry, 0, 0);
+	if(blocks < 0) {
+		err = blocks;
+		pr_err("qvio_qdma_wr_build_chain() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	buf_entry->nstripes = 1;
+	buf_entry->dsc_adr = buf_entry->stripes[0].dsc_adr;
+	buf_entry->dsc_adj = buf_entry->stripes[0].dsc_adj;
+#if 0
+	pr_warn("---- dsc_adr 0x%llx, dsc_adj %u, blocks %d\n", buf_entry->dsc_adr, buf_entry->dsc_adj, blocks);
+#endif
+
+	buf_entry->bytes = buffer_size;
+	trace_qvio_build_descs(self->video_queue, buf_entry, buf_entry->descs, blocks, buf_entry->bytes);
+
+	return 0;
+
+err0:
+	return err;
+}
+
+int qvio_qdma_wr_build_chain(struct qvio_qdma_wr* self, struct sg_table* sgt, size_t offset, size_t size,
+	struct qvio_buf_entry* buf_entry, int block, int stripe) {
+	int err;
+	struct xdma_desc_iter iter;
+	struct dma_block_t* pDmaBlock;
+	struct xdma_desc* pSgdmaDesc;
+	struct xdma_desc* pBlockDesc;
+	dma_addr_t src_addr;
+	dma_addr_t dst_addr;
+	dma_addr_t nxt_addr;
+	size_t dma_len;
+	size_t sg_bytes;
+	const int block_descs = PAGE_SIZE / sizeof(struct xdma_desc);
+	int i, j, blocks, descs, adj_descs;
+
+	if(! size) {
+		pr_err("unexpected value, size=%lu\n", size);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	xdma_desc_iter_init(&iter, &self->desc_policy, sgt, offset);
+
+	src_addr = 0xA0000000 + offset;
 	sg_bytes = 0;
-	for (i = 0; i < nents; i++, sg = sg_next(sg)) {
-		dst_addr = sg_dma_address(sg);
-		dma_len = sg_dma_len(sg);
+	pDmaBlock = NULL;
+	pSgdmaDesc = NULL;
+	for (i = 0; sg_bytes < size; i++) {
+		dma_len = xdma_desc_iter_next(&iter, size - sg_bytes, &dst_addr);
+		if(! dma_len) {
+			pr_err("unexpected value, sg_bytes=%lu < size=%lu\n", sg_bytes, size);
+			err = -EINVAL;
+			goto err0;
+		}
+
+		// a scattered buffer spills over several descriptor blocks
+		if(i % block_descs == 0) {
+			if(block + i / block_descs >= QVIO_MAX_DESC_BLOCKS) {
+				pr_err("unexpected value, descs=%d, nents=%d\n", i, sgt->nents);
+				err = -EINVAL;
+				goto err0;
+			}
+
+			pDmaBlock = &buf_entry->desc_blocks[block + i / block_descs];
+			err = qvio_dma_block_alloc(pDmaBlock, buf_entry->desc_pool, GFP_KERNEL | GFP_DMA);
+			if(err) {
+				pr_err("qvio_dma_block_alloc() failed, ret=%d\n", err);
+				goto err0;
+			}
+
+			// link the last descriptor of the previous block
+			if(pSgdmaDesc) {
+				pSgdmaDesc->next_lo = cpu_to_le32(PCI_DMA_L(pDmaBlock->dma_handle));
+				pSgdmaDesc->next_hi = cpu_to_le32(PCI_DMA_H(pDmaBlock->dma_handle));
+			}
+
+			pSgdmaDesc = pDmaBlock->cpu_addr;
+		} else {
+			pSgdmaDesc++;
+		}
+
 		nxt_addr = pDmaBlock->dma_handle + ((u8*)(pSgdmaDesc + 1) - (u8*)pDmaBlock->cpu_addr);
 
+		pSgdmaDesc->bytes = cpu_to_le32(dma_len);
 		pSgdmaDesc->src_addr_lo = cpu_to_le32(PCI_DMA_L(src_addr));
 		pSgdmaDesc->src_addr_hi = cpu_to_le32(PCI_DMA_H(src_addr));
 		pSgdmaDesc->dst_addr_lo = cpu_to_le32(PCI_DMA_L(dst_addr));
@@ -295,54 +390,48 @@ static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table*
 #if 0
 		pr_info("%d: dma_len=%lu, sg_bytes=%lu\n", i, dma_len, sg_bytes);
 #endif
+	}
 
-		if(sg_bytes >= buffer_size) {
-			pSgdmaDesc->bytes = cpu_to_le32(dma_len - (sg_bytes - buffer_size));
-			pSgdmaDesc->next_lo = 0;
-			pSgdmaDesc->next_hi = 0;
-			adj_descs = i;
-			break;
-		}
-
-		pSgdmaDesc->bytes = cpu_to_le32(dma_len);
+	pSgdmaDesc->next_lo = 0;
+	pSgdmaDesc->next_hi = 0;
+	adj_descs = i - 1;
 
-		pSgdmaDesc++;
-	}
+	// adjacent counts never reach across a block boundary
+	blocks = adj_descs / block_descs + 1;
+	for(j = 0;j < blocks;j++) {
+		pDmaBlock = &buf_entry->desc_blocks[block + j];
+		pBlockDesc = pDmaBlock->cpu_addr;
+		descs = (j == blocks - 1) ? adj_descs % block_descs + 1 : block_descs;
 
-	pSgdmaDesc = pDmaBlock->cpu_addr;
-	for(i = 0;i < adj_descs;i++, pSgdmaDesc++) {
+		for(i = 0;i < descs - 1;i++, pBlockDesc++) {
 #if 0
-		pr_warn("%d: bytes %u, src_addr 0x%llx, dst_addr 0x%llx, nxt_addr 0x%llx, Nxt_adj %d\n",
-			i, le32_to_cpu(pSgdmaDesc->bytes),
-			((u64)(le32_to_cpu(pSgdmaDesc->src_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->src_addr_lo),
-			((u64)(le32_to_cpu(pSgdmaDesc->dst_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->dst_addr_lo),
-			((u64)(le32_to_cpu(pSgdmaDesc->next_hi)) << 32) | le32_to_cpu(pSgdmaDesc->next_lo),
-			adj_descs - i);
+			pr_warn("%d: bytes %u, src_addr 0x%llx, dst_addr 0x%llx, nxt_addr 0x%llx, Nxt_adj %d\n",
+				i, le32_to_cpu(pBlockDesc->bytes),
+				((u64)(le32_to_cpu(pBlockDesc->src_addr_hi)) << 32) | le32_to_cpu(pBlockDesc->src_addr_lo),
+				((u64)(le32_to_cpu(pBlockDesc->dst_addr_hi)) << 32) | le32_to_cpu(pBlockDesc->dst_addr_lo),
+				((u64)(le32_to_cpu(pBlockDesc->next_hi)) << 32) | le32_to_cpu(pBlockDesc->next_lo),
+				descs - 1 - i);
 #endif
 
-		pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | ((adj_descs - i) << 8));
-	}
+			pBlockDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | ((descs - 1 - i) << 8));
+		}
 
-#if 0
-	pr_warn("%d: bytes %u, src_addr 0x%llx, dst_addr 0x%llx, nxt_addr 0x%llx, Nxt_adj %d\n",
-		i, le32_to_cpu(pSgdmaDesc->bytes),
-		((u64)(le32_to_cpu(pSgdmaDesc->src_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->src_addr_lo),
-		((u64)(le32_to_cpu(pSgdmaDesc->dst_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->dst_addr_lo),
-		((u64)(le32_to_cpu(pSgdmaDesc->next_hi)) << 32) | le32_to_cpu(pSgdmaDesc->next_lo),
-		adj_descs - i);
-#endif
+		pBlockDesc->control = cpu_to_le32(XDMA_DESC_MAGIC);
+	}
 
 	pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | XDMA_DESC_STOPPED);
 
-	buf_entry->dsc_adr = pDmaBlock->dma_handle;
-	buf_entry->dsc_adj = adj_descs;
-#if 0
-	pr_warn("---- dsc_adr 0x%llx, dsc_adj %u\n", buf_entry->dsc_adr, buf_entry->dsc_adj);
-#endif
+	buf_entry->stripes[stripe].dsc_adr = buf_entry->desc_blocks[block].dma_handle;
+	buf_entry->stripes[stripe].dsc_adj = (blocks > 1) ? block_descs - 1 : adj_descs;
+	buf_entry->stripes[stripe].descs = adj_descs + 1;
+	buf_entry->stripes[stripe].bytes = size;
 
-	dma_sync_single_for_device(buf_entry->dev, pDmaBlock->dma_handle, PAGE_SIZE, DMA_TO_DEVICE);
+	for(j = 0;j < blocks;j++)
+		dma_sync_single_for_device(buf_entry->dev, buf_entry->desc_blocks[block + j].dma_handle, PAGE_SIZE, DMA_TO_DEVICE);
 
-	return 0;
+	buf_entry->descs += adj_descs + 1;
+
+	return blocks;
 
 err0:
 	return err;
@@ -362,20 +451,22 @@ static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entr
 		goto err0;
 	}
 
-	pr_info("%08X %d x %d, %lu\n", self->format.fmt, self->format.width, self->format.height, buffer_size);
+	pr_debug("%08X %d x %d, %lu\n", self->format.fmt, self->format.width, self->format.height, buffer_size);
 
 	pDmaBlock = &buf_entry->desc_blocks[0];
 	pSgdmaDesc = pDmaBlock->cpu_addr;
-	pr_info("reg[0x00]=0x%x dsc_adr 0x%llx, dsc_adj %u, dst_addr %x:%x\n",
+	pr_debug("reg[0x00]=0x%x dsc_adr 0x%llx, dsc_adj %u, dst_addr %x:%x\n",
 		io_read_reg(reg, 0x00), buf_entry->dsc_adr, buf_entry->dsc_adj, (u32)pSgdmaDesc->dst_addr_hi, (u32)pSgdmaDesc->dst_addr_lo);
 
 	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
 	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
 	io_write_reg(reg, 0x18, buf_entry->dsc_adj);
 	io_write_reg(reg, 0x1C, buffer_size);
+	buf_entry->start_ns = ktime_get_ns();
 	io_write_reg(reg, 0x00, 0x01); // ap_start
+	trace_qvio_ap_start(self, buf_entry, self->sequence);
 
-	pr_info("QDMA WR started...\n");
+	pr_debug("QDMA WR started...\n");
 
 	return 0;
 
@@ -383,6 +474,16 @@ err0:
 	return err;
 }
 
+void qvio_qdma_wr_start(struct qvio_qdma_wr* self, dma_addr_t dsc_adr, u16 dsc_adj, size_t size) {
+	uintptr_t reg = (uintptr_t)self->reg;
+
+	io_write_reg(reg, 0x10, cpu_to_le32(PCI_DMA_L(dsc_adr)));
+	io_write_reg(reg, 0x14, cpu_to_le32(PCI_DMA_H(dsc_adr)));
+	io_write_reg(reg, 0x18, dsc_adj);
+	io_write_reg(reg, 0x1C, size);
+	io_write_reg(reg, 0x00, 0x01); // ap_start
+}
+
 static int __streamon(struct qvio_video_queue* self) {
 	int err;
 	struct qvio_qdma_wr* qdma_wr = self->parent;
@@ -7,6 +7,7 @@
 #include "cdev.h"
 #include "zdev.h"
 #include "video_queue.h"
+#include "xdma_desc.h"
 
 struct qvio_qdma_wr {
 	struct kref ref;
@@ -21,6 +22,12 @@ struct qvio_qdma_wr {
 	struct qvio_video_queue* video_queue;
 	int irq_counter;
 	struct dma_pool* desc_pool;
+	struct xdma_desc_policy desc_policy;
+
+	// ganged capture, ap_done goes to band_done() instead of the video queue
+	void (*band_done)(void* owner, int band);
+	void* band_owner;
+	int band;
 };
 
 // register
@@ -38,4 +45,15 @@ void qvio_qdma_wr_remove(struct qvio_qdma_wr* self);
 
 irqreturn_t qvio_qdma_wr_irq_handler(int irq, void *dev_id);
 
+// descriptor chain of the first buffer_size bytes of sgt
+int qvio_qdma_wr_build_descs(struct qvio_qdma_wr* self, struct sg_table* sgt, size_t buffer_size, struct qvio_buf_entry* buf_entry);
+
+// descriptor chain of [offset, offset + size) of sgt into stripes[stripe], from desc_blocks[block] on,
+// returns the number of blocks used
+int qvio_qdma_wr_build_chain(struct qvio_qdma_wr* self, struct sg_table* sgt, size_t offset, size_t size,
+	struct qvio_buf_entry* buf_entry, int block, int stripe);
+
+// run a single chain of size bytes, the engine must be streaming
+void qvio_qdma_wr_start(struct qvio_qdma_wr* self, dma_addr_t dsc_adr, u16 dsc_adj, size_t size);
+
 #endif // __QVIO_QDMA_WR_H__
@@ -2,10 +2,22 @@
 
 #include "queue.h"
 #include "video.h"
+#include "utils.h"
+#include "trace.h"
 
 #include <linux/kernel.h>
 #include <media/videobuf2-v4l2.h>
 #include <media/videobuf2-dma-contig.h>
+#include <media/videobuf2-dma-sg.h>
+#include <media/videobuf2-vmalloc.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/dma-buf.h>
+#include <linux/timekeeping.h>
+
+static char* vb2_mem = "dma-contig";
+module_param(vb2_mem, charp, 0444);
+MODULE_PARM_DESC(vb2_mem, "vb2 memory backend of the V4L2 nodes: dma-contig, dma-sg or vmalloc");
 
 struct __queue_buffer {
 	struct vb2_v4l2_buffer vb;
@@ -14,12 +26,49 @@ struct __queue_buffer {
 	// vb2_buffer dma access
 	struct sg_table sgt;
 	enum dma_data_direction dma_dir;
+
+	// engine mode descriptors
+	struct qvio_buf_entry* buf_entry;
+
+	// engine mode DMABUF import, cached across queue cycles
+	struct dma_buf* dmabuf;
+	struct dma_buf_attachment* attach;
+	struct sg_table* dmabuf_sgt;
 };
 
+static int __engine_buf_init(struct vb2_buffer *buffer);
+static void __engine_buf_cleanup(struct vb2_buffer *buffer);
+static void __engine_buf_queue(struct vb2_buffer *buffer);
+static int __engine_start_streaming(struct vb2_queue *queue, unsigned int count);
+static void __engine_stop_streaming(struct vb2_queue *queue);
+
 void qvio_queue_init(struct qvio_queue* self) {
 	mutex_init(&self->queue_mutex);
 	INIT_LIST_HEAD(&self->buffers);
 	mutex_init(&self->buffers_mutex);
+
+	if(! strcmp(vb2_mem, "dma-sg"))
+		self->mem = QVIO_QUEUE_MEM_DMA_SG;
+	else if(! strcmp(vb2_mem, "vmalloc"))
+		self->mem = QVIO_QUEUE_MEM_VMALLOC;
+	else
+		self->mem = QVIO_QUEUE_MEM_DMA_CONTIG;
+}
+
+static dma_addr_t __plane_dma_addr(struct qvio_queue* self, struct vb2_buffer *buffer) {
+	struct sg_table* sgt;
+
+	switch(self->mem) {
+	case QVIO_QUEUE_MEM_DMA_CONTIG:
+		return vb2_dma_contig_plane_dma_addr(buffer, 0);
+
+	case QVIO_QUEUE_MEM_DMA_SG:
+		sgt = vb2_dma_sg_plane_desc(buffer, 0);
+		return sgt ? sg_dma_address(sgt->sgl) : 0;
+
+	default:
+		return 0;
+	}
 }
 
 static int __queue_setup(struct vb2_queue *queue,
@@ -30,7 +79,8 @@ static int __queue_setup(struct vb2_queue *queue,
 	int err = 0;
 	struct qvio_queue* self = container_of(queue, struct qvio_queue, queue);
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
+	struct qvio_umods_rsp rsp;
 	int i;
 
 	pr_info("+param %d %d\n", *num_buffers, *num_planes);
@@ -45,19 +95,19 @@ static int __queue_setup(struct vb2_queue *queue,
 		case V4L2_PIX_FMT_YUYV:
 			sizes[0] = ALIGN(self->current_format.fmt.pix.width * 2, self->halign) *
 				ALIGN(self->current_format.fmt.pix.height, self->valign);
-			alloc_devs[0] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
 			break;
 
 		case V4L2_PIX_FMT_NV12:
 			sizes[0] = ALIGN(self->current_format.fmt.pix.width, self->halign) *
 				ALIGN(self->current_format.fmt.pix.height, self->valign) * 3 / 2;
-			alloc_devs[0] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
 			break;
 
 		case V4L2_PIX_FMT_M420:
 			sizes[0] = ALIGN(self->current_format.fmt.pix.width, self->halign) *
 				ALIGN(self->current_format.fmt.pix.height * 3 / 2, self->valign);
-			alloc_devs[0] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
 			break;
 
 		default:
@@ -74,7 +124,7 @@ static int __queue_setup(struct vb2_queue *queue,
 			*num_planes = 1;
 			sizes[0] = ALIGN(self->current_format.fmt.pix_mp.width * 2, self->halign) *
 				ALIGN(self->current_format.fmt.pix_mp.height, self->valign);
-			alloc_devs[0] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
 			break;
 
 		case V4L2_PIX_FMT_NV12:
@@ -83,15 +133,15 @@ static int __queue_setup(struct vb2_queue *queue,
 				ALIGN(self->current_format.fmt.pix_mp.height, self->valign);
 			sizes[1] = ALIGN(self->current_format.fmt.pix_mp.width, self->halign) *
 				ALIGN(self->current_format.fmt.pix_mp.height, self->valign) / 2;
-			alloc_devs[0] = video->qdev->dev;
-			alloc_devs[1] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
+			alloc_devs[1] = self->dev;
 			break;
 
 		case V4L2_PIX_FMT_M420:
 			*num_planes = 1;
 			sizes[0] = ALIGN(self->current_format.fmt.pix_mp.width, self->halign) *
 				ALIGN(self->current_format.fmt.pix_mp.height * 3 / 2, self->valign);
-			alloc_devs[0] = video->qdev->dev;
+			alloc_devs[0] = self->dev;
 			break;
 
 		default:
@@ -111,23 +161,29 @@ static int __queue_setup(struct vb2_queue *queue,
 
 	pr_info("-param %d %d [%d %d]\n", *num_buffers, *num_planes, sizes[0], sizes[1]);
 
-	err = qvio_umods_req_entry_new(&req_entry);
-	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+	if(video->qdma_wr) // no daemon behind an engine node
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_QUEUE_SETUP;
+	req.u.queue_setup.num_buffers = *num_buffers;
+	req.u.queue_setup.num_planes = *num_planes;
+	for(i = 0;i < (int)*num_planes;i++)
+		req.u.queue_setup.sizes[i] = sizes[i];
+	err = qvio_umods_call(&video->umods, &req, &rsp);
+	if(err && err != -ENODEV) { // -ENODEV: no daemon to veto
+		pr_err("qvio_umods_call() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_QUEUE_SETUP;
-	req_entry->req.u.queue_setup.num_buffers = *num_buffers;
-	req_entry->req.u.queue_setup.num_planes = *num_planes;
-	for(i = 0;i < (int)*num_planes;i++)
-		req_entry->req.u.queue_setup.sizes[i] = sizes[i];
-	qvio_umods_request(&video->umods, req_entry);
+	if(rsp.u.queue_setup.flags < 0) {
+		err = rsp.u.queue_setup.flags;
+		pr_err("rsp.u.queue_setup.flags=%d\n", err);
+		goto err0;
+	}
 
 	return 0;
 
-err1:
-	kfree(req_entry);
 err0:
 	return err;
 }
@@ -212,13 +268,16 @@ static int __buf_init(struct vb2_buffer *buffer) {
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
 	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
 	int plane_size;
 	void* vaddr;
 	dma_addr_t dma_addr;
 
+	if(video->qdma_wr)
+		return __engine_buf_init(buffer);
+
 #if 1 // DEBUG
-	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
+	pr_debug("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
 #endif
 
 	plane_size = vb2_plane_size(buffer, 0);
@@ -228,7 +287,7 @@ static int __buf_init(struct vb2_buffer *buffer) {
 		vaddr = vb2_plane_vaddr(buffer, 0);
 
 		buf->dma_dir = DMA_NONE;
-		err = vmalloc_dma_map_sg(video->qdev->dev, vaddr, plane_size, &buf->sgt, DMA_BIDIRECTIONAL);
+		err = vmalloc_dma_map_sg(self->dev, vaddr, plane_size, &buf->sgt, DMA_BIDIRECTIONAL);
 		if(err) {
 			pr_err("vmalloc_dma_map_sg() failed, err=%d\n", err);
 			goto err0;
@@ -236,17 +295,17 @@ static int __buf_init(struct vb2_buffer *buffer) {
 		buf->dma_dir = DMA_BIDIRECTIONAL;
 
 #if 1 // DEBUG
-		pr_info("plane_size=%d, vaddr=%p\n", (int)plane_size, vaddr);
+		pr_debug("plane_size=%d, vaddr=%p\n", (int)plane_size, vaddr);
 		sgt_dump(&buf->sgt);
 #endif
 
 		break;
 
 	case V4L2_MEMORY_DMABUF:
-		dma_addr = vb2_dma_contig_plane_dma_addr(buffer, 0);
+		dma_addr = __plane_dma_addr(self, buffer);
 
 #if 1 // DEBUG
-		pr_info("plane_size=%d, dma_addr=0x%llx\n", (int)plane_size, dma_addr);
+		pr_debug("plane_size=%d, dma_addr=0x%llx\n", (int)plane_size, dma_addr);
 #endif
 		break;
 
@@ -257,19 +316,18 @@ static int __buf_init(struct vb2_buffer *buffer) {
 		break;
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_BUF_INIT;
+	req.u.buf_init.index = buffer->index;
+	req.u.buf_init.type = buffer->type;
+	req.u.buf_init.memory = buffer->memory;
+	req.u.buf_init.timestamp = buffer->timestamp;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_BUF_INIT;
-	req_entry->req.u.buf_init.index = buffer->index;
-	req_entry->req.u.buf_init.type = buffer->type;
-	req_entry->req.u.buf_init.memory = buffer->memory;
-	req_entry->req.u.buf_init.timestamp = buffer->timestamp;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return 0;
 
 err0:
@@ -283,10 +341,15 @@ static void __buf_cleanup(struct vb2_buffer *buffer) {
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
 	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
 	struct sg_table* sgt = &buf->sgt;
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
+
+	if(video->qdma_wr) {
+		__engine_buf_cleanup(buffer);
+		return;
+	}
 
 #if 1 // DEBUG
-	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
+	pr_debug("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
 #endif
 
 	switch(buffer->memory) {
@@ -295,7 +358,7 @@ static void __buf_cleanup(struct vb2_buffer *buffer) {
 		sgt_dump(sgt);
 #endif
 
-		dma_unmap_sg(video->qdev->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+		dma_unmap_sg(self->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
 		sg_free_table(sgt);
 		buf->dma_dir = DMA_NONE;
 		break;
@@ -309,19 +372,18 @@ static void __buf_cleanup(struct vb2_buffer *buffer) {
 		break;
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_BUF_CLEANUP;
+	req.u.buf_cleanup.index = buffer->index;
+	req.u.buf_cleanup.type = buffer->type;
+	req.u.buf_cleanup.memory = buffer->memory;
+	req.u.buf_cleanup.timestamp = buffer->timestamp;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_BUF_CLEANUP;
-	req_entry->req.u.buf_cleanup.index = buffer->index;
-	req_entry->req.u.buf_cleanup.type = buffer->type;
-	req_entry->req.u.buf_cleanup.memory = buffer->memory;
-	req_entry->req.u.buf_cleanup.timestamp = buffer->timestamp;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return;
 
 err0:
@@ -336,14 +398,14 @@ static int __buf_prepare(struct vb2_buffer *buffer) {
 	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
 	int plane_size;
 	dma_addr_t dma_addr;
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
 
 #if 1 // DEBUG
-	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
+	pr_debug("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
 #endif
 
-	dma_addr = vb2_dma_contig_plane_dma_addr(buffer, 0);
-	pr_info("dma_addr=0x%llx\n", dma_addr);
+	dma_addr = __plane_dma_addr(self, buffer);
+	pr_debug("dma_addr=0x%llx\n", dma_addr);
 
 	switch(self->current_format.type) {
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
@@ -457,9 +519,17 @@ static int __buf_prepare(struct vb2_buffer *buffer) {
 	if(vbuf->field == V4L2_FIELD_ANY)
 		vbuf->field = V4L2_FIELD_NONE;
 
+	if(video->qdma_wr) {
+		// only a vmalloc backend is mapped by us, vb2 memops sync the others
+		if(buf->dma_dir != DMA_NONE)
+			dma_sync_sg_for_device(self->dev, buf->sgt.sgl, buf->sgt.orig_nents, buf->dma_dir);
+
+		return 0;
+	}
+
 	switch(buffer->memory) {
 	case V4L2_MEMORY_MMAP:
-		dma_sync_sg_for_device(video->qdev->dev, buf->sgt.sgl, buf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+		dma_sync_sg_for_device(self->dev, buf->sgt.sgl, buf->sgt.orig_nents, DMA_BIDIRECTIONAL);
 		break;
 
 	case V4L2_MEMORY_DMABUF:
@@ -471,19 +541,18 @@ static int __buf_prepare(struct vb2_buffer *buffer) {
 		break;
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_BUF_PREPARE;
+	req.u.buf_prepare.index = buffer->index;
+	req.u.buf_prepare.type = buffer->type;
+	req.u.buf_prepare.memory = buffer->memory;
+	req.u.buf_prepare.timestamp = buffer->timestamp;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_BUF_PREPARE;
-	req_entry->req.u.buf_prepare.index = buffer->index;
-	req_entry->req.u.buf_prepare.type = buffer->type;
-	req_entry->req.u.buf_prepare.memory = buffer->memory;
-	req_entry->req.u.buf_prepare.timestamp = buffer->timestamp;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return 0;
 
 err0:
@@ -497,15 +566,28 @@ static void __buf_finish(struct vb2_buffer *buffer) {
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
 	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
 	struct sg_table* sgt = &buf->sgt;
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
+
+	if(video->qdma_wr) {
+		if(buf->dma_dir != DMA_NONE)
+			dma_sync_sg_for_cpu(self->dev, sgt->sgl, sgt->orig_nents, buf->dma_dir);
+
+		// DQBUF, or a completed buffer dropped at STREAMOFF
+		if(buffer->state == VB2_BUF_STATE_DONE && buf->buf_entry) {
+			qvio_stats_lat(&video->qdma_wr->video_queue->stats, QVIO_STATS_LAT_IRQ_DQBUF,
+				buf->buf_entry->done_ns, ktime_get_ns());
+		}
+
+		return;
+	}
 
 #if 1 // DEBUG
-	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
+	pr_debug("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
 #endif
 
 	switch(buffer->memory) {
 	case V4L2_MEMORY_MMAP:
-		dma_sync_sg_for_cpu(video->qdev->dev, sgt->sgl, sgt->orig_nents, DMA_BIDIRECTIONAL);
+		dma_sync_sg_for_cpu(self->dev, sgt->sgl, sgt->orig_nents, DMA_BIDIRECTIONAL);
 		break;
 
 	case V4L2_MEMORY_DMABUF:
@@ -517,19 +599,18 @@ static void __buf_finish(struct vb2_buffer *buffer) {
 		break;
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_BUF_FINISH;
+	req.u.buf_finish.index = buffer->index;
+	req.u.buf_finish.type = buffer->type;
+	req.u.buf_finish.memory = buffer->memory;
+	req.u.buf_finish.timestamp = buffer->timestamp;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_BUF_FINISH;
-	req_entry->req.u.buf_finish.index = buffer->index;
-	req_entry->req.u.buf_finish.type = buffer->type;
-	req_entry->req.u.buf_finish.memory = buffer->memory;
-	req_entry->req.u.buf_finish.timestamp = buffer->timestamp;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return;
 
 err0:
@@ -542,7 +623,12 @@ static void __buf_queue(struct vb2_buffer *buffer) {
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
 	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
 	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
+
+	if(video->qdma_wr) {
+		__engine_buf_queue(buffer);
+		return;
+	}
 
 #if 0 // DEBUG
 	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
@@ -553,19 +639,18 @@ static void __buf_queue(struct vb2_buffer *buffer) {
 		mutex_unlock(&self->buffers_mutex);
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_BUF_QUEUE;
+	req.u.buf_queue.index = buffer->index;
+	req.u.buf_queue.type = buffer->type;
+	req.u.buf_queue.memory = buffer->memory;
+	req.u.buf_queue.timestamp = buffer->timestamp;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_BUF_QUEUE;
-	req_entry->req.u.buf_queue.index = buffer->index;
-	req_entry->req.u.buf_queue.type = buffer->type;
-	req_entry->req.u.buf_queue.memory = buffer->memory;
-	req_entry->req.u.buf_queue.timestamp = buffer->timestamp;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return;
 
 err0:
@@ -578,27 +663,45 @@ static int __start_streaming(struct vb2_queue *queue, unsigned int count) {
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
 	struct qvio_device* qdev = video->qdev;
 	struct __queue_buffer* buf;
-	struct qvio_umods_req_entry* req_entry;
+	struct __queue_buffer* node;
+	struct qvio_umods_req req;
+	struct qvio_umods_rsp rsp;
 	ssize_t size;
 
 	pr_info("count=%d\n", count);
 
+	if(video->qdma_wr)
+		return __engine_start_streaming(queue, count);
+
 	self->sequence = 0;
 
-	err = qvio_umods_req_entry_new(&req_entry);
-	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_START_STREAMING;
+	req.u.start_streaming.count = count;
+	err = qvio_umods_call(&video->umods, &req, &rsp);
+	if(err && err != -ENODEV) { // -ENODEV: no daemon to veto
+		pr_err("qvio_umods_call() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_START_STREAMING;
-	req_entry->req.u.start_streaming.count = count;
-	qvio_umods_request(&video->umods, req_entry);
+	if(rsp.u.start_streaming.flags < 0) {
+		err = rsp.u.start_streaming.flags;
+		pr_err("rsp.u.start_streaming.flags=%d\n", err);
+		goto err0;
+	}
 
 	return 0;
 
 err0:
-	return -EIO;
+	// vb2 wants the queued buffers back when start_streaming fails
+	mutex_lock(&self->buffers_mutex);
+	list_for_each_entry_safe(buf, node, &self->buffers, list_ready) {
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_QUEUED);
+		list_del(&buf->list_ready);
+	}
+	mutex_unlock(&self->buffers_mutex);
+
+	return err;
 }
 
 static void __stop_streaming(struct vb2_queue *queue) {
@@ -606,17 +709,22 @@ static void __stop_streaming(struct vb2_queue *queue) {
 	struct qvio_queue* self = container_of(queue, struct qvio_queue, queue);
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
 	struct qvio_device* qdev = video->qdev;
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
 
 	pr_info("\n");
 
+	if(video->qdma_wr) {
+		__engine_stop_streaming(queue);
+		return;
+	}
+
 	if (!mutex_lock_interruptible(&self->buffers_mutex)) {
 		struct __queue_buffer* buf;
 		struct __queue_buffer* node;
 
 		list_for_each_entry_safe(buf, node, &self->buffers, list_ready) {
 #if 1 // DEBUG
-			pr_info("vb2_buffer_done: %p %d\n", buf, buf->vb.vb2_buf.index);
+			pr_debug("vb2_buffer_done: %p %d\n", buf, buf->vb.vb2_buf.index);
 #endif
 
 			vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
@@ -626,22 +734,384 @@ static void __stop_streaming(struct vb2_queue *queue) {
 		mutex_unlock(&self->buffers_mutex);
 	}
 
-	err = qvio_umods_req_entry_new(&req_entry);
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_STOP_STREAMING;
+	req.u.stop_streaming.flags = 0;
+	err = qvio_umods_request(&video->umods, &req);
 	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		pr_err("qvio_umods_request() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_STOP_STREAMING;
-	req_entry->req.u.stop_streaming.flags = 0;
-	qvio_umods_request(&video->umods, req_entry);
-
 	return;
 
 err0:
 	return;
 }
 
+/* DMA mapped segments of plane 0, whatever the vb2 memory backend is */
+static int __engine_buf_sgt(struct qvio_queue* self, struct vb2_buffer *buffer, struct __queue_buffer* buf, size_t size, struct sg_table** sgt) {
+	int err;
+
+	switch(self->mem) {
+	case QVIO_QUEUE_MEM_DMA_CONTIG:
+		// dma-contig memory is a single DMA segment
+		err = sg_alloc_table(&buf->sgt, 1, GFP_KERNEL);
+		if(err) {
+			pr_err("sg_alloc_table() failed, err=%d\n", err);
+			goto err0;
+		}
+		sg_dma_address(buf->sgt.sgl) = vb2_dma_contig_plane_dma_addr(buffer, 0);
+		sg_dma_len(buf->sgt.sgl) = size;
+		buf->dma_dir = DMA_NONE;
+		*sgt = &buf->sgt;
+		break;
+
+	case QVIO_QUEUE_MEM_DMA_SG:
+		// already mapped by vb2 for self->dev
+		*sgt = vb2_dma_sg_plane_desc(buffer, 0);
+		if(! *sgt) {
+			pr_err("vb2_dma_sg_plane_desc() failed\n");
+			err = -EINVAL;
+			goto err0;
+		}
+		buf->dma_dir = DMA_NONE;
+		break;
+
+	case QVIO_QUEUE_MEM_VMALLOC:
+		buf->dma_dir = DMA_NONE;
+		err = vmalloc_dma_map_sg(self->dev, vb2_plane_vaddr(buffer, 0), vb2_plane_size(buffer, 0), &buf->sgt, DMA_FROM_DEVICE);
+		if(err) {
+			pr_err("vmalloc_dma_map_sg() failed, err=%d\n", err);
+			goto err0;
+		}
+		buf->dma_dir = DMA_FROM_DEVICE;
+		*sgt = &buf->sgt;
+		break;
+
+	default:
+		pr_err("unexpected value, self->mem=%d\n", (int)self->mem);
+		err = -EINVAL;
+		goto err0;
+		break;
+	}
+
+	return 0;
+
+err0:
+	return err;
+}
+
+static void __engine_buf_sgt_free(struct qvio_queue* self, struct __queue_buffer* buf) {
+	if(! buf->sgt.sgl)
+		return;
+
+	if(buf->dma_dir != DMA_NONE)
+		dma_unmap_sg(self->dev, buf->sgt.sgl, buf->sgt.orig_nents, buf->dma_dir);
+	sg_free_table(&buf->sgt);
+	memset(&buf->sgt, 0, sizeof(buf->sgt));
+	buf->dma_dir = DMA_NONE;
+}
+
+/* own attachment of an imported dma-buf, kept mapped until vb2 swaps the fd */
+static int __engine_dmabuf_import(struct qvio_queue* self, struct vb2_buffer *buffer, struct __queue_buffer* buf, size_t size, struct sg_table** sgt) {
+	int err;
+	struct dma_buf *dmabuf = buffer->planes[0].dbuf;
+	struct dma_buf_attachment *attach;
+	struct sg_table* dmabuf_sgt;
+
+	if(! dmabuf || dmabuf->size < size) {
+		pr_err("unexpected value, dmabuf=%p size=%lu\n", dmabuf, size);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	get_dma_buf(dmabuf);
+
+	attach = dma_buf_attach(dmabuf, self->dev);
+	if (IS_ERR(attach)) {
+		err = PTR_ERR(attach);
+		pr_err("dma_buf_attach() failed, err=%d\n", err);
+		goto err1;
+	}
+
+#if KERNEL_VERSION(6, 2, 0) <= LINUX_VERSION_CODE
+	dmabuf_sgt = dma_buf_map_attachment_unlocked(attach, DMA_FROM_DEVICE);
+#else
+	dmabuf_sgt = dma_buf_map_attachment(attach, DMA_FROM_DEVICE);
+#endif
+	if (IS_ERR(dmabuf_sgt)) {
+		err = PTR_ERR(dmabuf_sgt);
+		pr_err("dma_buf_map_attachment() failed, err=%d\n", err);
+		goto err2;
+	}
+
+	buf->dmabuf = dmabuf;
+	buf->attach = attach;
+	buf->dmabuf_sgt = dmabuf_sgt;
+	buf->dma_dir = DMA_NONE; // CPU access goes through DMA_BUF_IOCTL_SYNC
+	*sgt = dmabuf_sgt;
+
+	return 0;
+
+err2:
+	dma_buf_detach(dmabuf, attach);
+err1:
+	dma_buf_put(dmabuf);
+err0:
+	return err;
+}
+
+static void __engine_dmabuf_release(struct qvio_queue* self, struct __queue_buffer* buf) {
+	if(! buf->dmabuf)
+		return;
+
+#if KERNEL_VERSION(6, 2, 0) <= LINUX_VERSION_CODE
+	dma_buf_unmap_attachment_unlocked(buf->attach, buf->dmabuf_sgt, DMA_FROM_DEVICE);
+#else
+	dma_buf_unmap_attachment(buf->attach, buf->dmabuf_sgt, DMA_FROM_DEVICE);
+#endif
+	dma_buf_detach(buf->dmabuf, buf->attach);
+	dma_buf_put(buf->dmabuf);
+
+	buf->dmabuf = NULL;
+	buf->attach = NULL;
+	buf->dmabuf_sgt = NULL;
+}
+
+static int __engine_buf_init(struct vb2_buffer *buffer) {
+	int err;
+	struct qvio_queue* self = vb2_get_drv_priv(buffer->vb2_queue);
+	struct qvio_video* video = container_of(self, struct qvio_video, queue);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
+	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
+	struct qvio_buf_entry* buf_entry;
+	struct sg_table* sgt;
+	size_t plane_size;
+
+#if 0 // DEBUG
+	pr_info("param: %p %p %d %p\n", self, vbuf, vbuf->vb2_buf.index, buf);
+#endif
+
+	if(buffer->num_planes != 1) {
+		pr_err("unexpected value, buffer->num_planes=%d\n", (int)buffer->num_planes);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	plane_size = min_t(size_t, vb2_plane_size(buffer, 0), self->current_format.fmt.pix.sizeimage);
+
+	// vb2 maps dma-bufs again on every QBUF, the descriptors need a stable mapping
+	if(buffer->memory == V4L2_MEMORY_DMABUF)
+		err = __engine_dmabuf_import(self, buffer, buf, plane_size, &sgt);
+	else
+		err = __engine_buf_sgt(self, buffer, buf, plane_size, &sgt);
+	if(err) {
+		pr_err("failed to get the DMA segments, err=%d\n", err);
+		goto err0;
+	}
+	trace_qvio_map(video->qdma_wr->video_queue, buffer->index, sgt, plane_size);
+
+	buf_entry = qvio_buf_entry_new();
+	if(! buf_entry) {
+		err = -ENOMEM;
+		goto err1;
+	}
+
+	buf_entry->buf.index = buffer->index;
+	buf_entry->buf.buf_type = QVIO_BUF_TYPE_EXTERNAL;
+	buf_entry->dma_dir = DMA_FROM_DEVICE;
+	buf_entry->private_data = buf;
+
+	err = qvio_qdma_wr_build_descs(video->qdma_wr, sgt, plane_size, buf_entry);
+	if(err) {
+		pr_err("qvio_qdma_wr_build_descs() failed, err=%d\n", err);
+		goto err2;
+	}
+
+	buf->buf_entry = buf_entry;
+
+	return 0;
+
+err2:
+	qvio_buf_entry_put(buf_entry);
+err1:
+	__engine_dmabuf_release(self, buf);
+	__engine_buf_sgt_free(self, buf);
+err0:
+	return err;
+}
+
+static void __engine_buf_cleanup(struct vb2_buffer *buffer) {
+	struct qvio_queue* self = vb2_get_drv_priv(buffer->vb2_queue);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
+	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
+
+	qvio_buf_entry_put(buf->buf_entry);
+	buf->buf_entry = NULL;
+	__engine_dmabuf_release(self, buf);
+	__engine_buf_sgt_free(self, buf);
+}
+
+static void __engine_frame_meta(struct qvio_queue* self, struct __queue_buffer* buf,
+	struct qvio_video_queue* video_queue, struct qvio_buf_entry* buf_entry) {
+	struct qvio_video* video = container_of(self, struct qvio_video, queue);
+	struct qvio_zdev* zdev = video->qdma_wr->zdev;
+	struct qvio_frame_meta frame_meta;
+	unsigned long flags;
+
+	memset(&frame_meta, 0, sizeof(frame_meta));
+	frame_meta.sequence = buf->vb.sequence;
+	frame_meta.timestamp = buf_entry->done_ns;
+	frame_meta.start_ns = buf_entry->start_ns;
+	frame_meta.dma_ns = (u32)(buf_entry->done_ns - buf_entry->start_ns);
+	if(zdev) {
+		frame_meta.ticks = qvio_zdev_ticks(zdev);
+		frame_meta.value0 = qvio_zdev_value0(zdev);
+	}
+	frame_meta.bytes = vb2_get_plane_payload(&buf->vb.vb2_buf, 0);
+	spin_lock_irqsave(&video_queue->lock, flags);
+	frame_meta.starved = video_queue->starved;
+	if(list_empty(&video_queue->job_list)) // the engine idles until the next QBUF
+		frame_meta.flags |= QVIO_FRAME_META_FLAG_STARVED;
+	spin_unlock_irqrestore(&video_queue->lock, flags);
+
+	qvio_meta_frame_done(&video->meta, &frame_meta);
+}
+
+static void __engine_buf_done(struct qvio_video_queue* video_queue, struct qvio_buf_entry* buf_entry, int err) {
+	struct __queue_buffer* buf = buf_entry->private_data;
+	struct qvio_queue* self = vb2_get_drv_priv(buf->vb.vb2_buf.vb2_queue);
+	u64 done_ns = buf_entry->done_ns;
+
+	// called from the engine IRQ handler, or from streamoff with err set
+	if(! err) {
+		buf->vb.vb2_buf.timestamp = buf_entry->done_ns;
+		buf->vb.sequence = self->sequence++;
+		buf->vb.field = V4L2_FIELD_NONE;
+
+		__engine_frame_meta(self, buf, video_queue, buf_entry);
+		trace_qvio_wakeup(video_queue, buf_entry, buf_entry->sequence);
+	}
+
+	qvio_buf_entry_put(buf_entry);
+	vb2_buffer_done(&buf->vb.vb2_buf, err ? VB2_BUF_STATE_ERROR : VB2_BUF_STATE_DONE);
+
+	if(! err)
+		qvio_stats_lat(&video_queue->stats, QVIO_STATS_LAT_IRQ_WAKEUP, done_ns, ktime_get_ns());
+}
+
+static void __engine_qbuf(struct qvio_video* video, struct __queue_buffer* buf) {
+	int err;
+
+	// the job list holds its own reference, dropped in __engine_buf_done()
+	qvio_buf_entry_get(buf->buf_entry);
+
+	err = qvio_video_queue_qbuf(video->qdma_wr->video_queue, buf->buf_entry);
+	if(err) {
+		pr_err("qvio_video_queue_qbuf() failed, err=%d\n", err);
+		qvio_buf_entry_put(buf->buf_entry);
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
+	}
+}
+
+static void __engine_buf_queue(struct vb2_buffer *buffer) {
+	struct qvio_queue* self = vb2_get_drv_priv(buffer->vb2_queue);
+	struct qvio_video* video = container_of(self, struct qvio_video, queue);
+	struct vb2_v4l2_buffer *vbuf = to_vb2_v4l2_buffer(buffer);
+	struct __queue_buffer* buf = container_of(vbuf, struct __queue_buffer, vb);
+
+	// buffers queued before STREAMON wait here until the engine is claimed
+	if(! vb2_start_streaming_called(buffer->vb2_queue)) {
+		mutex_lock(&self->buffers_mutex);
+		list_add_tail(&buf->list_ready, &self->buffers);
+		mutex_unlock(&self->buffers_mutex);
+		return;
+	}
+
+	__engine_qbuf(video, buf);
+}
+
+static int __engine_start_streaming(struct vb2_queue *queue, unsigned int count) {
+	int err;
+	struct qvio_queue* self = container_of(queue, struct qvio_queue, queue);
+	struct qvio_video* video = container_of(self, struct qvio_video, queue);
+	struct qvio_video_queue* video_queue = video->qdma_wr->video_queue;
+	struct __queue_buffer* buf;
+	struct __queue_buffer* node;
+
+	if(self->current_format.type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+		pr_err("unexpected value, self->current_format.type=%d\n", (int)self->current_format.type);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	err = qvio_video_queue_claim(video_queue, self, __engine_buf_done);
+	if(err) {
+		pr_err("qvio_video_queue_claim() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	// the engine only needs the byte count of a frame
+	video_queue->format.fmt = FOURCC_Y800;
+	video_queue->format.width = self->current_format.fmt.pix.bytesperline;
+	video_queue->format.height = self->current_format.fmt.pix.sizeimage / self->current_format.fmt.pix.bytesperline;
+
+	self->sequence = 0;
+
+	err = qvio_video_queue_streamon(video_queue);
+	if(err) {
+		pr_err("qvio_video_queue_streamon() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	mutex_lock(&self->buffers_mutex);
+	list_for_each_entry_safe(buf, node, &self->buffers, list_ready) {
+		list_del(&buf->list_ready);
+		__engine_qbuf(video, buf);
+	}
+	mutex_unlock(&self->buffers_mutex);
+
+	return 0;
+
+err1:
+	qvio_video_queue_release(video_queue, self);
+err0:
+	// vb2 wants the queued buffers back when start_streaming fails
+	mutex_lock(&self->buffers_mutex);
+	list_for_each_entry_safe(buf, node, &self->buffers, list_ready) {
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_QUEUED);
+		list_del(&buf->list_ready);
+	}
+	mutex_unlock(&self->buffers_mutex);
+
+	return err;
+}
+
+static void __engine_stop_streaming(struct vb2_queue *queue) {
+	int err;
+	struct qvio_queue* self = container_of(queue, struct qvio_queue, queue);
+	struct qvio_video* video = container_of(self, struct qvio_video, queue);
+	struct qvio_video_queue* video_queue = video->qdma_wr->video_queue;
+	struct __queue_buffer* buf;
+	struct __queue_buffer* node;
+
+	// stops the engine and returns the in-flight buffers via __engine_buf_done()
+	err = qvio_video_queue_streamoff(video_queue);
+	if(err) {
+		pr_err("qvio_video_queue_streamoff() failed, err=%d\n", err);
+	}
+
+	qvio_video_queue_release(video_queue, self);
+
+	mutex_lock(&self->buffers_mutex);
+	list_for_each_entry_safe(buf, node, &self->buffers, list_ready) {
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
+		list_del(&buf->list_ready);
+	}
+	mutex_unlock(&self->buffers_mutex);
+}
+
 static const struct vb2_ops qvio_vb2_ops = {
 	.queue_setup     = __queue_setup,
 	.buf_init        = __buf_init,
@@ -666,9 +1136,23 @@ int qvio_queue_start(struct qvio_queue* self, enum v4l2_buf_type type) {
 		self->queue.io_modes = VB2_WRITE;
 	self->queue.io_modes |= VB2_MMAP | VB2_USERPTR | VB2_DMABUF;
 	self->queue.drv_priv = self;
+	self->queue.dev = self->dev;
 	self->queue.lock = &self->queue_mutex;
 	self->queue.buf_struct_size = sizeof(struct __queue_buffer);
-	self->queue.mem_ops = &vb2_dma_contig_memops;
+	switch(self->mem) {
+	case QVIO_QUEUE_MEM_DMA_SG:
+		self->queue.mem_ops = &vb2_dma_sg_memops;
+		break;
+
+	case QVIO_QUEUE_MEM_VMALLOC:
+		self->queue.mem_ops = &vb2_vmalloc_memops;
+		break;
+
+	default:
+		self->queue.mem_ops = &vb2_dma_contig_memops;
+		break;
+	}
+	pr_info("vb2_mem=%s\n", vb2_mem);
 	self->queue.ops = &qvio_vb2_ops;
 	self->queue.timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
 	self->queue.min_buffers_needed = 2;
@@ -687,21 +1171,39 @@ struct vb2_queue* qvio_queue_get_vb2_queue(struct qvio_queue* self) {
 int qvio_queue_s_fmt(struct qvio_queue* self, struct v4l2_format *format) {
 	int err;
 	struct qvio_video* video = container_of(self, struct qvio_video, queue);
-	struct qvio_umods_req_entry* req_entry;
+	struct qvio_umods_req req;
+	struct qvio_umods_rsp rsp;
 
 	pr_info("\n");
 
-	memcpy(&self->current_format, format, sizeof(struct v4l2_format));
+	if(video->qdma_wr) {
+		if(vb2_is_busy(&self->queue)) {
+			pr_err("vb2_is_busy()\n");
+			err = -EBUSY;
+			goto err0;
+		}
 
-	err = qvio_umods_req_entry_new(&req_entry);
-	if(err) {
-		pr_err("qvio_umods_req_entry_new() failed err=%d", err);
+		memcpy(&self->current_format, format, sizeof(struct v4l2_format));
+
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.job_id = QVIO_UMODS_JOB_ID_S_FMT;
+	memcpy(&req.u.s_fmt.format, format, sizeof(struct v4l2_format));
+	err = qvio_umods_call(&video->umods, &req, &rsp);
+	if(err && err != -ENODEV) { // -ENODEV: no daemon to veto
+		pr_err("qvio_umods_call() failed err=%d", err);
 		goto err0;
 	}
 
-	req_entry->req.job_id = QVIO_UMODS_JOB_ID_S_FMT;
-	memcpy(&req_entry->req.u.s_fmt.format, format, sizeof(struct v4l2_format));
-	qvio_umods_request(&video->umods, req_entry);
+	if(rsp.u.s_fmt.flags < 0) {
+		err = rsp.u.s_fmt.flags;
+		pr_err("rsp.u.s_fmt.flags=%d\n", err);
+		goto err0;
+	}
+
+	memcpy(&self->current_format, format, sizeof(struct v4l2_format));
 
 	return 0;
 
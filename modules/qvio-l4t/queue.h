@@ -5,7 +5,15 @@
 #include <linux/videodev2.h>
 #include <linux/sched.h>
 
+enum qvio_queue_mem {
+	QVIO_QUEUE_MEM_DMA_CONTIG,
+	QVIO_QUEUE_MEM_DMA_SG,
+	QVIO_QUEUE_MEM_VMALLOC,
+};
+
 struct qvio_queue {
+	struct device *dev;
+	enum qvio_queue_mem mem;
 	struct vb2_queue queue;
 	struct mutex queue_mutex;
 	struct list_head buffers;
@@ -0,0 +1,666 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include "selftest.h"
+#include "stats.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/sort.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/dma-mapping.h>
+#include <linux/timekeeping.h>
+
+#define SELFTEST_MAX_ENGINES	8
+#define SELFTEST_MAX_BUFS		16
+#define SELFTEST_MAX_COUNT		4096
+#define SELFTEST_MAX_SIZE		(64UL << 20)
+#define SELFTEST_TIMEOUT_NS		1000000000ULL
+#define SELFTEST_RESULT_LEN		8192
+
+struct selftest_config {
+	char engines[128];
+	size_t min;
+	size_t max;
+	int count;
+	int bufs;
+	int scatter;
+	int loopback;
+	int poll_us;
+};
+
+static LIST_HEAD(__engines);
+static DEFINE_MUTEX(__mutex);
+static struct dentry* __dir;
+static char __result[SELFTEST_RESULT_LEN];
+static size_t __result_len;
+
+// simulated card memory, sized for each run
+static void* __sim_mem;
+
+static int __sim_build(struct qvio_selftest_engine* self, struct qvio_selftest_buf* buf) {
+	return 0;
+}
+
+static void __sim_start(struct qvio_selftest_engine* self, struct qvio_selftest_buf* buf) {
+	if(self->dir == DMA_FROM_DEVICE)
+		memcpy(buf->vaddr, __sim_mem, buf->bytes);
+	else
+		memcpy(__sim_mem, buf->vaddr, buf->bytes);
+}
+
+static int __sim_poll(struct qvio_selftest_engine* self) {
+	return 1;
+}
+
+static void __sim_stop(struct qvio_selftest_engine* self) {
+}
+
+static struct qvio_selftest_engine __sim_engines[] = {
+	{
+		.name = "sim_rd",
+		.dir = DMA_TO_DEVICE,
+		.build = __sim_build,
+		.start = __sim_start,
+		.poll = __sim_poll,
+		.stop = __sim_stop,
+	},
+	{
+		.name = "sim_wr",
+		.dir = DMA_FROM_DEVICE,
+		.build = __sim_build,
+		.start = __sim_start,
+		.poll = __sim_poll,
+		.stop = __sim_stop,
+	},
+};
+
+static void __buf_free(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf) {
+	int i, npages;
+
+	qvio_buf_entry_put(buf->buf_entry);
+	buf->buf_entry = NULL;
+
+	if(buf->mapped)
+		dma_unmap_sgtable(engine->dev, &buf->sgt, engine->dir, 0);
+	buf->mapped = false;
+
+	if(buf->sgt.sgl)
+		sg_free_table(&buf->sgt);
+
+	if(buf->pages) {
+		npages = buf->size >> PAGE_SHIFT;
+
+		if(buf->vaddr)
+			vunmap(buf->vaddr);
+
+		for(i = 0;i < npages;i++) {
+			if(buf->pages[i])
+				__free_page(buf->pages[i]);
+		}
+		kvfree(buf->pages);
+	}
+
+	if(buf->page)
+		__free_pages(buf->page, get_order(buf->size));
+
+	memset(buf, 0, sizeof(*buf));
+}
+
+static int __buf_alloc(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf, size_t size, bool scatter) {
+	int err;
+	struct scatterlist* sg;
+	int i, npages;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->size = size;
+	npages = size >> PAGE_SHIFT;
+
+	if(scatter) {
+		buf->pages = kvcalloc(npages, sizeof(struct page*), GFP_KERNEL);
+		if(! buf->pages) {
+			pr_err("kvcalloc() failed\n");
+			err = -ENOMEM;
+			goto err0;
+		}
+
+		for(i = 0;i < npages;i++) {
+			buf->pages[i] = alloc_page(GFP_KERNEL);
+			if(! buf->pages[i]) {
+				pr_err("alloc_page() failed\n");
+				err = -ENOMEM;
+				goto err0;
+			}
+		}
+
+		buf->vaddr = vmap(buf->pages, npages, VM_MAP, PAGE_KERNEL);
+		if(! buf->vaddr) {
+			pr_err("vmap() failed\n");
+			err = -ENOMEM;
+			goto err0;
+		}
+
+		// one entry per page, whatever the physical layout
+		err = sg_alloc_table(&buf->sgt, npages, GFP_KERNEL);
+		if(err) {
+			pr_err("sg_alloc_table() failed, err=%d\n", err);
+			goto err0;
+		}
+
+		for_each_sg(buf->sgt.sgl, sg, npages, i)
+			sg_set_page(sg, buf->pages[i], PAGE_SIZE, 0);
+	} else {
+		buf->page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, get_order(size));
+		if(! buf->page) {
+			pr_err("alloc_pages() failed, size=%lu\n", size);
+			err = -ENOMEM;
+			goto err0;
+		}
+		buf->vaddr = page_address(buf->page);
+
+		err = sg_alloc_table(&buf->sgt, 1, GFP_KERNEL);
+		if(err) {
+			pr_err("sg_alloc_table() failed, err=%d\n", err);
+			goto err0;
+		}
+
+		sg_set_page(buf->sgt.sgl, buf->page, size, 0);
+	}
+
+	if(engine->dev) {
+		err = dma_map_sgtable(engine->dev, &buf->sgt, engine->dir, 0);
+		if(err) {
+			pr_err("dma_map_sgtable() failed, err=%d\n", err);
+			goto err0;
+		}
+		buf->mapped = true;
+	}
+
+	return 0;
+
+err0:
+	__buf_free(engine, buf);
+	return err;
+}
+
+static int __buf_build(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf, size_t bytes) {
+	int err;
+
+	qvio_buf_entry_put(buf->buf_entry);
+	buf->buf_entry = qvio_buf_entry_new();
+	if(! buf->buf_entry) {
+		err = -ENOMEM;
+		goto err0;
+	}
+
+	buf->bytes = bytes;
+	buf->buf_entry->dev = engine->dev;
+	buf->buf_entry->desc_pool = engine->desc_pool;
+	buf->buf_entry->dma_dir = engine->dir;
+
+	err = engine->build(engine, buf);
+	if(err) {
+		pr_err("%s: build() failed, err=%d, bytes=%lu\n", engine->name, err, bytes);
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return err;
+}
+
+static void __buf_sync_for_device(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf) {
+	if(buf->mapped)
+		dma_sync_sgtable_for_device(engine->dev, &buf->sgt, engine->dir);
+}
+
+static void __buf_sync_for_cpu(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf) {
+	if(buf->mapped)
+		dma_sync_sgtable_for_cpu(engine->dev, &buf->sgt, engine->dir);
+}
+
+static void __fill(struct qvio_selftest_buf* buf, u32 seed) {
+	u32* p = buf->vaddr;
+	size_t i;
+
+	for(i = 0;i < buf->bytes / sizeof(u32);i++)
+		p[i] = seed ^ (u32)i;
+}
+
+static void __wait_engines(struct qvio_selftest_engine** engines, int count, int poll_us, int* errors) {
+	unsigned long pending = GENMASK(count - 1, 0);
+	u64 deadline = ktime_get_ns() + SELFTEST_TIMEOUT_NS;
+	int i, ret;
+
+	while(pending) {
+		for(i = 0;i < count;i++) {
+			if(! (pending & BIT(i)))
+				continue;
+
+			ret = engines[i]->poll(engines[i]);
+			if(ret == 0)
+				continue;
+
+			if(ret < 0) {
+				pr_err("%s: poll() failed, err=%d\n", engines[i]->name, ret);
+				(*errors)++;
+			}
+
+			engines[i]->stop(engines[i]);
+			pending &= ~BIT(i);
+		}
+
+		if(! pending)
+			break;
+
+		if(ktime_get_ns() > deadline) {
+			for(i = 0;i < count;i++) {
+				if(! (pending & BIT(i)))
+					continue;
+
+				pr_err("%s: timeout\n", engines[i]->name);
+				engines[i]->stop(engines[i]);
+				(*errors)++;
+			}
+			break;
+		}
+
+		if(poll_us)
+			usleep_range(poll_us, poll_us + poll_us / 4 + 1);
+		else
+			cond_resched();
+	}
+}
+
+static int __cmp_u64(const void* a, const void* b) {
+	u64 x = *(const u64*)a;
+	u64 y = *(const u64*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void __report(const char* fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	__result_len += vscnprintf(__result + __result_len, sizeof(__result) - __result_len, fmt, args);
+	va_end(args);
+}
+
+// one size of the sweep, bufs[engine][buf] are built already
+static void __run_size(struct selftest_config* config, struct qvio_selftest_engine** engines, int engines_count,
+	struct qvio_selftest_buf (*bufs)[SELFTEST_MAX_BUFS], size_t bytes, u64* lat) {
+	struct qvio_selftest_buf* buf;
+	u64 t0, t1, ts, cpu0, cpu1;
+	u64 wall_ns, cpu_ns, total, mbps;
+	int i, e, b;
+	int errors = 0;
+	int mismatches = 0;
+
+	cpu0 = current->se.sum_exec_runtime;
+	t0 = ktime_get_ns();
+
+	for(i = 0;i < config->count;i++) {
+		b = i % config->bufs;
+
+		if(config->loopback) {
+			// engines[0] is H2C, engines[1] C2H, through the same card memory
+			__fill(&bufs[0][b], i);
+			memset(bufs[1][b].vaddr, 0, bytes);
+			__buf_sync_for_device(engines[0], &bufs[0][b]);
+			__buf_sync_for_device(engines[1], &bufs[1][b]);
+
+			ts = ktime_get_ns();
+			engines[0]->start(engines[0], &bufs[0][b]);
+			__wait_engines(&engines[0], 1, config->poll_us, &errors);
+			engines[1]->start(engines[1], &bufs[1][b]);
+			__wait_engines(&engines[1], 1, config->poll_us, &errors);
+			lat[i] = ktime_get_ns() - ts;
+
+			__buf_sync_for_cpu(engines[1], &bufs[1][b]);
+			if(memcmp(bufs[0][b].vaddr, bufs[1][b].vaddr, bytes))
+				mismatches++;
+		} else {
+			for(e = 0;e < engines_count;e++)
+				__buf_sync_for_device(engines[e], &bufs[e][b]);
+
+			ts = ktime_get_ns();
+			for(e = 0;e < engines_count;e++)
+				engines[e]->start(engines[e], &bufs[e][b]);
+			__wait_engines(engines, engines_count, config->poll_us, &errors);
+			lat[i] = ktime_get_ns() - ts;
+
+			for(e = 0;e < engines_count;e++)
+				__buf_sync_for_cpu(engines[e], &bufs[e][b]);
+		}
+	}
+
+	t1 = ktime_get_ns();
+	cpu1 = current->se.sum_exec_runtime;
+
+	// the syncs and the data check are in the wall time, as for a real frame
+	wall_ns = max_t(u64, t1 - t0, 1);
+	cpu_ns = cpu1 - cpu0;
+	total = (u64)bytes * config->count * engines_count;
+	mbps = div64_u64(total * 1000, wall_ns);
+
+	sort(lat, config->count, sizeof(u64), __cmp_u64, NULL);
+
+	buf = &bufs[0][0];
+	__report("%lu %d %d %llu.%03llu %llu %llu %llu %llu %llu %d %d\n",
+		bytes, buf->buf_entry ? buf->buf_entry->descs : 0, config->count,
+		mbps / 1000, mbps % 1000,
+		lat[config->count / 2], lat[config->count * 90 / 100], lat[config->count * 99 / 100], lat[config->count - 1],
+		div64_u64(cpu_ns * 100, wall_ns), errors, mismatches);
+}
+
+static int __run(struct selftest_config* config) {
+	int err;
+	struct qvio_selftest_engine* engines[SELFTEST_MAX_ENGINES];
+	struct qvio_selftest_engine* engine;
+	struct qvio_selftest_buf (*bufs)[SELFTEST_MAX_BUFS] = NULL;
+	u64* lat = NULL;
+	char* names = config->engines;
+	char* name;
+	int engines_count = 0;
+	int claimed = 0;
+	size_t bytes;
+	int e, b;
+
+	while((name = strsep(&names, ",")) != NULL) {
+		if(! *name)
+			continue;
+
+		if(engines_count >= SELFTEST_MAX_ENGINES) {
+			pr_err("unexpected value, engines_count=%d\n", engines_count);
+			err = -EINVAL;
+			goto err0;
+		}
+
+		engines[engines_count] = NULL;
+		list_for_each_entry(engine, &__engines, node) {
+			if(! strcmp(engine->name, name)) {
+				engines[engines_count] = engine;
+				break;
+			}
+		}
+
+		if(! engines[engines_count]) {
+			pr_err("unexpected value, engine %s\n", name);
+			err = -ENODEV;
+			goto err0;
+		}
+		engines_count++;
+	}
+
+	if(! engines_count) {
+		pr_err("unexpected value, no engines\n");
+		err = -EINVAL;
+		goto err0;
+	}
+
+	if(config->loopback && (engines_count != 2 ||
+		engines[0]->dir != DMA_TO_DEVICE || engines[1]->dir != DMA_FROM_DEVICE)) {
+		pr_err("unexpected value, loopback needs a H2C engine then a C2H one\n");
+		err = -EINVAL;
+		goto err0;
+	}
+
+	// streaming engines are busy
+	for(claimed = 0;claimed < engines_count;claimed++) {
+		if(! engines[claimed]->video_queue)
+			continue;
+
+		err = qvio_video_queue_claim(engines[claimed]->video_queue, &__engines, NULL);
+		if(err) {
+			pr_err("%s: qvio_video_queue_claim() failed, err=%d\n", engines[claimed]->name, err);
+			goto err1;
+		}
+	}
+
+	__sim_mem = vzalloc(config->max);
+	if(! __sim_mem) {
+		pr_err("vzalloc() failed\n");
+		err = -ENOMEM;
+		goto err1;
+	}
+
+	bufs = kvcalloc(engines_count, sizeof(*bufs), GFP_KERNEL);
+	lat = kvcalloc(config->count, sizeof(u64), GFP_KERNEL);
+	if(! bufs || ! lat) {
+		pr_err("kvcalloc() failed\n");
+		err = -ENOMEM;
+		goto err2;
+	}
+
+	for(e = 0;e < engines_count;e++) {
+		for(b = 0;b < config->bufs;b++) {
+			err = __buf_alloc(engines[e], &bufs[e][b], config->max, config->scatter);
+			if(err) {
+				pr_err("__buf_alloc() failed, err=%d\n", err);
+				goto err3;
+			}
+		}
+	}
+
+	__result_len = 0;
+	__report("# engines");
+	for(e = 0;e < engines_count;e++)
+		__report("%s%s", e ? "," : " ", engines[e]->name);
+	__report(" bufs %d %s loopback %d poll_us %d\n", config->bufs,
+		config->scatter ? "scattered" : "contiguous", config->loopback, config->poll_us);
+	__report("# bytes descs count GB/s p50_ns p90_ns p99_ns max_ns cpu%% errors mismatches\n");
+
+	for(bytes = config->min;bytes <= config->max;bytes <<= 1) {
+		for(e = 0;e < engines_count;e++) {
+			for(b = 0;b < config->bufs;b++) {
+				err = __buf_build(engines[e], &bufs[e][b], bytes);
+				if(err) {
+					__report("%lu build failed, err=%d\n", bytes, err);
+					goto err3;
+				}
+			}
+		}
+
+		__run_size(config, engines, engines_count, bufs, bytes, lat);
+	}
+
+	err = 0;
+
+err3:
+	for(e = 0;e < engines_count;e++) {
+		for(b = 0;b < config->bufs;b++)
+			__buf_free(engines[e], &bufs[e][b]);
+	}
+err2:
+	kvfree(lat);
+	kvfree(bufs);
+	vfree(__sim_mem);
+	__sim_mem = NULL;
+err1:
+	for(claimed--;claimed >= 0;claimed--) {
+		if(engines[claimed]->video_queue)
+			qvio_video_queue_release(engines[claimed]->video_queue, &__engines);
+	}
+err0:
+	return err;
+}
+
+static int __parse(char* line, struct selftest_config* config) {
+	int err;
+	char* token;
+	char* value;
+	unsigned long v;
+
+	strscpy(config->engines, "sim_rd,sim_wr", sizeof(config->engines));
+	config->min = PAGE_SIZE;
+	config->max = 4UL << 20;
+	config->count = 64;
+	config->bufs = 4;
+	config->scatter = 1;
+	config->loopback = 0;
+	config->poll_us = 0;
+
+	while((token = strsep(&line, " \t\n")) != NULL) {
+		if(! *token)
+			continue;
+
+		value = strchr(token, '=');
+		if(! value) {
+			pr_err("unexpected value, token=%s\n", token);
+			return -EINVAL;
+		}
+		*value++ = '\0';
+
+		if(! strcmp(token, "engines")) {
+			strscpy(config->engines, value, sizeof(config->engines));
+			continue;
+		}
+
+		err = kstrtoul(value, 0, &v);
+		if(err) {
+			pr_err("unexpected value, %s=%s\n", token, value);
+			return err;
+		}
+
+		if(! strcmp(token, "min"))
+			config->min = v;
+		else if(! strcmp(token, "max"))
+			config->max = v;
+		else if(! strcmp(token, "count"))
+			config->count = v;
+		else if(! strcmp(token, "bufs"))
+			config->bufs = v;
+		else if(! strcmp(token, "scatter"))
+			config->scatter = !! v;
+		else if(! strcmp(token, "loopback"))
+			config->loopback = !! v;
+		else if(! strcmp(token, "poll_us"))
+			config->poll_us = v;
+		else {
+			pr_err("unexpected value, token=%s\n", token);
+			return -EINVAL;
+		}
+	}
+
+	// whole pages, doubling from min to max
+	if(config->min < PAGE_SIZE || ! is_power_of_2(config->min) || config->max < config->min ||
+		config->max > SELFTEST_MAX_SIZE || config->count < 1 || config->count > SELFTEST_MAX_COUNT ||
+		config->bufs < 1 || config->bufs > SELFTEST_MAX_BUFS || config->poll_us < 0) {
+		pr_err("unexpected value, min=%lu max=%lu count=%d bufs=%d poll_us=%d\n",
+			config->min, config->max, config->count, config->bufs, config->poll_us);
+		return -EINVAL;
+	}
+	config->max = ALIGN(config->max, PAGE_SIZE);
+
+	return 0;
+}
+
+static ssize_t run_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+	int err;
+	struct selftest_config config;
+	char line[256];
+
+	if(count >= sizeof(line))
+		return -EINVAL;
+
+	if(copy_from_user(line, buf, count))
+		return -EFAULT;
+	line[count] = '\0';
+
+	err = __parse(line, &config);
+	if(err)
+		return err;
+
+	mutex_lock(&__mutex);
+	err = __run(&config);
+	mutex_unlock(&__mutex);
+
+	if(err)
+		return err;
+
+	return count;
+}
+
+static const struct file_operations run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = run_write,
+	.llseek = noop_llseek,
+};
+
+static ssize_t result_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
+	ssize_t ret;
+
+	mutex_lock(&__mutex);
+	ret = simple_read_from_buffer(buf, count, ppos, __result, __result_len);
+	mutex_unlock(&__mutex);
+
+	return ret;
+}
+
+static const struct file_operations result_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = result_read,
+	.llseek = default_llseek,
+};
+
+static int engines_show(struct seq_file *s, void *unused) {
+	struct qvio_selftest_engine* engine;
+
+	mutex_lock(&__mutex);
+	list_for_each_entry(engine, &__engines, node)
+		seq_printf(s, "%s %s\n", engine->name, engine->dir == DMA_FROM_DEVICE ? "c2h" : "h2c");
+	mutex_unlock(&__mutex);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(engines);
+
+void qvio_selftest_register(void) {
+	int i;
+
+	for(i = 0;i < ARRAY_SIZE(__sim_engines);i++)
+		qvio_selftest_add(&__sim_engines[i]);
+
+	// debugfs is optional, as for the stats
+	if(IS_ERR_OR_NULL(qvio_stats_root()))
+		return;
+
+	__dir = debugfs_create_dir("selftest", qvio_stats_root());
+	debugfs_create_file("engines", 0444, __dir, NULL, &engines_fops);
+	debugfs_create_file("run", 0200, __dir, NULL, &run_fops);
+	debugfs_create_file("result", 0444, __dir, NULL, &result_fops);
+}
+
+void qvio_selftest_unregister(void) {
+	int i;
+
+	debugfs_remove_recursive(__dir);
+	__dir = NULL;
+
+	for(i = 0;i < ARRAY_SIZE(__sim_engines);i++)
+		qvio_selftest_del(&__sim_engines[i]);
+}
+
+void qvio_selftest_add(struct qvio_selftest_engine* engine) {
+	mutex_lock(&__mutex);
+	list_add_tail(&engine->node, &__engines);
+	mutex_unlock(&__mutex);
+}
+
+void qvio_selftest_del(struct qvio_selftest_engine* engine) {
+	// waits for a running test
+	mutex_lock(&__mutex);
+	list_del_init(&engine->node);
+	mutex_unlock(&__mutex);
+}
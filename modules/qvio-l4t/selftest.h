@@ -0,0 +1,61 @@
+#ifndef __QVIO_SELFTEST_H__
+#define __QVIO_SELFTEST_H__
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-direction.h>
+
+#include "buf_entry.h"
+#include "video_queue.h"
+
+/*
+ * Raw DMA bandwidth/latency self-test in debugfs, qvio/selftest/:
+ * - engines: the registered engines, "sim" is always there
+ * - run: write "engines=xdma_rd0,xdma_wr0 min=4096 max=4194304 count=64
+ *   bufs=4 scatter=1 loopback=0 poll_us=0" to run a sweep of the transfer
+ *   sizes from min to max (doubling), all the fields are optional
+ * - result: the report of the last run, one line per size
+ *
+ * The engines run concurrently, or H2C then C2H over the same card memory
+ * with loopback=1 and the data checked. Completion is polled, the IRQ of the
+ * engine is left alone, so an engine streaming video is reported busy.
+ */
+struct qvio_selftest_buf {
+	struct sg_table sgt;
+	struct page** pages; // scattered, one per page
+	struct page* page; // contiguous, a single high order allocation
+	size_t size; // allocated
+	size_t bytes; // of the current transfer
+	void* vaddr; // of the contiguous allocation, or vmap() of the pages
+	bool mapped;
+
+	struct qvio_buf_entry* buf_entry; // descriptors built by the engine
+};
+
+struct qvio_selftest_engine {
+	struct list_head node;
+	const char* name;
+	struct device* dev; // NULL for an engine without DMA mapping
+	enum dma_data_direction dir; // DMA_FROM_DEVICE for C2H
+	struct qvio_video_queue* video_queue; // claimed during a run, optional
+	struct dma_pool* desc_pool;
+	void* parent;
+	u32 descs; // of the running transfer
+
+	// descriptors of buf into buf->buf_entry
+	int (*build)(struct qvio_selftest_engine* self, struct qvio_selftest_buf* buf);
+	void (*start)(struct qvio_selftest_engine* self, struct qvio_selftest_buf* buf);
+	// 1 when done, 0 when still running, < 0 on errors
+	int (*poll)(struct qvio_selftest_engine* self);
+	void (*stop)(struct qvio_selftest_engine* self);
+};
+
+// register
+void qvio_selftest_register(void);
+void qvio_selftest_unregister(void);
+
+void qvio_selftest_add(struct qvio_selftest_engine* engine);
+void qvio_selftest_del(struct qvio_selftest_engine* engine);
+
+#endif // __QVIO_SELFTEST_H__
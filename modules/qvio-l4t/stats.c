@@ -0,0 +1,130 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include "stats.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+
+static struct dentry *__debugfs_root;
+
+static const char* __lat_names[QVIO_STATS_LAT_MAX] = {
+	[QVIO_STATS_LAT_QBUF_START] = "qbuf_to_start_ns",
+	[QVIO_STATS_LAT_DMA] = "dma_ns",
+	[QVIO_STATS_LAT_IRQ_WAKEUP] = "irq_to_wakeup_ns",
+	[QVIO_STATS_LAT_IRQ_DQBUF] = "irq_to_dqbuf_ns",
+	[QVIO_STATS_LAT_PTS_START] = "pts_to_start_ns",
+};
+
+void qvio_stats_register(void) {
+	// debugfs is optional, the statistics are simply missing without it
+	__debugfs_root = debugfs_create_dir(KBUILD_MODNAME, NULL);
+}
+
+void qvio_stats_unregister(void) {
+	debugfs_remove_recursive(__debugfs_root);
+	__debugfs_root = NULL;
+}
+
+struct dentry* qvio_stats_root(void) {
+	return __debugfs_root;
+}
+
+void qvio_stats_reset(struct qvio_stats* self) {
+	int i, j;
+
+	for(i = 0;i < QVIO_STATS_LAT_MAX;i++) {
+		for(j = 0;j < QVIO_STATS_LAT_BINS;j++)
+			atomic64_set(&self->lat_bins[i][j], 0);
+	}
+
+	atomic64_set(&self->frames, 0);
+	atomic64_set(&self->bytes, 0);
+	atomic64_set(&self->descs, 0);
+	for(i = 0;i < QVIO_STATS_DESC_BINS;i++)
+		atomic64_set(&self->desc_bins[i], 0);
+	atomic64_set(&self->starved, 0);
+	atomic64_set(&self->irqs, 0);
+	atomic64_set(&self->late, 0);
+}
+
+void qvio_stats_lat(struct qvio_stats* self, enum qvio_stats_lat lat, u64 from_ns, u64 to_ns) {
+	int bin;
+
+	// from_ns is 0 when the stage was never stamped, e.g. right after streamon
+	if(! from_ns || to_ns < from_ns)
+		return;
+
+	bin = min(fls64(to_ns - from_ns), QVIO_STATS_LAT_BINS - 1);
+	atomic64_inc(&self->lat_bins[lat][bin]);
+}
+
+void qvio_stats_descs(struct qvio_stats* self, u32 descs) {
+	int bin;
+
+	atomic64_add(descs, &self->descs);
+
+	bin = min(fls(descs), QVIO_STATS_DESC_BINS - 1);
+	atomic64_inc(&self->desc_bins[bin]);
+}
+
+static int stats_show(struct seq_file *s, void *unused) {
+	struct qvio_stats* self = s->private;
+	int i, j;
+
+	seq_printf(s, "frames %lld\n", (long long)atomic64_read(&self->frames));
+	seq_printf(s, "bytes %lld\n", (long long)atomic64_read(&self->bytes));
+	seq_printf(s, "descs %lld\n", (long long)atomic64_read(&self->descs));
+	seq_puts(s, "descs_per_frame ");
+	for(j = 0;j < QVIO_STATS_DESC_BINS;j++) {
+		seq_printf(s, "%s%lld", j ? "," : "",
+			(long long)atomic64_read(&self->desc_bins[j]));
+	}
+	seq_puts(s, "\n");
+	seq_printf(s, "starved %lld\n", (long long)atomic64_read(&self->starved));
+	seq_printf(s, "irqs %lld\n", (long long)atomic64_read(&self->irqs));
+	seq_printf(s, "late %lld\n", (long long)atomic64_read(&self->late));
+
+	for(i = 0;i < QVIO_STATS_LAT_MAX;i++) {
+		seq_printf(s, "%s ", __lat_names[i]);
+		for(j = 0;j < QVIO_STATS_LAT_BINS;j++) {
+			seq_printf(s, "%s%lld", j ? "," : "",
+				(long long)atomic64_read(&self->lat_bins[i][j]));
+		}
+		seq_puts(s, "\n");
+	}
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static ssize_t reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+	struct qvio_stats* self = file->private_data;
+
+	qvio_stats_reset(self);
+
+	return count;
+}
+
+static const struct file_operations reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = reset_write,
+	.llseek = noop_llseek,
+};
+
+void qvio_stats_start(struct qvio_stats* self, const char* name) {
+	if(IS_ERR_OR_NULL(__debugfs_root))
+		return;
+
+	self->dir = debugfs_create_dir(name, __debugfs_root);
+	debugfs_create_file("stats", 0444, self->dir, self, &stats_fops);
+	debugfs_create_file("reset", 0200, self->dir, self, &reset_fops);
+}
+
+void qvio_stats_stop(struct qvio_stats* self) {
+	debugfs_remove_recursive(self->dir);
+	self->dir = NULL;
+}
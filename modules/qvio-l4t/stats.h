@@ -0,0 +1,53 @@
+#ifndef __QVIO_STATS_H__
+#define __QVIO_STATS_H__
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+
+/*
+ * Per engine frame statistics, updated locklessly from the IRQ path and
+ * exposed in debugfs as qvio/<engine>/stats, write qvio/<engine>/reset to
+ * clear them. Latency bin n counts samples in [2^(n-1), 2^n) ns, descriptor
+ * bin n frames of [2^(n-1), 2^n) descriptors.
+ */
+#define QVIO_STATS_LAT_BINS		32
+#define QVIO_STATS_DESC_BINS		16
+
+enum qvio_stats_lat {
+	QVIO_STATS_LAT_QBUF_START, // QBUF -> ap_start
+	QVIO_STATS_LAT_DMA, // ap_start -> IRQ
+	QVIO_STATS_LAT_IRQ_WAKEUP, // IRQ -> waiter woken up
+	QVIO_STATS_LAT_IRQ_DQBUF, // IRQ -> DQBUF
+	QVIO_STATS_LAT_PTS_START, // presentation time -> ap_start, paced engines
+	QVIO_STATS_LAT_MAX,
+};
+
+struct qvio_stats {
+	atomic64_t lat_bins[QVIO_STATS_LAT_MAX][QVIO_STATS_LAT_BINS];
+
+	atomic64_t frames;
+	atomic64_t bytes;
+	atomic64_t descs;
+	atomic64_t desc_bins[QVIO_STATS_DESC_BINS]; // descriptors per frame
+	atomic64_t starved; // empty job_list at completion
+	atomic64_t irqs;
+	atomic64_t late; // paced starts queued after their presentation time
+
+	struct dentry* dir;
+};
+
+// register
+void qvio_stats_register(void);
+void qvio_stats_unregister(void);
+
+void qvio_stats_reset(struct qvio_stats* self);
+void qvio_stats_lat(struct qvio_stats* self, enum qvio_stats_lat lat, u64 from_ns, u64 to_ns);
+void qvio_stats_descs(struct qvio_stats* self, u32 descs);
+
+// debugfs, optional
+struct dentry* qvio_stats_root(void);
+void qvio_stats_start(struct qvio_stats* self, const char* name);
+void qvio_stats_stop(struct qvio_stats* self);
+
+#endif // __QVIO_STATS_H__
@@ -9,8 +9,13 @@
 #include "utils.h"
 #include "xvidc.h"
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+#define HRTIMER_MODE_ABS_HARD HRTIMER_MODE_ABS
+#endif
+
 static struct qvio_cdev_class __cdev_class;
 static const unsigned int __reset_delay = 100;
+static const u64 __min_period_ns = 100 * NSEC_PER_USEC;
 
 static void __free(struct kref *ref);
 static int __reset_cores(struct qvio_tpg* self);
@@ -20,6 +25,10 @@ static long __file_ioctl_g_fmt(struct qvio_tpg* self, struct file * filp, unsign
 static long __file_ioctl_streamon(struct qvio_tpg* self, struct file * filp, unsigned long arg);
 static long __file_ioctl_streamoff(struct qvio_tpg* self, struct file * filp, unsigned long arg);
 static long __file_ioctl_trigger(struct qvio_tpg* self, struct file * filp, unsigned long arg);
+static long __file_ioctl_s_rate(struct qvio_tpg* self, struct file * filp, unsigned long arg);
+static long __file_ioctl_g_rate(struct qvio_tpg* self, struct file * filp, unsigned long arg);
+static long __file_ioctl_g_stats(struct qvio_tpg* self, struct file * filp, unsigned long arg);
+static enum hrtimer_restart __trigger_timer(struct hrtimer* timer);
 
 static const struct file_operations __fops = {
 	.owner = THIS_MODULE,
@@ -63,6 +72,13 @@ struct qvio_tpg* qvio_tpg_new(void) {
 	}
 
 	kref_init(&self->ref);
+	mutex_init(&self->ioctl_mutex);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&self->trigger_timer, __trigger_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+#else
+	hrtimer_init(&self->trigger_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+	self->trigger_timer.function = __trigger_timer;
+#endif
 
 	return self;
 
@@ -154,6 +170,10 @@ void qvio_tpg_remove(struct qvio_tpg* self) {
 	XV_tpg* xtpg = &self->xtpg;
 
 	qvio_cdev_stop(&self->cdev, &__cdev_class);
+	mutex_lock(&self->ioctl_mutex);
+	self->streaming = false;
+	hrtimer_cancel(&self->trigger_timer);
+	mutex_unlock(&self->ioctl_mutex);
 	XV_tpg_DisableAutoRestart(xtpg);
 }
 
@@ -174,10 +194,51 @@ err0:
 	return err;
 }
 
+// first deadline one period from now, on the hrtimer grid from there
+static void __start_timer(struct qvio_tpg* self) {
+	if(! self->period_ns)
+		return;
+
+	atomic64_set(&self->triggers, 0);
+	atomic64_set(&self->missed, 0);
+	atomic64_set(&self->busy, 0);
+	self->max_late_ns = 0;
+
+	hrtimer_start(&self->trigger_timer, ns_to_ktime(ktime_get_ns() + self->period_ns), HRTIMER_MODE_ABS_HARD);
+}
+
+static enum hrtimer_restart __trigger_timer(struct hrtimer* timer) {
+	struct qvio_tpg* self = container_of(timer, struct qvio_tpg, trigger_timer);
+	XV_tpg* xtpg = &self->xtpg;
+	ktime_t now = hrtimer_cb_get_time(timer);
+	s64 late_ns;
+	u64 overruns;
+
+	late_ns = ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer)));
+	if(late_ns > self->max_late_ns)
+		WRITE_ONCE(self->max_late_ns, (u32)min_t(s64, late_ns, U32_MAX));
+
+	if(XV_tpg_IsIdle(xtpg)) {
+		XV_tpg_Start(xtpg);
+		atomic64_inc(&self->triggers);
+	} else {
+		atomic64_inc(&self->missed);
+		atomic64_inc(&self->busy);
+	}
+
+	// deadlines passed while the timer was late
+	overruns = hrtimer_forward(timer, now, ns_to_ktime(self->period_ns));
+	if(overruns > 1)
+		atomic64_add(overruns - 1, &self->missed);
+
+	return HRTIMER_RESTART;
+}
+
 static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg) {
 	long ret;
 	struct qvio_tpg* self = filp->private_data;
 
+	mutex_lock(&self->ioctl_mutex);
 	switch(cmd) {
 	case QVIO_IOC_TPG_S_FMT:
 		ret = __file_ioctl_s_fmt(self, filp, arg);
@@ -199,11 +260,24 @@ static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg
 		ret = __file_ioctl_trigger(self, filp, arg);
 		break;
 
+	case QVIO_IOC_TPG_S_RATE:
+		ret = __file_ioctl_s_rate(self, filp, arg);
+		break;
+
+	case QVIO_IOC_TPG_G_RATE:
+		ret = __file_ioctl_g_rate(self, filp, arg);
+		break;
+
+	case QVIO_IOC_TPG_G_STATS:
+		ret = __file_ioctl_g_stats(self, filp, arg);
+		break;
+
 	default:
 		pr_err("unexpected, cmd=%d\n", cmd);
 		ret = -EINVAL;
 		break;
 	}
+	mutex_unlock(&self->ioctl_mutex);
 
 	return ret;
 }
@@ -279,6 +353,9 @@ static long __file_ioctl_streamon(struct qvio_tpg* self, struct file * filp, uns
 		goto err0;
 	}
 
+	self->streaming = false;
+	hrtimer_cancel(&self->trigger_timer);
+
 	err = __reset_cores(self);
 	if(err < 0) {
 		pr_err("__reset_cores() failed, err=%d\n", err);
@@ -323,6 +400,11 @@ static long __file_ioctl_streamon(struct qvio_tpg* self, struct file * filp, uns
 
 	XV_tpg_Start(xtpg);
 
+	if(! args.bypass) {
+		self->streaming = true;
+		__start_timer(self);
+	}
+
 	return 0;
 
 err0:
@@ -334,6 +416,14 @@ static long __file_ioctl_streamoff(struct qvio_tpg* self, struct file * filp, un
 	XV_tpg* xtpg = &self->xtpg;
 	int i;
 
+	self->streaming = false;
+	hrtimer_cancel(&self->trigger_timer);
+	if(self->period_ns) {
+		pr_info("triggers=%lld, missed=%lld, busy=%lld, max_late_ns=%u\n",
+			(long long)atomic64_read(&self->triggers), (long long)atomic64_read(&self->missed),
+			(long long)atomic64_read(&self->busy), self->max_late_ns);
+	}
+
 	XV_tpg_DisableAutoRestart(xtpg);
 	for(i = 0;i < 5;i++) {
 		if(XV_tpg_IsIdle(xtpg))
@@ -367,6 +457,12 @@ static long __file_ioctl_trigger(struct qvio_tpg* self, struct file * filp, unsi
 		goto err0;
 	}
 
+	if(self->period_ns) {
+		pr_err("unexpected value, self->period_ns=%llu\n", self->period_ns);
+		ret = -EBUSY;
+		goto err0;
+	}
+
 	if(! XV_tpg_IsIdle(xtpg)) {
 		ret = -EBUSY;
 		// pr_err("unexpected, XV_tpg_IsIdle()\n");
@@ -380,3 +476,106 @@ static long __file_ioctl_trigger(struct qvio_tpg* self, struct file * filp, unsi
 err0:
 	return ret;
 }
+
+static long __file_ioctl_s_rate(struct qvio_tpg* self, struct file * filp, unsigned long arg) {
+	long ret;
+	struct qvio_tpg_rate args;
+	u64 ticks, t0, t1;
+	u64 period_ns;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	if(args.period_ticks) {
+		// converted once, at the rate estimate of now
+		ticks = qvio_zdev_ticks64(self->zdev);
+		ret = qvio_zdev_ticks_to_ns(self->zdev, ticks, &t0);
+		if(! ret)
+			ret = qvio_zdev_ticks_to_ns(self->zdev, ticks + args.period_ticks, &t1);
+		if(ret) {
+			pr_err("qvio_zdev_ticks_to_ns() failed, err=%d\n", (int)ret);
+			goto err0;
+		}
+
+		period_ns = t1 - t0;
+	} else if(args.num) {
+		if(! args.den) {
+			pr_err("unexpected value, args.den=%u\n", args.den);
+			ret = -EINVAL;
+			goto err0;
+		}
+
+		period_ns = div_u64((u64)args.den * NSEC_PER_SEC, args.num);
+	} else {
+		period_ns = 0;
+	}
+
+	if(period_ns && (period_ns < __min_period_ns || period_ns > U32_MAX)) {
+		pr_err("unexpected value, period_ns=%llu\n", period_ns);
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	hrtimer_cancel(&self->trigger_timer);
+	self->rate = args;
+	self->period_ns = period_ns;
+	pr_info("period_ns=%llu\n", period_ns);
+
+	if(self->streaming)
+		__start_timer(self);
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+static long __file_ioctl_g_rate(struct qvio_tpg* self, struct file * filp, unsigned long arg) {
+	long ret;
+	struct qvio_tpg_rate args;
+
+	args = self->rate;
+
+	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+static long __file_ioctl_g_stats(struct qvio_tpg* self, struct file * filp, unsigned long arg) {
+	long ret;
+	struct qvio_tpg_stats args;
+
+	memset(&args, 0, sizeof(args));
+	args.triggers = atomic64_read(&self->triggers);
+	args.missed = atomic64_read(&self->missed);
+	args.busy = atomic64_read(&self->busy);
+	args.period_ns = (u32)self->period_ns;
+	args.max_late_ns = READ_ONCE(self->max_late_ns);
+
+	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return ret;
+}
@@ -2,6 +2,8 @@
 #define __QVIO_TPG_H__
 
 #include <linux/platform_device.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
 
 #include "cdev.h"
 #include "zdev.h"
@@ -23,6 +25,19 @@ struct qvio_tpg {
 	struct qvio_format format;
 	struct qvio_tpg_config cur_config;
 	u32 nXtpgColorFormat;
+
+	// serialises the ioctls, streaming and the timer restart in S_RATE
+	struct mutex ioctl_mutex;
+	bool streaming;
+
+	// frames triggered by the driver, see QVIO_IOC_TPG_S_RATE
+	struct hrtimer trigger_timer;
+	struct qvio_tpg_rate rate;
+	u64 period_ns;
+	atomic64_t triggers;
+	atomic64_t missed;
+	atomic64_t busy;
+	u32 max_late_ns;
 };
 
 // register
@@ -0,0 +1,170 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM qvio
+
+#if !defined(__QVIO_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __QVIO_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+#include "video_queue.h"
+#include "zdev.h"
+
+/*
+ * Frame lifecycle of the engines, in order:
+ *   qvio_qbuf -> qvio_map -> qvio_build_descs -> qvio_ap_start -> qvio_irq ->
+ *   qvio_done -> qvio_wakeup -> qvio_dqbuf
+ * e.g. perf record -e 'qvio:*' or trace-cmd record -e qvio
+ */
+
+DECLARE_EVENT_CLASS(qvio_buf_class,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, u32 sequence),
+	TP_ARGS(vq, buf_entry, sequence),
+
+	TP_STRUCT__entry(
+		__array(char, engine, QVIO_VIDEO_QUEUE_NAME_LEN)
+		__field(u32, index)
+		__field(u32, sequence)
+		__field(u64, dsc_adr)
+		__field(u16, dsc_adj)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->engine, vq->name, QVIO_VIDEO_QUEUE_NAME_LEN);
+		__entry->index = buf_entry->buf.index;
+		__entry->sequence = sequence;
+		__entry->dsc_adr = buf_entry->dsc_adr;
+		__entry->dsc_adj = buf_entry->dsc_adj;
+	),
+
+	TP_printk("%s index=%u sequence=%u dsc_adr=0x%llx dsc_adj=%u",
+		__entry->engine, __entry->index, __entry->sequence,
+		__entry->dsc_adr, __entry->dsc_adj)
+);
+
+DEFINE_EVENT(qvio_buf_class, qvio_qbuf,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, u32 sequence),
+	TP_ARGS(vq, buf_entry, sequence)
+);
+
+DEFINE_EVENT(qvio_buf_class, qvio_ap_start,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, u32 sequence),
+	TP_ARGS(vq, buf_entry, sequence)
+);
+
+DEFINE_EVENT(qvio_buf_class, qvio_wakeup,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, u32 sequence),
+	TP_ARGS(vq, buf_entry, sequence)
+);
+
+DEFINE_EVENT(qvio_buf_class, qvio_dqbuf,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, u32 sequence),
+	TP_ARGS(vq, buf_entry, sequence)
+);
+
+TRACE_EVENT(qvio_map,
+	TP_PROTO(struct qvio_video_queue* vq, u32 index, struct sg_table* sgt, size_t size),
+	TP_ARGS(vq, index, sgt, size),
+
+	TP_STRUCT__entry(
+		__array(char, engine, QVIO_VIDEO_QUEUE_NAME_LEN)
+		__field(u32, index)
+		__field(u32, nents)
+		__field(u64, dma_addr)
+		__field(size_t, size)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->engine, vq->name, QVIO_VIDEO_QUEUE_NAME_LEN);
+		__entry->index = index;
+		__entry->nents = sgt->nents;
+		__entry->dma_addr = sgt->nents ? sg_dma_address(sgt->sgl) : 0;
+		__entry->size = size;
+	),
+
+	TP_printk("%s index=%u nents=%u dma_addr=0x%llx size=%zu",
+		__entry->engine, __entry->index, __entry->nents,
+		__entry->dma_addr, __entry->size)
+);
+
+TRACE_EVENT(qvio_build_descs,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, int descs, int blocks, size_t size),
+	TP_ARGS(vq, buf_entry, descs, blocks, size),
+
+	TP_STRUCT__entry(
+		__array(char, engine, QVIO_VIDEO_QUEUE_NAME_LEN)
+		__field(u32, index)
+		__field(int, descs)
+		__field(int, blocks)
+		__field(size_t, size)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->engine, vq->name, QVIO_VIDEO_QUEUE_NAME_LEN);
+		__entry->index = buf_entry->buf.index;
+		__entry->descs = descs;
+		__entry->blocks = blocks;
+		__entry->size = size;
+	),
+
+	TP_printk("%s index=%u descs=%d blocks=%d size=%zu",
+		__entry->engine, __entry->index, __entry->descs,
+		__entry->blocks, __entry->size)
+);
+
+TRACE_EVENT(qvio_irq,
+	TP_PROTO(struct qvio_video_queue* vq, int irq, u32 status, struct qvio_zdev* zdev),
+	TP_ARGS(vq, irq, status, zdev),
+
+	TP_STRUCT__entry(
+		__array(char, engine, QVIO_VIDEO_QUEUE_NAME_LEN)
+		__field(int, irq)
+		__field(u32, status)
+		__field(u32, ticks)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->engine, vq->name, QVIO_VIDEO_QUEUE_NAME_LEN);
+		__entry->irq = irq;
+		__entry->status = status;
+		__entry->ticks = zdev ? qvio_zdev_ticks(zdev) : 0; // only read while enabled
+	),
+
+	TP_printk("%s irq=%d status=0x%x ticks=%u",
+		__entry->engine, __entry->irq, __entry->status, __entry->ticks)
+);
+
+TRACE_EVENT(qvio_done,
+	TP_PROTO(struct qvio_video_queue* vq, struct qvio_buf_entry* buf_entry, struct qvio_buf_entry* next_entry),
+	TP_ARGS(vq, buf_entry, next_entry),
+
+	TP_STRUCT__entry(
+		__array(char, engine, QVIO_VIDEO_QUEUE_NAME_LEN)
+		__field(u32, index)
+		__field(u32, sequence)
+		__field(u64, dma_ns)
+		__field(int, next_index)
+		__field(u32, starved)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->engine, vq->name, QVIO_VIDEO_QUEUE_NAME_LEN);
+		__entry->index = buf_entry->buf.index;
+		__entry->sequence = buf_entry->sequence;
+		__entry->dma_ns = buf_entry->done_ns - buf_entry->start_ns;
+		__entry->next_index = next_entry ? (int)next_entry->buf.index : -1;
+		__entry->starved = vq->starved;
+	),
+
+	TP_printk("%s index=%u sequence=%u dma_ns=%llu next_index=%d starved=%u",
+		__entry->engine, __entry->index, __entry->sequence,
+		__entry->dma_ns, __entry->next_index, __entry->starved)
+);
+
+#endif // __QVIO_TRACE_H__
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>
@@ -8,6 +8,13 @@
 #include <linux/fs.h>
 #include <linux/slab.h>
 #include <linux/poll.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/jiffies.h>
+
+// how long a synchronous request waits for the daemon
+#define QVIO_UMODS_RSP_TIMEOUT_MS		2000
 
 
 int qvio_umods_req_entry_new(struct qvio_umods_req_entry** req_entry) {
@@ -17,7 +24,7 @@ int qvio_umods_req_entry_new(struct qvio_umods_req_entry** req_entry) {
 	if(! *req_entry) {
 		pr_err("out of memory\n");
 
-		err = ENOMEM;
+		err = -ENOMEM;
 		goto err0;
 	}
 	INIT_LIST_HEAD(&(*req_entry)->node);
@@ -28,17 +35,117 @@ err0:
 	return err;
 }
 
-int qvio_umods_rsp_entry_new(struct qvio_umods_rsp_entry** rsp_entry) {
+// called with req_list_lock held
+static bool __ring_req_push(struct qvio_umods* self, struct qvio_umods_req* req) {
+	u32 head = self->ring_req_head;
+
+	if(head - smp_load_acquire(&self->ring->req_tail) >= QVIO_UMODS_RING_SLOTS)
+		return false;
+
+	memcpy(&self->ring_req[head & (QVIO_UMODS_RING_SLOTS - 1)], req, sizeof(struct qvio_umods_req));
+	self->ring_req_head = head + 1;
+	smp_store_release(&self->ring->req_head, self->ring_req_head);
+
+	return true;
+}
+
+// called with req_list_lock held, moves held back requests into free slots
+static int __ring_req_refill(struct qvio_umods* self) {
+	struct qvio_umods_req_entry *req_entry;
+	int count = 0;
+
+	while(! list_empty(&self->req_list)) {
+		req_entry = list_first_entry(&self->req_list, struct qvio_umods_req_entry, node);
+		if(! __ring_req_push(self, &req_entry->req))
+			break;
+
+		list_del(&req_entry->node);
+		kfree(req_entry);
+		count++;
+	}
+
+	return count;
+}
+
+// called with req_list_lock held
+static bool __req_pending(struct qvio_umods* self) {
+	if(! list_empty(&self->req_list))
+		return true;
+
+	if(self->ring_enabled && self->ring_req_head != smp_load_acquire(&self->ring->req_tail))
+		return true;
+
+	return false;
+}
+
+// called with req_list_lock held
+static void __req_notify(struct qvio_umods* self) {
+	if(self->eventfd) {
+#if KERNEL_VERSION(6, 8, 0) <= LINUX_VERSION_CODE
+		eventfd_signal(self->eventfd);
+#else
+		eventfd_signal(self->eventfd, 1);
+#endif
+	}
+
+	wake_up_interruptible(&self->req_wq);
+}
+
+// hand a response to the request waiting for its sequence
+static void __rsp_complete(struct qvio_umods* self, const struct qvio_umods_rsp* rsp) {
+	struct qvio_umods_waiter* waiter;
+	unsigned long flags;
+	bool matched = false;
+
+	spin_lock_irqsave(&self->rsp_lock, flags);
+	list_for_each_entry(waiter, &self->waiters, node) {
+		if(waiter->sequence == rsp->sequence && ! waiter->done) {
+			memcpy(&waiter->rsp, rsp, sizeof(struct qvio_umods_rsp));
+			waiter->done = true;
+			matched = true;
+			break;
+		}
+	}
+	if(! matched)
+		self->rsp_unmatched++;
+	spin_unlock_irqrestore(&self->rsp_lock, flags);
+
+	if(! matched) {
+		pr_warn_ratelimited("unmatched rsp(%d, %d)\n", (int)rsp->job_id, (int)rsp->sequence);
+		return;
+	}
+
+	wake_up_all(&self->rsp_wq);
+}
+
+static int __ring_alloc(struct qvio_umods* self) {
 	int err;
+	struct qvio_umods_ring_hdr* ring;
+	size_t req_offset, rsp_offset, size;
 
-	*rsp_entry = kzalloc(sizeof(struct qvio_umods_rsp_entry), GFP_KERNEL);
-	if(! *rsp_entry) {
-		pr_err("out of memory\n");
+	req_offset = ALIGN(sizeof(struct qvio_umods_ring_hdr), 64);
+	rsp_offset = ALIGN(req_offset + sizeof(struct qvio_umods_req) * QVIO_UMODS_RING_SLOTS, 64);
+	size = PAGE_ALIGN(rsp_offset + sizeof(struct qvio_umods_rsp) * QVIO_UMODS_RING_SLOTS);
+
+	ring = vmalloc_user(size);
+	if(! ring) {
+		pr_err("vmalloc_user() failed\n");
 
-		err = ENOMEM;
+		err = -ENOMEM;
 		goto err0;
 	}
-	INIT_LIST_HEAD(&(*rsp_entry)->node);
+
+	ring->nslots = QVIO_UMODS_RING_SLOTS;
+	ring->req_offset = (__u32)req_offset;
+	ring->rsp_offset = (__u32)rsp_offset;
+	ring->size = (__u32)size;
+
+	self->ring = ring;
+	self->ring_req = (struct qvio_umods_req*)((u8*)ring + req_offset);
+	self->ring_rsp = (struct qvio_umods_rsp*)((u8*)ring + rsp_offset);
+	self->ring_size = size;
+
+	pr_info("ring=%p, size=%lu\n", ring, (unsigned long)size);
 
 	return 0;
 
@@ -51,34 +158,74 @@ static int __file_release(struct inode *inode, struct file *filep) {
 
 	pr_info("self=%p\n", self);
 
+	// waiters give up once no daemon is left to answer
+	atomic_dec(&self->files);
+	wake_up_all(&self->rsp_wq);
+
 	return 0;
 }
 
 static __poll_t __file_poll(struct file *filep, struct poll_table_struct *wait) {
 	struct qvio_umods* self = filep->private_data;
 
+	unsigned long flags;
+	bool pending;
+
 	poll_wait(filep, &self->req_wq, wait);
 
-	if(!list_empty(&self->req_list))
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	pending = __req_pending(self);
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+	if(pending)
 		return EPOLLIN | EPOLLRDNORM;
 
 	return 0;
 }
 
+static int __file_mmap(struct file *filep, struct vm_area_struct *vma) {
+	struct qvio_umods* self = filep->private_data;
+	int err;
+
+	mutex_lock(&self->ring_mutex);
+
+	if(! self->ring) {
+		pr_err("unexpected value, self->ring=%p\n", self->ring);
+
+		err = -EINVAL;
+		goto err0;
+	}
+
+	err = remap_vmalloc_range(vma, self->ring, vma->vm_pgoff);
+	if(err) {
+		pr_err("remap_vmalloc_range() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	mutex_unlock(&self->ring_mutex);
+
+	return 0;
+
+err0:
+	mutex_unlock(&self->ring_mutex);
+	return err;
+}
+
 static long __ioctl_g_umods_req(struct file *filep, unsigned int cmd, unsigned long arg) {
 	long ret;
 	struct qvio_umods* self = filep->private_data;
 	struct qvio_umods_req_entry *req_entry;
 	unsigned long flags;
 
+	spin_lock_irqsave(&self->req_list_lock, flags);
 	if(list_empty(&self->req_list)) {
+		spin_unlock_irqrestore(&self->req_list_lock, flags);
 		pr_err("unexpected value, self->req_list is empty\n");
 
 		ret = -EFAULT;
 		goto err0;
 	}
 
-	spin_lock_irqsave(&self->req_list_lock, flags);
 	req_entry = list_first_entry(&self->req_list, struct qvio_umods_req_entry, node);
 	list_del(&req_entry->node);
 	spin_unlock_irqrestore(&self->req_list_lock, flags);
@@ -110,50 +257,260 @@ err0:
 
 static long __ioctl_s_umods_rsp(struct file *filep, unsigned int cmd, unsigned long arg) {
 	long ret;
-	int err;
 	struct qvio_umods* self = filep->private_data;
-	struct qvio_umods_rsp_entry *rsp_entry;
-	unsigned long flags;
+	struct qvio_umods_rsp rsp;
 
 #if 0 // DEBUG
 	pr_info("\n");
 #endif
 
-	err = qvio_umods_rsp_entry_new(&rsp_entry);
-	if(err) {
-		pr_err("qvio_umods_rsp_entry_new() failed, err=%d\n", err);
+	ret = copy_from_user(&rsp, (void __user *)arg, sizeof(struct qvio_umods_rsp));
+	if (ret != 0) {
+		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
 
-		ret = -err;
+		ret = -EFAULT;
 		goto err0;
 	}
 
-	ret = copy_from_user(&rsp_entry->rsp, (void __user *)arg, sizeof(struct qvio_umods_rsp));
+#if 0 // DEBUG
+	pr_info("+rsp(%d, %d)\n",
+		(int)rsp.job_id,
+		(int)rsp.sequence);
+#endif
+
+	__rsp_complete(self, &rsp);
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+// called with ring_mutex held, hands the responses in the ring to their waiters
+static int __ring_rsp_drain(struct qvio_umods* self) {
+	struct qvio_umods_rsp rsp;
+	u32 head;
+
+	head = smp_load_acquire(&self->ring->rsp_head);
+	if(head - self->ring_rsp_tail > QVIO_UMODS_RING_SLOTS) {
+		pr_err("unexpected value, rsp_head=%u, rsp_tail=%u\n", head, self->ring_rsp_tail);
+		return -EINVAL;
+	}
+
+	while(self->ring_rsp_tail != head) {
+		memcpy(&rsp, &self->ring_rsp[self->ring_rsp_tail & (QVIO_UMODS_RING_SLOTS - 1)],
+			sizeof(struct qvio_umods_rsp));
+		self->ring_rsp_tail++;
+		smp_store_release(&self->ring->rsp_tail, self->ring_rsp_tail);
+
+#if 0 // DEBUG
+		pr_info("+rsp(%d, %d)\n",
+			(int)rsp.job_id,
+			(int)rsp.sequence);
+#endif
+
+		__rsp_complete(self, &rsp);
+	}
+	WRITE_ONCE(self->ring->rsp_unmatched, (__u32)self->rsp_unmatched);
+
+	return 0;
+}
+
+// called with ring_mutex held and the ring disabled, moves the requests the
+// daemon has not taken yet back to the front of req_list, in order
+static int __ring_req_drain(struct qvio_umods* self) {
+	int err;
+	struct qvio_umods_req_entry *req_entry, *req_next;
+	LIST_HEAD(drained);
+	unsigned long flags;
+	u32 tail;
+
+	tail = smp_load_acquire(&self->ring->req_tail);
+	if(self->ring_req_head - tail > QVIO_UMODS_RING_SLOTS) {
+		pr_err("unexpected value, req_head=%u, req_tail=%u\n", self->ring_req_head, tail);
+
+		err = -EINVAL;
+		goto err0;
+	}
+
+	for(;tail != self->ring_req_head;tail++) {
+		err = qvio_umods_req_entry_new(&req_entry);
+		if(err) {
+			pr_err("qvio_umods_req_entry_new() failed, err=%d\n", err);
+			goto err1;
+		}
+
+		memcpy(&req_entry->req, &self->ring_req[tail & (QVIO_UMODS_RING_SLOTS - 1)],
+			sizeof(struct qvio_umods_req));
+		list_add_tail(&req_entry->node, &drained);
+	}
+
+	if(list_empty(&drained))
+		return 0;
+
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	list_splice(&drained, &self->req_list);
+	__req_notify(self);
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+	return 0;
+
+err1:
+	list_for_each_entry_safe(req_entry, req_next, &drained, node) {
+		list_del(&req_entry->node);
+		kfree(req_entry);
+	}
+err0:
+	return err;
+}
+
+static long __ioctl_s_umods_ring(struct file *filep, unsigned int cmd, unsigned long arg) {
+	long ret;
+	int err;
+	struct qvio_umods* self = filep->private_data;
+	struct qvio_umods_ring args;
+	struct eventfd_ctx* eventfd = NULL;
+	struct eventfd_ctx* old_eventfd;
+	unsigned long flags;
+	bool was_enabled;
+
+	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
 	if (ret != 0) {
 		pr_err("copy_from_user() failed, err=%d\n", (int)ret);
 
 		ret = -EFAULT;
-		goto err1;
+		goto err0;
 	}
 
-#if 0 // DEBUG
-	pr_info("+rsp(%d, %d)\n",
-		(int)rsp_entry->rsp.job_id,
-		(int)rsp_entry->rsp.sequence);
-#endif
+	if(args.enable && args.eventfd >= 0) {
+		eventfd = eventfd_ctx_fdget(args.eventfd);
+		if(IS_ERR(eventfd)) {
+			ret = PTR_ERR(eventfd);
+			pr_err("eventfd_ctx_fdget() failed, err=%d\n", (int)ret);
 
-	spin_lock_irqsave(&self->rsp_list_lock, flags);
-	list_add_tail(&rsp_entry->node, &self->rsp_list);
-	spin_unlock_irqrestore(&self->rsp_list_lock, flags);
+			goto err0;
+		}
+	}
 
-	wake_up_interruptible(&self->rsp_wq);
+	mutex_lock(&self->ring_mutex);
 
-	ret = 0;
+	if(args.enable && ! self->ring) {
+		err = __ring_alloc(self);
+		if(err) {
+			pr_err("__ring_alloc() failed, err=%d\n", err);
 
-	return ret;
+			ret = err;
+			goto err1;
+		}
+	}
+
+	was_enabled = self->ring_enabled;
+	if(! args.enable && was_enabled) {
+		// answers already in the ring still reach their waiters
+		err = __ring_rsp_drain(self);
+		if(err)
+			pr_err("__ring_rsp_drain() failed, err=%d\n", err);
+	}
+
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	old_eventfd = self->eventfd;
+	if(args.enable) {
+		if(! self->ring_enabled) {
+			// a (re)started daemon begins with an empty ring
+			self->ring_req_head = 0;
+			self->ring_rsp_tail = 0;
+			self->ring->req_head = 0;
+			self->ring->req_tail = 0;
+			self->ring->rsp_head = 0;
+			self->ring->rsp_tail = 0;
+			self->ring->req_overflows = 0;
+		}
+		self->ring_enabled = true;
+		self->eventfd = eventfd;
+		__ring_req_refill(self);
+		if(__req_pending(self))
+			__req_notify(self);
+	} else {
+		self->ring_enabled = false;
+		self->eventfd = NULL;
+	}
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+	// requests still in their slots go through QVID_IOC_G_UMODS_REQ
+	if(! args.enable && was_enabled) {
+		err = __ring_req_drain(self);
+		if(err) {
+			pr_err("__ring_req_drain() failed, err=%d\n", err);
+
+			// keep the ring running rather than drop the requests
+			spin_lock_irqsave(&self->req_list_lock, flags);
+			self->ring_enabled = true;
+			self->eventfd = old_eventfd;
+			spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+			ret = err;
+			goto err1;
+		}
+	}
+
+	args.nslots = QVIO_UMODS_RING_SLOTS;
+	args.size = (__u32)self->ring_size;
+
+	mutex_unlock(&self->ring_mutex);
+
+	if(old_eventfd)
+		eventfd_ctx_put(old_eventfd);
+
+	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	return 0;
 
 err1:
-	kfree(rsp_entry);
+	mutex_unlock(&self->ring_mutex);
+	if(eventfd)
+		eventfd_ctx_put(eventfd);
+err0:
+	return ret;
+}
+
+static long __ioctl_umods_ring_kick(struct file *filep, unsigned int cmd, unsigned long arg) {
+	long ret;
+	struct qvio_umods* self = filep->private_data;
+	unsigned long flags;
+
+	mutex_lock(&self->ring_mutex);
+
+	if(! self->ring_enabled) {
+		pr_err("unexpected value, self->ring_enabled=%d\n", (int)self->ring_enabled);
+
+		ret = -EINVAL;
+		goto err0;
+	}
+
+	// slots freed by the daemon take the held back requests
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	if(__ring_req_refill(self))
+		__req_notify(self);
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+	ret = __ring_rsp_drain(self);
+	if(ret) {
+		pr_err("__ring_rsp_drain() failed, err=%d\n", (int)ret);
+		goto err0;
+	}
+
+	mutex_unlock(&self->ring_mutex);
+
+	return 0;
+
 err0:
+	mutex_unlock(&self->ring_mutex);
 	return ret;
 }
 
@@ -167,6 +524,14 @@ static long __file_ioctl(struct file *filep, unsigned int cmd, unsigned long arg
 		return __ioctl_s_umods_rsp(filep, cmd, arg);
 		break;
 
+	case QVID_IOC_S_UMODS_RING:
+		return __ioctl_s_umods_ring(filep, cmd, arg);
+		break;
+
+	case QVID_IOC_UMODS_RING_KICK:
+		return __ioctl_umods_ring_kick(filep, cmd, arg);
+		break;
+
 	default:
 		return -EINVAL;
 		break;
@@ -185,6 +550,7 @@ static const struct file_operations __fileops = {
 	.owner = THIS_MODULE,
 	.release = __file_release,
 	.poll = __file_poll,
+	.mmap = __file_mmap,
 	.llseek = noop_llseek,
 	.unlocked_ioctl = __file_ioctl,
 #ifdef CONFIG_COMPAT
@@ -200,13 +566,20 @@ void qvio_umods_start(struct qvio_umods* self) {
 	INIT_LIST_HEAD(&self->req_list);
 
 	init_waitqueue_head(&self->rsp_wq);
-	spin_lock_init(&self->rsp_list_lock);
-	INIT_LIST_HEAD(&self->rsp_list);
+	spin_lock_init(&self->rsp_lock);
+	INIT_LIST_HEAD(&self->waiters);
+	self->rsp_unmatched = 0;
+	atomic_set(&self->files, 0);
+
+	self->ring = NULL;
+	self->ring_size = 0;
+	self->ring_enabled = false;
+	self->eventfd = NULL;
+	mutex_init(&self->ring_mutex);
 }
 
 void qvio_umods_stop(struct qvio_umods* self) {
-	struct qvio_umods_req_entry *req_entry;
-	struct qvio_umods_rsp_entry *rsp_entry;
+	struct qvio_umods_req_entry *req_entry, *req_next;
 
 	pr_info("\n");
 
@@ -214,7 +587,7 @@ void qvio_umods_stop(struct qvio_umods* self) {
 		pr_warn("self->req_list is not empty\n");
 
 #if 1
-		list_for_each_entry(req_entry, &self->req_list, node) {
+		list_for_each_entry_safe(req_entry, req_next, &self->req_list, node) {
 			list_del(&req_entry->node);
 
 			pr_warn("req_entry->req={%d %d}\n",
@@ -226,20 +599,19 @@ void qvio_umods_stop(struct qvio_umods* self) {
 #endif
 	}
 
-	if(! list_empty(&self->rsp_list)) {
-		pr_warn("self->rsp_list is not empty\n");
+	if(! list_empty(&self->waiters))
+		pr_warn("self->waiters is not empty\n");
 
-#if 1
-		list_for_each_entry(rsp_entry, &self->rsp_list, node) {
-			list_del(&rsp_entry->node);
-
-			pr_warn("rsp_entry->rsp={%d %d}\n",
-				(int)rsp_entry->rsp.job_id,
-				(int)rsp_entry->rsp.sequence);
+	self->ring_enabled = false;
+	if(self->eventfd) {
+		eventfd_ctx_put(self->eventfd);
+		self->eventfd = NULL;
+	}
 
-			kfree(rsp_entry);
-		}
-#endif
+	// pages still mapped by a daemon stay alive until it unmaps them
+	if(self->ring) {
+		vfree(self->ring);
+		self->ring = NULL;
 	}
 }
 
@@ -265,6 +637,7 @@ int qvio_umods_get_fd(struct qvio_umods* self, const char* name, int flags) {
 	}
 
 	fd_install(fd, file);
+	atomic_inc(&self->files);
 	err = fd;
 
 	return err;
@@ -275,62 +648,125 @@ err0:
 	return err;
 }
 
-void qvio_umods_request(struct qvio_umods* self, struct qvio_umods_req_entry* req_entry) {
+static int __request(struct qvio_umods* self, struct qvio_umods_req* req) {
+	int err;
+	struct qvio_umods_req_entry* req_entry;
 	unsigned long flags;
 
-	req_entry->req.sequence = (__u16)atomic_inc_return(&self->sequence);
-
-#if 1 // DEBUG
+#if 0 // DEBUG
 	pr_info("+req(%d, %d)\n",
-		(int)req_entry->req.job_id,
-		(int)req_entry->req.sequence);
+		(int)req->job_id,
+		(int)req->sequence);
 #endif
 
+	// fast path, straight into a free ring slot
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	if(self->ring_enabled && list_empty(&self->req_list) && __ring_req_push(self, req)) {
+		__req_notify(self);
+		spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+		return 0;
+	}
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+
+	err = qvio_umods_req_entry_new(&req_entry);
+	if(err) {
+		pr_err("qvio_umods_req_entry_new() failed, err=%d\n", err);
+		goto err0;
+	}
+	memcpy(&req_entry->req, req, sizeof(struct qvio_umods_req));
+
 	spin_lock_irqsave(&self->req_list_lock, flags);
 	list_add_tail(&req_entry->node, &self->req_list);
+	if(self->ring_enabled) {
+		WRITE_ONCE(self->ring->req_overflows, self->ring->req_overflows + 1);
+		__ring_req_refill(self);
+	}
+	__req_notify(self);
 	spin_unlock_irqrestore(&self->req_list_lock, flags);
 
-	wake_up_interruptible(&self->req_wq);
+	return 0;
+
+err0:
+	return err;
 }
 
-int qvio_umods_response(struct qvio_umods* self, struct qvio_umods_rsp_entry** rsp_entry) {
+int qvio_umods_request(struct qvio_umods* self, struct qvio_umods_req* req) {
+	req->sequence = (__u16)atomic_inc_return(&self->sequence);
+	req->flags |= QVIO_UMODS_REQ_FLAG_NO_RSP;
+
+	return __request(self, req);
+}
+
+int qvio_umods_call(struct qvio_umods* self, struct qvio_umods_req* req, struct qvio_umods_rsp* rsp) {
 	int err;
+	long timeout;
+	struct qvio_umods_waiter waiter;
 	unsigned long flags;
+	bool ring_enabled;
 
-#if 0 // DEBUG
-	pr_info("\n");
-#endif
+	memset(rsp, 0, sizeof(struct qvio_umods_rsp));
 
-	// wait for user-job-done
-	err = wait_event_interruptible(self->rsp_wq, !list_empty(&self->rsp_list));
-	if(err != 0) {
-		pr_err("wait_event_interruptible() failed, err=%d\n", err);
-		goto err0;
-	}
+	// nobody to answer, and a daemon attaching later must not get a stale job
+	if(! atomic_read(&self->files))
+		return -ENODEV;
 
-#if 0 // DEBUG
-	pr_info("\n");
-#endif
+	// answers are opt-in, a daemon that never enabled the ring gets it fire-and-forget
+	spin_lock_irqsave(&self->req_list_lock, flags);
+	ring_enabled = self->ring_enabled;
+	spin_unlock_irqrestore(&self->req_list_lock, flags);
+	if(! ring_enabled)
+		return qvio_umods_request(self, req);
+
+	req->sequence = (__u16)atomic_inc_return(&self->sequence);
+	req->flags &= ~QVIO_UMODS_REQ_FLAG_NO_RSP;
 
-	if(list_empty(&self->rsp_list)) {
-		pr_err("self->rsp_list is empty\n");
-		err = EFAULT;
+	waiter.sequence = req->sequence;
+	waiter.done = false;
+	spin_lock_irqsave(&self->rsp_lock, flags);
+	list_add_tail(&waiter.node, &self->waiters);
+	spin_unlock_irqrestore(&self->rsp_lock, flags);
+
+	err = __request(self, req);
+	if(err) {
+		pr_err("__request() failed, err=%d\n", err);
+		goto err1;
+	}
+
+	timeout = wait_event_interruptible_timeout(self->rsp_wq,
+		READ_ONCE(waiter.done) || ! atomic_read(&self->files),
+		msecs_to_jiffies(QVIO_UMODS_RSP_TIMEOUT_MS));
+
+	spin_lock_irqsave(&self->rsp_lock, flags);
+	list_del(&waiter.node);
+	spin_unlock_irqrestore(&self->rsp_lock, flags);
+
+	if(! waiter.done) {
+		if(timeout < 0)
+			err = (int)timeout;
+		else if(! atomic_read(&self->files))
+			err = -ENODEV; // the daemon went away
+		else
+			err = -ETIMEDOUT;
+		pr_err("req(%d, %d) not answered, err=%d\n",
+			(int)req->job_id, (int)req->sequence, err);
 		goto err0;
 	}
 
-	spin_lock_irqsave(&self->rsp_list_lock, flags);
-	*rsp_entry = list_first_entry(&self->rsp_list, struct qvio_umods_rsp_entry, node);
-	list_del(&(*rsp_entry)->node);
-	spin_unlock_irqrestore(&self->rsp_list_lock, flags);
+	memcpy(rsp, &waiter.rsp, sizeof(struct qvio_umods_rsp));
 
-#if 1 // DEBUG
+#if 0 // DEBUG
 	pr_info("-rsp(%d, %d)\n",
-		(int)(*rsp_entry)->rsp.job_id,
-		(int)(*rsp_entry)->rsp.sequence);
+		(int)rsp->job_id,
+		(int)rsp->sequence);
 #endif
 
 	return 0;
 
+err1:
+	spin_lock_irqsave(&self->rsp_lock, flags);
+	list_del(&waiter.node);
+	spin_unlock_irqrestore(&self->rsp_lock, flags);
 err0:
 	return err;
 }
@@ -6,7 +6,9 @@
 #include <linux/wait.h>
 #include <linux/fs.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/spinlock_types.h>
+#include <linux/eventfd.h>
 
 struct qvio_umods;
 
@@ -15,8 +17,11 @@ struct qvio_umods_req_entry {
 	struct qvio_umods_req req;
 };
 
-struct qvio_umods_rsp_entry {
+// a request in flight, waiting for the response with the same sequence
+struct qvio_umods_waiter {
 	struct list_head node;
+	__u16 sequence;
+	bool done;
 	struct qvio_umods_rsp rsp;
 };
 
@@ -28,19 +33,33 @@ struct qvio_umods {
 	spinlock_t req_list_lock;
 	struct list_head req_list;
 
-	// rsp list
+	// rsp waiters
 	wait_queue_head_t rsp_wq;
-	spinlock_t rsp_list_lock;
-	struct list_head rsp_list;
+	spinlock_t rsp_lock;
+	struct list_head waiters;
+	unsigned long rsp_unmatched;
+	atomic_t files;
+
+	// shared ring, see QVID_IOC_S_UMODS_RING, protected by req_list_lock
+	struct qvio_umods_ring_hdr* ring;
+	struct qvio_umods_req* ring_req;
+	struct qvio_umods_rsp* ring_rsp;
+	size_t ring_size;
+	u32 ring_req_head;
+	u32 ring_rsp_tail;
+	bool ring_enabled;
+	struct eventfd_ctx* eventfd;
+	struct mutex ring_mutex;
 };
 
 int qvio_umods_req_entry_new(struct qvio_umods_req_entry** req_entry);
-int qvio_umods_rsp_entry_new(struct qvio_umods_rsp_entry** rsp_entry);
 
 void qvio_umods_start(struct qvio_umods* self);
 void qvio_umods_stop(struct qvio_umods* self);
 int qvio_umods_get_fd(struct qvio_umods* self, const char* name, int flags); // flags = O_RDONLY | O_CLOEXEC
-void qvio_umods_request(struct qvio_umods* self, struct qvio_umods_req_entry* req_entry);
-int qvio_umods_response(struct qvio_umods* self, struct qvio_umods_rsp_entry** rsp_entry);
+int qvio_umods_request(struct qvio_umods* self, struct qvio_umods_req* req); // fire-and-forget
+// waits for the answer once the daemon enabled the ring, fire-and-forget
+// before that, -ENODEV at once without queueing when no daemon holds the UMODS_FD
+int qvio_umods_call(struct qvio_umods* self, struct qvio_umods_req* req, struct qvio_umods_rsp* rsp);
 
 #endif // __QVIO_UMODS_H__
\ No newline at end of file
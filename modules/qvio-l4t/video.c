@@ -90,6 +90,7 @@ struct qvio_video* qvio_video_new(void) {
 
 	kref_init(&self->ref);
 	qvio_queue_init(&self->queue);
+	qvio_meta_init(&self->meta);
 	mutex_init(&self->device_mutex);
 	self->vfl_dir = VFL_DIR_RX;
 	self->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
@@ -113,6 +114,7 @@ static void __video_free(struct kref *ref)
 
 	pr_info("\n");
 
+	qvio_qdma_wr_put(self->qdma_wr);
 	kfree(self);
 }
 
@@ -121,6 +123,10 @@ void qvio_video_put(struct qvio_video* self) {
 		kref_put(&self->ref, __video_free);
 }
 
+static void __meta_release(struct qvio_meta* meta) {
+	qvio_video_put(container_of(meta, struct qvio_video, meta));
+}
+
 int qvio_video_start(struct qvio_video* self) {
 	int err;
 	struct vb2_queue* vb2_queue;
@@ -135,6 +141,7 @@ int qvio_video_start(struct qvio_video* self) {
 
 	self->queue.halign = self->halign;
 	self->queue.valign = self->valign;
+	self->queue.dev = self->qdma_wr ? self->qdma_wr->dev : self->qdev->dev;
 
 	err = qvio_queue_start(&self->queue, self->buffer_type);
 	if(err) {
@@ -207,6 +214,9 @@ int qvio_video_start(struct qvio_video* self) {
 		break;
 	}
 
+	if(self->qdma_wr) // no daemon to hand the default format to
+		memcpy(&self->queue.current_format, &self->current_format, sizeof(struct v4l2_format));
+
 	self->current_parm.type = self->buffer_type;
 	self->current_parm.parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
 	self->current_parm.parm.capture.capturemode = 0;
@@ -230,10 +240,24 @@ int qvio_video_start(struct qvio_video* self) {
 		goto err3;
 	}
 
+	if(self->qdma_wr) {
+		// the meta node holds self until its last file is closed
+		self->meta.release = __meta_release;
+		qvio_video_get(self);
+		err = qvio_meta_start(&self->meta, &self->v4l2_dev, self->bus_info);
+		if(err) {
+			pr_err("qvio_meta_start() failed, err=%d\n", err);
+			qvio_video_put(self);
+			goto err4;
+		}
+	}
+
 	qvio_umods_start(&self->umods);
 
 	return 0;
 
+err4:
+	video_unregister_device(self->vdev);
 err3:
 	video_device_release(self->vdev);
 err2:
@@ -248,6 +272,7 @@ void qvio_video_stop(struct qvio_video* self) {
 	pr_info("\n");
 
 	qvio_umods_stop(&self->umods);
+	qvio_meta_stop(&self->meta);
 	video_unregister_device(self->vdev);
 	video_device_release(self->vdev);
 	qvio_queue_stop(&self->queue);
@@ -865,11 +890,15 @@ err0:
 
 static long __ioctl_default(struct file *file, void *fh, bool valid_prio, unsigned int cmd, void *arg) {
 	long ret;
+	struct qvio_video* self = video_drvdata(file);
 
 #if 0
 	pr_info("valid_prio=%d cmd=%d arg=%p\n", valid_prio, cmd, arg);
 #endif
 
+	if(self->qdma_wr) // engine mode, umods is not used
+		return -ENOIOCTLCMD;
+
 	switch(cmd) {
 	case QVID_IOC_G_UMODS_FD:
 		ret = __ioctl_g_umods_fd(file, fh, valid_prio, cmd, arg);
@@ -4,6 +4,8 @@
 #include "queue.h"
 #include "device.h"
 #include "umods.h"
+#include "qdma_wr.h"
+#include "meta.h"
 
 #include <media/v4l2-device.h>
 #include <linux/videodev2.h>
@@ -29,6 +31,10 @@ struct qvio_video {
 	struct v4l2_streamparm current_parm;
 
 	struct qvio_umods umods;
+
+	// engine mode, vb2 buffers are fed to the qdma_wr engine without a daemon
+	struct qvio_qdma_wr* qdma_wr;
+	struct qvio_meta meta; // per-frame metadata node of engine mode
 };
 
 struct qvio_video* qvio_video_new(void);
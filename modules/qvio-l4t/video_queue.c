@@ -4,9 +4,11 @@
 #include <linux/slab.h>
 #include <linux/fs.h>
 #include <linux/poll.h>
+#include <linux/timekeeping.h>
 
 #include "video_queue.h"
 #include "utils.h"
+#include "trace.h"
 
 static void __free(struct kref *ref);
 static long __file_ioctl_s_fmt(struct qvio_video_queue* self, struct file * filp, unsigned long arg);
@@ -17,9 +19,9 @@ static long __file_ioctl_qbuf(struct qvio_video_queue* self, struct file * filp,
 static long __file_ioctl_dqbuf(struct qvio_video_queue* self, struct file * filp, unsigned long arg);
 static long __file_ioctl_streamon(struct qvio_video_queue* self, struct file * filp, unsigned long arg);
 static long __file_ioctl_streamoff(struct qvio_video_queue* self, struct file * filp, unsigned long arg);
-static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf);
-static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf);
-static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf);
+static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns);
+static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns);
+static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns);
 static int qbuf_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry);
 
 struct qvio_video_queue* qvio_video_queue_new(void) {
@@ -78,9 +80,38 @@ __poll_t qvio_video_queue_file_poll(struct qvio_video_queue* self, struct file *
 	return 0;
 }
 
+// file ioctls keep qvio_video_queue_claim() out until they return
+static int __file_begin(struct qvio_video_queue* self) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	if(self->owner) {
+		spin_unlock_irqrestore(&self->lock, flags);
+
+		// engine is driven by a V4L2 node
+		return -EBUSY;
+	}
+	self->file_users++;
+	spin_unlock_irqrestore(&self->lock, flags);
+
+	return 0;
+}
+
+static void __file_end(struct qvio_video_queue* self) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	self->file_users--;
+	spin_unlock_irqrestore(&self->lock, flags);
+}
+
 long qvio_video_queue_file_ioctl(struct qvio_video_queue* self, struct file * filp, unsigned int cmd, unsigned long arg) {
 	long ret;
 
+	ret = __file_begin(self);
+	if(ret)
+		return ret;
+
 	switch(cmd) {
 	case QVIO_IOC_S_FMT:
 		ret = __file_ioctl_s_fmt(self, filp, arg);
@@ -119,6 +150,8 @@ long qvio_video_queue_file_ioctl(struct qvio_video_queue* self, struct file * fi
 		break;
 	}
 
+	__file_end(self);
+
 	return ret;
 }
 
@@ -186,6 +219,7 @@ static long __file_ioctl_req_bufs(struct qvio_video_queue* self, struct file * f
 	int err;
 	long ret;
 	struct qvio_req_bufs args;
+	int node;
 	int i;
 
 	ret = copy_from_user(&args, (void __user *)arg, sizeof(args));
@@ -196,6 +230,11 @@ static long __file_ioctl_req_bufs(struct qvio_video_queue* self, struct file * f
 		goto err0;
 	}
 
+	// numa_node was padding before, only trust it when asked to
+	if(! (args.buf_type & QVIO_REQ_BUFS_FLAG_NUMA_NODE))
+		args.numa_node = 0;
+	args.buf_type &= ~QVIO_REQ_BUFS_FLAG_NUMA_NODE;
+
 	if(self->buffers) {
 		kfree(self->buffers);
 		self->buffers_count = 0;
@@ -225,14 +264,27 @@ static long __file_ioctl_req_bufs(struct qvio_video_queue* self, struct file * f
 
 	switch(args.buf_type) {
 	case QVIO_BUF_TYPE_MMAP:
+		if(args.numa_node) {
+			node = args.numa_node - 1;
+			if(node >= MAX_NUMNODES || ! node_online(node)) {
+				pr_err("unexpected value, args.numa_node=%d\n", (int)args.numa_node);
+				ret = -EINVAL;
+				goto err0;
+			}
+		} else {
+			/* keep frames next to the root port the device sits on */
+			node = dev_to_node(self->dev);
+		}
+
 		if(self->mmap_buffer) vfree(self->mmap_buffer);
 
 		self->mmap_buffer_size = (size_t)(self->buffer_size * args.count);
-		self->mmap_buffer = vmalloc(self->mmap_buffer_size);
+		self->mmap_buffer = vmalloc_node(self->mmap_buffer_size, node);
 		if(! self->mmap_buffer) {
-			pr_err("vmalloc() failed\n");
+			pr_err("vmalloc_node() failed, node=%d\n", node);
 			goto err0;
 		}
+		pr_info("mmap_buffer_size=%lu, node=%d\n", (unsigned long)self->mmap_buffer_size, node);
 
 		break;
 
@@ -302,28 +354,40 @@ static long __file_ioctl_qbuf(struct qvio_video_queue* self, struct file * filp,
 		goto err0;
 	}
 
-	switch(buf.buf_type) {
+	return qvio_video_queue_file_qbuf(self, filp, &buf, 0);
+
+err0:
+	return ret;
+}
+
+long qvio_video_queue_file_qbuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns) {
+	long ret;
+
+	ret = __file_begin(self);
+	if(ret)
+		return ret;
+
+	switch(buf->buf_type) {
 	case QVIO_BUF_TYPE_USERPTR:
-		ret = __file_ioctl_qbuf_userptr(self, filp, &buf);
+		ret = __file_ioctl_qbuf_userptr(self, filp, buf, pts_ns);
 		break;
 
 	case QVIO_BUF_TYPE_DMABUF:
-		ret = __file_ioctl_qbuf_dmabuf(self, filp, &buf);
+		ret = __file_ioctl_qbuf_dmabuf(self, filp, buf, pts_ns);
 		break;
 
 	case QVIO_BUF_TYPE_MMAP:
-		ret = __file_ioctl_qbuf_mmap(self, filp, &buf);
+		ret = __file_ioctl_qbuf_mmap(self, filp, buf, pts_ns);
 		break;
 
 	default:
-		pr_err("unexpected value, buf.buf_type=%d\n", buf.buf_type);
+		pr_err("unexpected value, buf->buf_type=%d\n", buf->buf_type);
 		ret = -EINVAL;
 		break;
 	}
 
-	return ret;
+	__file_end(self);
 
-err0:
 	return ret;
 }
 
@@ -347,6 +411,8 @@ static long __file_ioctl_dqbuf(struct qvio_video_queue* self, struct file * filp
 
 	// pr_info("buf_entry->buf.index=0x%llX\n", (int64_t)buf_entry->buf.index);
 	args.index = buf_entry->buf.index;
+	trace_qvio_dqbuf(self, buf_entry, buf_entry->sequence);
+	qvio_stats_lat(&self->stats, QVIO_STATS_LAT_IRQ_DQBUF, buf_entry->done_ns, ktime_get_ns());
 
 	qvio_buf_entry_put(buf_entry);
 
@@ -365,23 +431,32 @@ err0:
 }
 
 static long __file_ioctl_streamon(struct qvio_video_queue* self, struct file * filp, unsigned long arg) {
-	long ret;
+	return qvio_video_queue_streamon(self);
+}
+
+static long __file_ioctl_streamoff(struct qvio_video_queue* self, struct file * filp, unsigned long arg) {
+	return qvio_video_queue_streamoff(self);
+}
+
+int qvio_video_queue_streamon(struct qvio_video_queue* self) {
 	int err;
 	struct qvio_buf_entry* buf_entry;
 
 	if(self->state == QVIO_VIDEO_QUEUE_STATE_START) {
 		pr_err("unexpected value, self->state=%d\n", self->state);
-		ret = -EINVAL;
+		err = -EINVAL;
 		goto err0;
 	}
 
 	err = self->streamon(self);
 	if(err) {
 		pr_err("streamon() failed, err=%d\n", err);
-		ret = err;
 		goto err0;
 	}
 
+	self->sequence = 0;
+	self->starved = 0;
+
 	if(! list_empty(&self->job_list)) {
 		buf_entry = list_first_entry(&self->job_list, struct qvio_buf_entry, node);
 		err = self->start_buf_entry(self, buf_entry);
@@ -395,47 +470,51 @@ static long __file_ioctl_streamon(struct qvio_video_queue* self, struct file * f
 	return 0;
 
 err0:
-	return ret;
+	return err;
 }
 
-static long __file_ioctl_streamoff(struct qvio_video_queue* self, struct file * filp, unsigned long arg) {
-	long ret;
+static void __flush_list(struct qvio_video_queue* self, struct list_head* list) {
+	struct qvio_buf_entry* buf_entry;
+
+	while(! list_empty(list)) {
+		buf_entry = list_first_entry(list, struct qvio_buf_entry, node);
+		list_del(&buf_entry->node);
+
+		if(self->buf_done)
+			self->buf_done(self, buf_entry, -ECANCELED);
+		else
+			qvio_buf_entry_put(buf_entry);
+	}
+}
+
+int qvio_video_queue_streamoff(struct qvio_video_queue* self) {
 	int err;
 	unsigned long flags;
-	struct qvio_buf_entry* buf_entry;
 
 	if(self->state == QVIO_VIDEO_QUEUE_STATE_READY) {
 		pr_err("unexpected value, self->state=%d\n", self->state);
-		ret = -EINVAL;
+		err = -EINVAL;
 		goto err0;
 	}
 
 	err = self->streamoff(self);
 	if(err) {
 		pr_err("streamoff() failed, err=%d\n", err);
-		ret = err;
 		goto err0;
 	}
 
 	spin_lock_irqsave(&self->lock, flags);
 	if(! list_empty(&self->job_list)) {
-		pr_warn("job list is not empty!!\n");
+		if(! self->owner)
+			pr_warn("job list is not empty!!\n");
 
-		while(! list_empty(&self->job_list)) {
-			buf_entry = list_first_entry(&self->job_list, struct qvio_buf_entry, node);
-			list_del(&buf_entry->node);
-			qvio_buf_entry_put(buf_entry);
-		}
+		__flush_list(self, &self->job_list);
 	}
 
 	if(! list_empty(&self->done_list)) {
 		pr_warn("done list is not empty!!\n");
 
-		while(! list_empty(&self->done_list)) {
-			buf_entry = list_first_entry(&self->done_list, struct qvio_buf_entry, node);
-			list_del(&buf_entry->node);
-			qvio_buf_entry_put(buf_entry);
-		}
+		__flush_list(self, &self->done_list);
 	}
 	spin_unlock_irqrestore(&self->lock, flags);
 
@@ -444,10 +523,50 @@ static long __file_ioctl_streamoff(struct qvio_video_queue* self, struct file *
 	return 0;
 
 err0:
-	return ret;
+	return err;
 }
 
-static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf) {
+int qvio_video_queue_claim(struct qvio_video_queue* self, void* owner,
+	void (*buf_done)(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry, int err)) {
+	int err;
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	if(self->owner || self->file_users || self->state != QVIO_VIDEO_QUEUE_STATE_READY ||
+		! list_empty(&self->job_list) || ! list_empty(&self->done_list)) {
+		spin_unlock_irqrestore(&self->lock, flags);
+
+		pr_err("engine is busy, self->owner=%p, self->state=%d\n", self->owner, self->state);
+		err = -EBUSY;
+		goto err0;
+	}
+
+	self->owner = owner;
+	self->buf_done = buf_done;
+	spin_unlock_irqrestore(&self->lock, flags);
+
+	return 0;
+
+err0:
+	return err;
+}
+
+void qvio_video_queue_release(struct qvio_video_queue* self, void* owner) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&self->lock, flags);
+	if(self->owner == owner) {
+		self->owner = NULL;
+		self->buf_done = NULL;
+	}
+	spin_unlock_irqrestore(&self->lock, flags);
+}
+
+int qvio_video_queue_qbuf(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry) {
+	return qbuf_buf_entry(self, buf_entry);
+}
+
+static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns) {
 	long ret;
 	int err;
 	unsigned long start;
@@ -512,6 +631,7 @@ static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file
 		ret = err;
 		goto err4;
 	}
+	trace_qvio_map(self, buf->index, sgt, length);
 
 	// utils_sgt_dump(sgt, true);
 
@@ -523,6 +643,7 @@ static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file
 		goto err5;
 	}
 
+	buf_entry->buf.index = buf->index; // for tracing, the rest is filled on success
 	err = self->buf_entry_from_sgt(self, sgt, buf, buf_entry);
 	if (err < 0) {
 		pr_err("self->buf_entry_from_sgt() failed, err=%d\n", err);
@@ -533,6 +654,7 @@ static long __file_ioctl_qbuf_userptr(struct qvio_video_queue* self, struct file
 	buf_entry->buf = *buf;
 	buf_entry->dma_dir = dma_dir;
 	buf_entry->u.userptr.sgt = sgt;
+	buf_entry->pts_ns = pts_ns;
 
 	qbuf_buf_entry(self, buf_entry);
 
@@ -554,7 +676,7 @@ err0:
 	return ret;
 }
 
-static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf) {
+static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns) {
 	long ret;
 	int err;
 	struct dma_buf *dmabuf;
@@ -593,6 +715,7 @@ static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file
 		ret = -EINVAL;
 		goto err3;
 	}
+	trace_qvio_map(self, buf->index, sgt, dmabuf->size);
 
 	// utils_sgt_dump(sgt, true);
 
@@ -602,6 +725,7 @@ static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file
 		goto err4;
 	}
 
+	buf_entry->buf.index = buf->index; // for tracing, the rest is filled on success
 	err = self->buf_entry_from_sgt(self, sgt, buf, buf_entry);
 	if (err < 0) {
 		pr_err("buf_entry_from_sgt() failed, err=%d\n", err);
@@ -614,6 +738,7 @@ static long __file_ioctl_qbuf_dmabuf(struct qvio_video_queue* self, struct file
 	buf_entry->u.dmabuf.dmabuf = dmabuf;
 	buf_entry->u.dmabuf.attach = attach;
 	buf_entry->u.dmabuf.sgt = sgt;
+	buf_entry->pts_ns = pts_ns;
 
 	qbuf_buf_entry(self, buf_entry);
 
@@ -633,7 +758,7 @@ err0:
 	return ret;
 }
 
-static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf) {
+static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns) {
 	long ret;
 	int err;
 	void* vaddr;
@@ -686,6 +811,7 @@ static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file *
 		ret = err;
 		goto err3;
 	}
+	trace_qvio_map(self, buf->index, sgt, self->buffer_size);
 
 	// utils_sgt_dump(sgt, true);
 
@@ -695,6 +821,7 @@ static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file *
 		goto err4;
 	}
 
+	buf_entry->buf.index = buf->index; // for tracing, the rest is filled on success
 	err = self->buf_entry_from_sgt(self, sgt, buf, buf_entry);
 	if (err < 0) {
 		pr_err("buf_entry_from_sgt() failed, err=%d\n", err);
@@ -705,6 +832,7 @@ static long __file_ioctl_qbuf_mmap(struct qvio_video_queue* self, struct file *
 	buf_entry->buf = *buf;
 	buf_entry->dma_dir = dma_dir;
 	buf_entry->u.userptr.sgt = sgt;
+	buf_entry->pts_ns = pts_ns;
 
 	qbuf_buf_entry(self, buf_entry);
 
@@ -731,6 +859,9 @@ int qbuf_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_ent
 	struct qvio_buf_entry* next_entry;
 	unsigned long flags;
 
+	buf_entry->qbuf_ns = ktime_get_ns();
+	trace_qvio_qbuf(self, buf_entry, self->sequence);
+
 	spin_lock_irqsave(&self->lock, flags);
 	next_entry = list_empty(&self->job_list) ? buf_entry : NULL;
 	list_add_tail(&buf_entry->node, &self->job_list);
@@ -751,6 +882,7 @@ int qbuf_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_ent
 int qvio_video_queue_done(struct qvio_video_queue* self, struct qvio_buf_entry** next_entry) {
 	int err;
 	struct qvio_buf_entry* done_entry;
+	u64 done_ns;
 
 	spin_lock(&self->lock);
 	if(list_empty(&self->job_list)) {
@@ -763,14 +895,40 @@ int qvio_video_queue_done(struct qvio_video_queue* self, struct qvio_buf_entry**
 	// move job from job_list to done_list
 	done_entry = list_first_entry(&self->job_list, struct qvio_buf_entry, node);
 	list_del(&done_entry->node);
+	done_entry->done_ns = ktime_get_ns();
 	// try pick next job
 	*next_entry = list_empty(&self->job_list) ? NULL : list_first_entry(&self->job_list, struct qvio_buf_entry, node);
+	if(! *next_entry) {
+		self->starved++;
+		atomic64_inc(&self->stats.starved);
+	}
+	done_entry->sequence = self->sequence++;
+	trace_qvio_done(self, done_entry, *next_entry);
+
+	atomic64_inc(&self->stats.frames);
+	atomic64_add(done_entry->bytes, &self->stats.bytes);
+	qvio_stats_descs(&self->stats, done_entry->descs);
+	qvio_stats_lat(&self->stats, QVIO_STATS_LAT_QBUF_START, done_entry->qbuf_ns, done_entry->start_ns);
+	qvio_stats_lat(&self->stats, QVIO_STATS_LAT_DMA, done_entry->start_ns, done_entry->done_ns);
+
+	if(self->buf_done) {
+		spin_unlock(&self->lock);
+
+		// the owner's completion counts as the wakeup
+		self->buf_done(self, done_entry, 0);
+
+		return 0;
+	}
 
+	// done_entry may be dequeued and freed as soon as the lock is dropped
+	done_ns = done_entry->done_ns;
+	trace_qvio_wakeup(self, done_entry, done_entry->sequence);
 	list_add_tail(&done_entry->node, &self->done_list);
 	spin_unlock(&self->lock);
 
 	// job done wake up
 	wake_up_interruptible(&self->irq_wait);
+	qvio_stats_lat(&self->stats, QVIO_STATS_LAT_IRQ_WAKEUP, done_ns, ktime_get_ns());
 
 	return 0;
 
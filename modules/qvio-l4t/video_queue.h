@@ -5,6 +5,9 @@
 
 #include "uapi/qvio-l4t.h"
 #include "buf_entry.h"
+#include "stats.h"
+
+#define QVIO_VIDEO_QUEUE_NAME_LEN	16
 
 enum qvio_video_queue_state {
 	QVIO_VIDEO_QUEUE_STATE_READY,
@@ -16,6 +19,7 @@ struct qvio_video_queue {
 
 	struct device *dev;
 	uint32_t device_id;
+	char name[QVIO_VIDEO_QUEUE_NAME_LEN]; // engine node name, for tracing
 
 	spinlock_t lock;
 	struct list_head job_list; // qvio_buf_entry
@@ -41,6 +45,18 @@ struct qvio_video_queue {
 	int (*start_buf_entry)(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry);
 	int (*streamon)(struct qvio_video_queue* self);
 	int (*streamoff)(struct qvio_video_queue* self);
+
+	// in-kernel owner (V4L2 capture node), completes entries instead of done_list
+	void* owner;
+	int file_users; // file ioctls in progress, under lock
+	void (*buf_done)(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry, int err);
+
+	// stats since streamon
+	u32 sequence; // completions
+	u32 starved; // completions that left the job list empty
+
+	// cumulative stats, see stats.h
+	struct qvio_stats stats;
 };
 
 // object alloc
@@ -51,7 +67,17 @@ void qvio_video_queue_put(struct qvio_video_queue* self);
 // file ops
 __poll_t qvio_video_queue_file_poll(struct qvio_video_queue* self, struct file *filp, struct poll_table_struct *wait);
 long qvio_video_queue_file_ioctl(struct qvio_video_queue* self, struct file * filp, unsigned int cmd, unsigned long arg);
+// QBUF of buf, pts_ns is the CLOCK_MONOTONIC start time for the paced engines, 0 for none
+long qvio_video_queue_file_qbuf(struct qvio_video_queue* self, struct file * filp, struct qvio_buffer* buf, u64 pts_ns);
 
 int qvio_video_queue_done(struct qvio_video_queue* self, struct qvio_buf_entry** next_entry);
 
+// in-kernel ops
+int qvio_video_queue_claim(struct qvio_video_queue* self, void* owner,
+	void (*buf_done)(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry, int err));
+void qvio_video_queue_release(struct qvio_video_queue* self, void* owner);
+int qvio_video_queue_qbuf(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry);
+int qvio_video_queue_streamon(struct qvio_video_queue* self);
+int qvio_video_queue_streamoff(struct qvio_video_queue* self);
+
 #endif // __QVIO_VIDEO_QUEUE_H__
\ No newline at end of file
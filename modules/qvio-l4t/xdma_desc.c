@@ -0,0 +1,309 @@
+#define pr_fmt(fmt)     "[" KBUILD_MODNAME "]%s(#%d): " fmt, __func__, __LINE__
+
+#include <linux/kernel.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/device.h>
+#include <linux/log2.h>
+
+#include "xdma_desc.h"
+#include "buf_entry.h"
+
+static struct xdma_desc_policy* __to_policy(struct device *dev) {
+	struct qvio_cdev* cdev = dev_get_drvdata(dev);
+
+	return cdev->attr_data;
+}
+
+static ssize_t merge_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(self->merge));
+}
+
+static ssize_t merge_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+	u32 value;
+	int err;
+
+	err = kstrtou32(buf, 0, &value);
+	if(err)
+		return err;
+
+	WRITE_ONCE(self->merge, !! value);
+
+	return count;
+}
+
+static ssize_t max_len_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(self->max_len));
+}
+
+static ssize_t max_len_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+	u32 value;
+	int err;
+
+	err = kstrtou32(buf, 0, &value);
+	if(err)
+		return err;
+
+	if(! value || value > XDMA_DESC_BLEN_MAX) {
+		pr_err("unexpected value, max_len=%u\n", value);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(self->max_len, value);
+
+	return count;
+}
+
+static ssize_t boundary_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(self->boundary));
+}
+
+static ssize_t boundary_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+	struct xdma_desc_policy* self = __to_policy(dev);
+	u32 value;
+	int err;
+
+	err = kstrtou32(buf, 0, &value);
+	if(err)
+		return err;
+
+	if(value && ! is_power_of_2(value)) {
+		pr_err("unexpected value, boundary=%u\n", value);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(self->boundary, value);
+
+	return count;
+}
+
+static DEVICE_ATTR(merge, 0644, merge_show, merge_store);
+static DEVICE_ATTR(max_len, 0644, max_len_show, max_len_store);
+static DEVICE_ATTR(boundary, 0644, boundary_show, boundary_store);
+
+static struct attribute *__policy_attrs[] = {
+	&dev_attr_merge.attr,
+	&dev_attr_max_len.attr,
+	&dev_attr_boundary.attr,
+	NULL,
+};
+
+// in the desc_policy/ directory of the device, removed along with the engine's cdev
+static const struct attribute_group __policy_group = {
+	.name = "desc_policy",
+	.attrs = __policy_attrs,
+};
+
+void xdma_desc_policy_init(struct xdma_desc_policy* self) {
+	self->merge = 1;
+	self->max_len = XDMA_DESC_BLEN_MAX;
+	self->boundary = 0;
+}
+
+int xdma_desc_policy_start(struct xdma_desc_policy* self, struct qvio_cdev* cdev) {
+	int err;
+
+	cdev->attr_data = self;
+
+	err = sysfs_create_group(&cdev->device->kobj, &__policy_group);
+	if(err) {
+		pr_err("sysfs_create_group() failed, err=%d\n", err);
+		goto err0;
+	}
+	self->cdev = cdev;
+
+	return 0;
+
+err0:
+	cdev->attr_data = NULL;
+	return err;
+}
+
+void xdma_desc_policy_stop(struct xdma_desc_policy* self) {
+	if(! self->cdev)
+		return;
+
+	// waits for the running show/store, later ones fail
+	sysfs_remove_group(&self->cdev->device->kobj, &__policy_group);
+	self->cdev->attr_data = NULL;
+	self->cdev = NULL;
+}
+
+void xdma_desc_iter_init(struct xdma_desc_iter* self, const struct xdma_desc_policy* policy, struct sg_table* sgt, size_t offset) {
+	self->sg = sgt->sgl;
+	self->nents = sgt->nents;
+	self->sg_offset = offset;
+
+	// the policy may be changed from sysfs at any time, one snapshot per build
+	self->merge = READ_ONCE(policy->merge);
+	self->max_len = READ_ONCE(policy->max_len);
+	self->boundary = READ_ONCE(policy->boundary);
+
+	// skip the sg entries before offset
+	while(self->nents > 0 && self->sg_offset >= sg_dma_len(self->sg)) {
+		self->sg_offset -= sg_dma_len(self->sg);
+		self->sg = sg_next(self->sg);
+		self->nents--;
+	}
+}
+
+size_t xdma_desc_iter_next(struct xdma_desc_iter* self, size_t len, dma_addr_t* addr) {
+	struct scatterlist* sg;
+	size_t seg_len, step;
+	dma_addr_t boundary_addr;
+	int nents;
+
+	if(self->nents <= 0 || ! len)
+		return 0;
+
+	*addr = sg_dma_address(self->sg) + self->sg_offset;
+	seg_len = sg_dma_len(self->sg) - self->sg_offset;
+
+	// following sg entries contiguous in bus address space
+	if(self->merge) {
+		sg = self->sg;
+		nents = self->nents;
+		while(seg_len < len && nents > 1 && sg_dma_address(sg_next(sg)) == *addr + seg_len) {
+			sg = sg_next(sg);
+			nents--;
+			seg_len += sg_dma_len(sg);
+		}
+	}
+
+	seg_len = min(seg_len, len);
+	seg_len = min_t(size_t, seg_len, self->max_len ? self->max_len : XDMA_DESC_BLEN_MAX);
+
+	if(self->boundary) {
+		boundary_addr = round_down(*addr, self->boundary) + self->boundary;
+		if(*addr + seg_len > boundary_addr)
+			seg_len = boundary_addr - *addr;
+	}
+
+	// consume seg_len bytes, possibly over several sg entries
+	len = seg_len;
+	while(len) {
+		step = min_t(size_t, sg_dma_len(self->sg) - self->sg_offset, len);
+		self->sg_offset += step;
+		len -= step;
+
+		if(self->sg_offset >= sg_dma_len(self->sg)) {
+			self->sg = sg_next(self->sg);
+			self->nents--;
+			self->sg_offset = 0;
+		}
+	}
+
+	return seg_len;
+}
+
+int qvio_xdma_desc_build(struct qvio_buf_entry* buf_entry, const struct xdma_desc_policy* policy, struct sg_table* sgt,
+	size_t buffer_size, dma_addr_t card_addr, bool c2h, int stripes) {
+	int err;
+	struct xdma_desc_iter iter;
+	size_t stripe_size;
+	size_t offset, stripe_end;
+	struct dma_block_t* pDmaBlock;
+	struct xdma_desc* pSgdmaDesc;
+	dma_addr_t host_addr;
+	dma_addr_t src_addr;
+	dma_addr_t dst_addr;
+	dma_addr_t nxt_addr;
+	size_t dma_len;
+	int s, i, adj_descs;
+
+	if(! buffer_size) {
+		err = -EINVAL;
+		pr_err("unexpected value, buffer_size=%lu\n", buffer_size);
+		goto err0;
+	}
+
+	stripes = clamp(stripes, 1, QVIO_MAX_STRIPES);
+	stripe_size = ALIGN(DIV_ROUND_UP(buffer_size, stripes), PAGE_SIZE);
+	stripes = DIV_ROUND_UP(buffer_size, stripe_size);
+
+	xdma_desc_iter_init(&iter, policy, sgt, 0);
+	offset = 0;
+	buf_entry->descs = 0;
+
+	for(s = 0;s < stripes;s++) {
+		stripe_end = min(offset + stripe_size, buffer_size);
+
+		pDmaBlock = &buf_entry->desc_blocks[s];
+		err = qvio_dma_block_alloc(pDmaBlock, buf_entry->desc_pool, GFP_KERNEL | GFP_DMA);
+		if(err) {
+			pr_err("qvio_dma_block_alloc() failed, ret=%d\n", err);
+			goto err0;
+		}
+
+		pSgdmaDesc = pDmaBlock->cpu_addr;
+		for(i = 0;offset < stripe_end;i++, pSgdmaDesc++) {
+			if(i >= PAGE_SIZE / sizeof(struct xdma_desc)) {
+				err = -EINVAL;
+				pr_err("unexpected value, stripe %d descs=%d\n", s, i);
+				goto err0;
+			}
+
+			// a sg entry crossing the stripe boundary is split over two chains
+			dma_len = xdma_desc_iter_next(&iter, stripe_end - offset, &host_addr);
+			if(! dma_len) {
+				err = -EINVAL;
+				pr_err("unexpected value, sg list too short, offset=%lu, buffer_size=%lu\n", offset, buffer_size);
+				goto err0;
+			}
+
+			src_addr = c2h ? card_addr + offset : host_addr;
+			dst_addr = c2h ? host_addr : card_addr + offset;
+			nxt_addr = pDmaBlock->dma_handle + ((u8*)(pSgdmaDesc + 1) - (u8*)pDmaBlock->cpu_addr);
+
+			pSgdmaDesc->bytes = cpu_to_le32(dma_len);
+			pSgdmaDesc->src_addr_lo = cpu_to_le32(PCI_DMA_L(src_addr));
+			pSgdmaDesc->src_addr_hi = cpu_to_le32(PCI_DMA_H(src_addr));
+			pSgdmaDesc->dst_addr_lo = cpu_to_le32(PCI_DMA_L(dst_addr));
+			pSgdmaDesc->dst_addr_hi = cpu_to_le32(PCI_DMA_H(dst_addr));
+			pSgdmaDesc->next_lo = cpu_to_le32(PCI_DMA_L(nxt_addr));
+			pSgdmaDesc->next_hi = cpu_to_le32(PCI_DMA_H(nxt_addr));
+
+			offset += dma_len;
+		}
+
+		adj_descs = i - 1;
+		pSgdmaDesc = pDmaBlock->cpu_addr;
+		for(i = 0;i < adj_descs;i++, pSgdmaDesc++) {
+			pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | ((adj_descs - i) << 8));
+		}
+
+		pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | XDMA_DESC_STOPPED | XDMA_DESC_COMPLETED);
+		pSgdmaDesc->next_lo = 0;
+		pSgdmaDesc->next_hi = 0;
+
+#if 0
+		pr_warn("stripe %d: dsc_adr 0x%llx, dsc_adj %u, offset %lu\n", s, pDmaBlock->dma_handle, adj_descs, offset);
+#endif
+
+		dma_sync_single_for_device(buf_entry->dev, pDmaBlock->dma_handle, PAGE_SIZE, DMA_TO_DEVICE);
+
+		buf_entry->stripes[s].dsc_adr = pDmaBlock->dma_handle;
+		buf_entry->stripes[s].dsc_adj = adj_descs;
+		buf_entry->stripes[s].descs = adj_descs + 1;
+		buf_entry->stripes[s].bytes = stripe_end - (s * stripe_size);
+		buf_entry->descs += adj_descs + 1;
+	}
+
+	buf_entry->nstripes = stripes;
+	buf_entry->dsc_adr = buf_entry->stripes[0].dsc_adr;
+	buf_entry->dsc_adj = buf_entry->stripes[0].dsc_adj;
+	buf_entry->bytes = buffer_size;
+
+	return 0;
+
+err0:
+	return err;
+}
@@ -1,6 +1,10 @@
 #ifndef __QVIO_XDMA_DESC_H__
 #define __QVIO_XDMA_DESC_H__
 
+#include <linux/scatterlist.h>
+
+#include "cdev.h"
+
 #define XDMA_DESC_MAGIC 0xAD4B0000UL
 
 /* bits of the SGDMA descriptor control field */
@@ -8,6 +12,18 @@
 #define XDMA_DESC_COMPLETED	(1UL << 1)
 #define XDMA_DESC_EOP		(1UL << 4)
 
+/* the length field of a descriptor is 28 bits wide */
+#define XDMA_DESC_BLEN_MAX	((1UL << 28) - 1)
+
+/* poll mode writeback of a channel, see pollmode_wb_enable */
+#define XDMA_WB_COUNT_MASK	0x00FFFFFFUL
+#define XDMA_WB_ERR_MASK	(1UL << 31)
+
+struct xdma_poll_wb {
+	u32 completed_desc_count;
+	u32 reserved_1[7];
+} __packed;
+
 /* obtain the 32 most significant (high) bits of a 32-bit or 64-bit address */
 #define PCI_DMA_H(addr) ((addr >> 16) >> 16)
 /* obtain the 32 least significant (low) bits of a 32-bit or 64-bit address */
@@ -42,4 +58,51 @@ static inline uint32_t xdma_mkaddr(uint8_t target, uint8_t channel, uint8_t offs
 	return ((uint32_t)(target & 0xF) << 12) | ((uint32_t)(channel & 0xF) << 8) | offset;
 }
 
+struct device;
+struct qvio_buf_entry;
+
+/*
+ * Descriptor segmentation policy of an engine, tunable in
+ * /sys/class/<engine>/<engine>N/desc_policy/:
+ * - merge: one descriptor over bus contiguous sg entries
+ * - max_len: split longer segments, at most XDMA_DESC_BLEN_MAX
+ * - boundary: split at multiples of it of the host address (power of 2,
+ *   e.g. 4096 or the MRRS), 0 for none, so following descriptors start
+ *   aligned for full size TLPs
+ */
+struct xdma_desc_policy {
+	u32 merge;
+	u32 max_len;
+	u32 boundary;
+
+	struct qvio_cdev* cdev; // of the attributes, NULL until started
+};
+
+void xdma_desc_policy_init(struct xdma_desc_policy* self);
+int xdma_desc_policy_start(struct xdma_desc_policy* self, struct qvio_cdev* cdev);
+void xdma_desc_policy_stop(struct xdma_desc_policy* self);
+
+/* walks the host segments of a sg list as cut by a policy */
+struct xdma_desc_iter {
+	struct scatterlist* sg;
+	int nents;
+	size_t sg_offset;
+
+	u32 merge;
+	u32 max_len;
+	u32 boundary;
+};
+
+void xdma_desc_iter_init(struct xdma_desc_iter* self, const struct xdma_desc_policy* policy, struct sg_table* sgt, size_t offset);
+/* next segment of at most len bytes at *addr, 0 at the end of the list */
+size_t xdma_desc_iter_next(struct xdma_desc_iter* self, size_t len, dma_addr_t* addr);
+
+/*
+ * Build the descriptor chains of the first buffer_size bytes of sgt, split in
+ * up to stripes page aligned pieces, one chain per stripe in desc_blocks[i].
+ * card_addr is the AXI address of the frame, c2h selects the direction.
+ */
+int qvio_xdma_desc_build(struct qvio_buf_entry* buf_entry, const struct xdma_desc_policy* policy, struct sg_table* sgt,
+	size_t buffer_size, dma_addr_t card_addr, bool c2h, int stripes);
+
 #endif // __QVIO_XDMA_DESC_H__
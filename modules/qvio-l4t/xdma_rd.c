@@ -4,13 +4,24 @@
 #include <linux/slab.h>
 #include <linux/fs.h>
 #include <linux/delay.h>
+#include <linux/timekeeping.h>
 
 #include "xdma_rd.h"
 #include "uapi/qvio-l4t.h"
 #include "xdma_desc.h"
 #include "utils.h"
+#include "trace.h"
 
 static struct qvio_cdev_class __cdev_class;
+
+static int xdma_rd_channels = 0;
+module_param(xdma_rd_channels, int, 0644);
+MODULE_PARM_DESC(xdma_rd_channels, "H2C channels a frame is striped over, 0 for all of the discovered ones");
+
+static int xdma_rd_poll_us = 0;
+module_param(xdma_rd_poll_us, int, 0644);
+MODULE_PARM_DESC(xdma_rd_poll_us, "poll the H2C completion writeback every N us instead of using the IRQ, 0 to disable");
+
 static const unsigned int __reset_delay = 100;
 
 static void __free(struct kref *ref);
@@ -20,6 +31,12 @@ static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table*
 static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry);
 static int __streamon(struct qvio_video_queue* self);
 static int __streamoff(struct qvio_video_queue* self);
+static u32 __service(struct qvio_xdma_rd* self, int irq);
+static enum hrtimer_restart __poll_timer(struct hrtimer* timer);
+static int __selftest_build(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf);
+static void __selftest_start(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf);
+static int __selftest_poll(struct qvio_selftest_engine* engine);
+static void __selftest_stop(struct qvio_selftest_engine* engine);
 
 static const struct file_operations __fops = {
 	.owner = THIS_MODULE,
@@ -64,6 +81,15 @@ struct qvio_xdma_rd* qvio_xdma_rd_new(void) {
 	}
 
 	kref_init(&self->ref);
+	xdma_desc_policy_init(&self->desc_policy);
+	self->channels = 1;
+	self->irq_bit = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&self->poll_timer, __poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&self->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	self->poll_timer.function = __poll_timer;
+#endif
 
 	self->video_queue = qvio_video_queue_new();
 	if(! self->video_queue) {
@@ -120,16 +146,48 @@ int qvio_xdma_rd_probe(struct qvio_xdma_rd* self) {
 		goto err0;
 	}
 
+	err = qvio_dma_block_alloc(&self->wb_block, self->desc_pool, GFP_KERNEL | GFP_DMA);
+	if(err) {
+		pr_err("qvio_dma_block_alloc() failed, err=%d\n", err);
+		goto err1;
+	}
+	memset(self->wb_block.cpu_addr, 0, PAGE_SIZE);
+
 	self->cdev.fops = &__fops;
 	self->cdev.private_data = self;
 	err = qvio_cdev_start(&self->cdev, &__cdev_class);
 	if(err) {
 		pr_err("qvio_cdev_start() failed, err=%d\n", err);
-		goto err1;
+		goto err2;
+	}
+
+	err = xdma_desc_policy_start(&self->desc_policy, &self->cdev);
+	if(err) {
+		pr_err("xdma_desc_policy_start() failed, err=%d\n", err);
+		goto err3;
 	}
 
+	snprintf(self->video_queue->name, sizeof(self->video_queue->name), "xdma_rd%d", MINOR(self->cdev.cdevno));
+	qvio_stats_start(&self->video_queue->stats, self->video_queue->name);
+
+	self->selftest.name = self->video_queue->name;
+	self->selftest.dev = self->dev;
+	self->selftest.dir = DMA_TO_DEVICE;
+	self->selftest.video_queue = self->video_queue;
+	self->selftest.desc_pool = self->desc_pool;
+	self->selftest.parent = self;
+	self->selftest.build = __selftest_build;
+	self->selftest.start = __selftest_start;
+	self->selftest.poll = __selftest_poll;
+	self->selftest.stop = __selftest_stop;
+	qvio_selftest_add(&self->selftest);
+
 	return 0;
 
+err3:
+	qvio_cdev_stop(&self->cdev, &__cdev_class);
+err2:
+	qvio_dma_block_free(&self->wb_block, self->desc_pool);
 err1:
 	dma_pool_destroy(self->desc_pool);
 err0:
@@ -137,7 +195,11 @@ err0:
 }
 
 void qvio_xdma_rd_remove(struct qvio_xdma_rd* self) {
+	qvio_selftest_del(&self->selftest);
+	qvio_stats_stop(&self->video_queue->stats);
+	xdma_desc_policy_stop(&self->desc_policy);
 	qvio_cdev_stop(&self->cdev, &__cdev_class);
+	qvio_dma_block_free(&self->wb_block, self->desc_pool);
 	dma_pool_destroy(self->desc_pool);
 }
 
@@ -169,30 +231,12 @@ static __poll_t __file_poll(struct file *filp, struct poll_table_struct *wait) {
 static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table* sgt, struct qvio_buffer* buf, struct qvio_buf_entry* buf_entry) {
 	int err;
 	struct qvio_xdma_rd* xdma_rd = self->parent;
-	struct scatterlist* sg;
-	int nents;
 	size_t buffer_size;
-	struct dma_block_t* pDmaBlock;
-	struct xdma_desc* pSgdmaDesc;
-	dma_addr_t src_addr;
-	dma_addr_t dst_addr;
-	dma_addr_t nxt_addr;
-	ssize_t dma_len;
-	ssize_t sg_bytes;
-	int i, adj_descs;
+	int stripes;
 
 	buf_entry->dev = xdma_rd->dev;
 	buf_entry->desc_pool = xdma_rd->desc_pool;
 
-	sg = sgt->sgl;
-	nents = sgt->nents;
-
-	if(nents >= PAGE_SIZE / sizeof(struct xdma_desc)) {
-		err = -EINVAL;
-		pr_err("unexpected value, nents=%d\n", nents);
-		goto err0;
-	}
-
 	err = utils_calc_buf_size(&self->format, buf->offset, buf->stride, &buffer_size);
 	if(err < 0) {
 		pr_err("utils_calc_buf_size() failed, err=%d\n", err);
@@ -202,112 +246,103 @@ static int __buf_entry_from_sgt(struct qvio_video_queue* self, struct sg_table*
 	pr_info("buffer_size=%lu\n", buffer_size);
 #endif
 
-	pDmaBlock = &buf_entry->desc_blocks[0];
-	err = qvio_dma_block_alloc(pDmaBlock, buf_entry->desc_pool, GFP_KERNEL | GFP_DMA);
+	stripes = xdma_rd->channels;
+	if(xdma_rd_channels > 0 && xdma_rd_channels < stripes)
+		stripes = xdma_rd_channels;
+
+	err = qvio_xdma_desc_build(buf_entry, &xdma_rd->desc_policy, sgt, buffer_size, 0xA0000000, false, stripes);
 	if(err) {
-		pr_err("qvio_dma_block_alloc() failed, ret=%d\n", err);
+		pr_err("qvio_xdma_desc_build() failed, err=%d\n", err);
 		goto err0;
 	}
 
-	pSgdmaDesc = pDmaBlock->cpu_addr;
-	dst_addr = 0xA0000000;
-	sg_bytes = 0;
-	for (i = 0; i < nents; i++, sg = sg_next(sg)) {
-		src_addr = sg_dma_address(sg);
-		dma_len = sg_dma_len(sg);
-		nxt_addr = pDmaBlock->dma_handle + ((u8*)(pSgdmaDesc + 1) - (u8*)pDmaBlock->cpu_addr);
-
-		pSgdmaDesc->src_addr_lo = cpu_to_le32(PCI_DMA_L(src_addr));
-		pSgdmaDesc->src_addr_hi = cpu_to_le32(PCI_DMA_H(src_addr));
-		pSgdmaDesc->dst_addr_lo = cpu_to_le32(PCI_DMA_L(dst_addr));
-		pSgdmaDesc->dst_addr_hi = cpu_to_le32(PCI_DMA_H(dst_addr));
-		pSgdmaDesc->next_lo = cpu_to_le32(PCI_DMA_L(nxt_addr));
-		pSgdmaDesc->next_hi = cpu_to_le32(PCI_DMA_H(nxt_addr));
-
-		sg_bytes += dma_len;
-		dst_addr += dma_len;
+	trace_qvio_build_descs(self, buf_entry, buf_entry->descs, buf_entry->nstripes, buf_entry->bytes);
 
-#if 0
-		pr_info("%d: dma_len=%lu, sg_bytes=%lu\n", i, dma_len, sg_bytes);
-#endif
+	return 0;
 
-		if(sg_bytes >= buffer_size) {
-			pSgdmaDesc->bytes = cpu_to_le32(dma_len - (sg_bytes - buffer_size));
-			pSgdmaDesc->next_lo = 0;
-			pSgdmaDesc->next_hi = 0;
-			adj_descs = i;
-			break;
-		}
+err0:
+	return err;
+}
 
-		pSgdmaDesc->bytes = cpu_to_le32(dma_len);
+// start every stripe of buf_entry on its own channel, the frame is done when all of them are
+static void __start_stripes(struct qvio_xdma_rd* self, struct qvio_buf_entry* buf_entry) {
+	uintptr_t irq_block = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x2, 0, 0));
+	uintptr_t h2c_channel;
+	uintptr_t h2c_sgdma;
+	struct xdma_poll_wb* wb = self->wb_block.cpu_addr;
+	int i;
 
-		pSgdmaDesc++;
-	}
+	for(i = 0;i < buf_entry->nstripes;i++) {
+		h2c_sgdma = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x4, self->channel + i, 0));
 
-	pSgdmaDesc = pDmaBlock->cpu_addr;
-	for(i = 0;i < adj_descs;i++, pSgdmaDesc++) {
-#if 0
-		pr_warn("%d: bytes %u, src_addr 0x%llx, dst_addr 0x%llx, nxt_addr 0x%llx, Nxt_adj %d\n",
-			i, le32_to_cpu(pSgdmaDesc->bytes),
-			((u64)(le32_to_cpu(pSgdmaDesc->src_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->src_addr_lo),
-			((u64)(le32_to_cpu(pSgdmaDesc->dst_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->dst_addr_lo),
-			((u64)(le32_to_cpu(pSgdmaDesc->next_hi)) << 32) | le32_to_cpu(pSgdmaDesc->next_lo),
-			adj_descs - i);
-#endif
+		io_write_reg(h2c_sgdma, 0x80, cpu_to_le32(PCI_DMA_L(buf_entry->stripes[i].dsc_adr)));
+		io_write_reg(h2c_sgdma, 0x84, cpu_to_le32(PCI_DMA_H(buf_entry->stripes[i].dsc_adr)));
+		io_write_reg(h2c_sgdma, 0x88, buf_entry->stripes[i].dsc_adj);
 
-		pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | ((adj_descs - i) << 8));
+		self->stripe_descs[i] = buf_entry->stripes[i].descs;
+		WRITE_ONCE(wb[i].completed_desc_count, 0);
 	}
 
-#if 0
-	pr_warn("%d: bytes %u, src_addr 0x%llx, dst_addr 0x%llx, nxt_addr 0x%llx, Nxt_adj %d\n",
-		i, le32_to_cpu(pSgdmaDesc->bytes),
-		((u64)(le32_to_cpu(pSgdmaDesc->src_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->src_addr_lo),
-		((u64)(le32_to_cpu(pSgdmaDesc->dst_addr_hi)) << 32) | le32_to_cpu(pSgdmaDesc->dst_addr_lo),
-		((u64)(le32_to_cpu(pSgdmaDesc->next_hi)) << 32) | le32_to_cpu(pSgdmaDesc->next_lo),
-		adj_descs - i);
-#endif
+	// stripe_descs[] and the writeback reset before irq_pending, see __service()
+	smp_wmb();
+	WRITE_ONCE(self->irq_pending, GENMASK(self->irq_bit + buf_entry->nstripes - 1, self->irq_bit));
+	if(! self->poll_us)
+		io_write_reg(irq_block, 0x14, self->irq_pending); // W1S channel_int_enmask
+	buf_entry->start_ns = ktime_get_ns();
+	for(i = 0;i < buf_entry->nstripes;i++) {
+		h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel + i, 0));
 
-	pSgdmaDesc->control = cpu_to_le32(XDMA_DESC_MAGIC | XDMA_DESC_STOPPED | XDMA_DESC_COMPLETED);
-
-	buf_entry->dsc_adr = pDmaBlock->dma_handle;
-	buf_entry->dsc_adj = adj_descs;
-#if 0
-	pr_warn("---- dsc_adr 0x%llx, dsc_adj %u\n", buf_entry->dsc_adr, buf_entry->dsc_adj);
-#endif
-
-	dma_sync_single_for_device(buf_entry->dev, pDmaBlock->dma_handle, PAGE_SIZE, DMA_TO_DEVICE);
-
-	return 0;
-
-err0:
-	return err;
+		io_write_reg(h2c_channel, 0x04, BIT(0) | BIT(1) | BIT(2) | BIT(26) | BIT(27)); // Run & ie_descriptor_stopped & im_descriptor_completd & pollmode_wb_enable & disable_writeback
+	}
 }
 
 static int __start_buf_entry(struct qvio_video_queue* self, struct qvio_buf_entry* buf_entry) {
 	struct qvio_xdma_rd* xdma_rd = self->parent;
-	uintptr_t h2c_channel = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x0, xdma_rd->channel, 0));
-	uintptr_t h2c_sgdma = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x4, xdma_rd->channel, 0));
-	u32 value;
 
 #if 1
-	io_write_reg(h2c_sgdma, 0x80, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
-	io_write_reg(h2c_sgdma, 0x84, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
-	io_write_reg(h2c_sgdma, 0x88, buf_entry->dsc_adj);
-	io_write_reg(h2c_channel, 0x04, BIT(0) | BIT(1) | BIT(2) | BIT(27)); // Run & ie_descriptor_stopped & im_descriptor_completd & disable_writeback
+	__start_stripes(xdma_rd, buf_entry);
+	trace_qvio_ap_start(self, buf_entry, self->sequence);
 #endif
-	pr_info("XDMA H2C started... dsc_adr 0x%llx, dsc_adj %u\n", buf_entry->dsc_adr, buf_entry->dsc_adj);
+	pr_debug("XDMA H2C started... dsc_adr 0x%llx, dsc_adj %u, nstripes %d\n", buf_entry->dsc_adr, buf_entry->dsc_adj, buf_entry->nstripes);
 
 	return 0;
 }
 
+static enum hrtimer_restart __poll_timer(struct hrtimer* timer) {
+	struct qvio_xdma_rd* self = container_of(timer, struct qvio_xdma_rd, poll_timer);
+
+	__service(self, 0);
+	hrtimer_forward_now(timer, ns_to_ktime((u64)self->poll_us * NSEC_PER_USEC));
+
+	return HRTIMER_RESTART;
+}
+
 static int __streamon(struct qvio_video_queue* self) {
 	struct qvio_xdma_rd* xdma_rd = self->parent;
-	uintptr_t irq_block = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x2, xdma_rd->channel, 0));
-	uintptr_t h2c_channel = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x0, xdma_rd->channel, 0));
-	u32 value;
+	uintptr_t irq_block = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x2, 0, 0));
+	uintptr_t h2c_channel;
+	dma_addr_t wb_addr;
+	int i;
 
-	io_write_reg(h2c_channel, 0x90, BIT(1) | BIT(2)); // im_descriptor_stopped & im_descriptor_completd
-	io_write_reg(irq_block, 0x10, BIT(0)); // W1S channel_int_enmask[0]
+	xdma_rd->poll_us = max(xdma_rd_poll_us, 0);
+	xdma_rd->irq_pending = 0;
+
+	for(i = 0;i < xdma_rd->channels;i++) {
+		h2c_channel = (uintptr_t)((u64)xdma_rd->reg + xdma_mkaddr(0x0, xdma_rd->channel + i, 0));
+		wb_addr = xdma_rd->wb_block.dma_handle + i * sizeof(struct xdma_poll_wb);
+
+		io_write_reg(h2c_channel, 0x88, cpu_to_le32(PCI_DMA_L(wb_addr))); // Poll Mode Low Write Back Address
+		io_write_reg(h2c_channel, 0x8C, cpu_to_le32(PCI_DMA_H(wb_addr))); // Poll Mode High Write Back Address
+		io_write_reg(h2c_channel, 0x90, BIT(1) | BIT(2)); // im_descriptor_stopped & im_descriptor_completd
+	}
+
+	if(xdma_rd->poll_us) {
+		pr_info("H2C completion polling every %dus\n", xdma_rd->poll_us);
+		io_write_reg(irq_block, 0x18, GENMASK(xdma_rd->irq_bit + xdma_rd->channels - 1, xdma_rd->irq_bit)); // W1C channel_int_enmask
+		hrtimer_start(&xdma_rd->poll_timer, ns_to_ktime((u64)xdma_rd->poll_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	} else {
+		io_write_reg(irq_block, 0x14, GENMASK(xdma_rd->irq_bit + xdma_rd->channels - 1, xdma_rd->irq_bit)); // W1S channel_int_enmask
+	}
 
 	return 0;
 }
@@ -315,42 +350,62 @@ static int __streamon(struct qvio_video_queue* self) {
 static int __streamoff(struct qvio_video_queue* self) {
 	struct qvio_xdma_rd* xdma_rd = self->parent;
 
+	if(xdma_rd->poll_us)
+		hrtimer_cancel(&xdma_rd->poll_timer);
+
 	pr_info("TODO\n");
 
 	return 0;
 }
 
-irqreturn_t qvio_xdma_rd_irq_handler(int irq, void *dev_id) {
+/*
+ * Complete the stripes whose completed descriptor count has been written back,
+ * returns their channel_int bits. No MMIO read, the writeback is ordered before
+ * the MSI of the channel.
+ */
+static u32 __service(struct qvio_xdma_rd* self, int irq) {
 	int err;
-	struct qvio_xdma_rd* self = dev_id;
-	uintptr_t irq_block = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x2, self->channel, 0));
-	uintptr_t h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel, 0));
-	uintptr_t h2c_sgdma = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x4, self->channel, 0));
-	u32 engine_int_req, engine_int_pend;
-	u32 compl_descriptor_count;
-	u32 Status;
+	uintptr_t h2c_channel;
+	struct xdma_poll_wb* wb = self->wb_block.cpu_addr;
+	u32 channel_int;
+	u32 irq_pending;
 	u32 value;
 	struct qvio_buf_entry* buf_entry;
+	int i;
 
-#if 0
-	pr_info("XDMA, IRQ[%d]: irq_counter=%d\n", irq, self->irq_counter);
-	self->irq_counter++;
-#endif
+	// the poll timer may run on another CPU than the one starting the frame
+	irq_pending = READ_ONCE(self->irq_pending);
+	smp_rmb();
 
-	engine_int_req = io_read_reg(irq_block, 0x44);
-	// engine_int_pend = io_read_reg(irq_block, 0x4C);
-	compl_descriptor_count = io_read_reg(h2c_channel, 0x48);
+	channel_int = 0;
+	for(i = 0;i < self->channels;i++) {
+		if(! (irq_pending & BIT(self->irq_bit + i)))
+			continue;
 
-	// pr_info("engine_int_req=0x%X engine_int_pend=0x%X\n", engine_int_req, engine_int_pend);
-	if(! (engine_int_req & BIT(0))) { // H2C engine_int_req[0]
-		return IRQ_NONE;
+		value = le32_to_cpu(READ_ONCE(wb[i].completed_desc_count));
+		if(! (value & XDMA_WB_ERR_MASK) && (value & XDMA_WB_COUNT_MASK) < self->stripe_descs[i])
+			continue;
+
+		if(value & XDMA_WB_ERR_MASK)
+			pr_err("H2C channel %d error, completed_desc_count=0x%X\n", self->channel + i, value);
+
+		h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel + i, 0));
+		io_write_reg(h2c_channel, 0x04, 0); // Stop
+		io_write_reg(h2c_channel, 0x40, BIT(1) | BIT(2)); // W1C descriptor_stopped & descriptor_completed
+		trace_qvio_irq(self->video_queue, irq, value, NULL);
+
+		channel_int |= BIT(self->irq_bit + i);
 	}
 
-	io_write_reg(irq_block, 0x18, BIT(0)); // W1C channel_int_enmask[0]
-	Status = io_read_reg(h2c_channel, 0x44); // engine_int_req
-	// pr_info("Engine Interrupt H2C, Status=%d\n", Status);
+	if(! channel_int)
+		return 0;
 
-	io_write_reg(h2c_channel, 0x04, 0); // Stop
+	irq_pending &= ~channel_int;
+	WRITE_ONCE(self->irq_pending, irq_pending);
+	if(irq_pending) {
+		// wait for the other stripes of the frame
+		goto err0;
+	}
 
 	err = qvio_video_queue_done(self->video_queue, &buf_entry);
 	if(err) {
@@ -365,14 +420,35 @@ irqreturn_t qvio_xdma_rd_irq_handler(int irq, void *dev_id) {
 
 #if 1
 	// try to do another job
-	io_write_reg(irq_block, 0x14, BIT(0)); // W1S channel_int_enmask[0]
-	io_write_reg(h2c_sgdma, 0x80, cpu_to_le32(PCI_DMA_L(buf_entry->dsc_adr)));
-	io_write_reg(h2c_sgdma, 0x84, cpu_to_le32(PCI_DMA_H(buf_entry->dsc_adr)));
-	io_write_reg(h2c_sgdma, 0x88, buf_entry->dsc_adj);
-	io_write_reg(h2c_channel, 0x04, BIT(0) | BIT(1) | BIT(2) | BIT(27)); // Run & ie_descriptor_stopped & im_descriptor_completd & disable_writeback
+	__start_stripes(self, buf_entry);
+	trace_qvio_ap_start(self->video_queue, buf_entry, self->video_queue->sequence);
 #endif
 
 err0:
+	return channel_int;
+}
+
+irqreturn_t qvio_xdma_rd_irq_handler(int irq, void *dev_id) {
+	struct qvio_xdma_rd* self = dev_id;
+	uintptr_t irq_block = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x2, 0, 0));
+	u32 channel_int;
+
+#if 0
+	pr_info("XDMA, IRQ[%d]: irq_counter=%d\n", irq, self->irq_counter);
+	self->irq_counter++;
+#endif
+
+	if(self->poll_us)
+		return IRQ_NONE;
+
+	channel_int = __service(self, irq);
+	if(! channel_int) {
+		return IRQ_NONE;
+	}
+
+	io_write_reg(irq_block, 0x18, channel_int); // W1C channel_int_enmask
+	atomic64_inc(&self->video_queue->stats.irqs);
+
 	return IRQ_HANDLED;
 }
 
@@ -432,4 +508,50 @@ int qvio_xdma_rd_test_case_0(struct qvio_xdma_rd* self, struct dma_block_t* dma_
 	io_write_reg(h2c_channel, 0x04, 0);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+static int __selftest_build(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf) {
+	struct qvio_xdma_rd* self = engine->parent;
+
+	// a single chain on the first channel
+	return qvio_xdma_desc_build(buf->buf_entry, &self->desc_policy, &buf->sgt, buf->bytes, 0xA0000000, false, 1);
+}
+
+static void __selftest_start(struct qvio_selftest_engine* engine, struct qvio_selftest_buf* buf) {
+	struct qvio_xdma_rd* self = engine->parent;
+	uintptr_t h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel, 0));
+	uintptr_t h2c_sgdma = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x4, self->channel, 0));
+
+	engine->descs = buf->buf_entry->stripes[0].descs;
+
+	io_write_reg(h2c_channel, 0x04, 0);
+	io_read_reg(h2c_channel, 0x44); // RC status
+	io_write_reg(h2c_sgdma, 0x80, cpu_to_le32(PCI_DMA_L(buf->buf_entry->dsc_adr)));
+	io_write_reg(h2c_sgdma, 0x84, cpu_to_le32(PCI_DMA_H(buf->buf_entry->dsc_adr)));
+	io_write_reg(h2c_sgdma, 0x88, buf->buf_entry->dsc_adj);
+
+	// Run without any interrupt, the completed descriptor count is polled
+	io_write_reg(h2c_channel, 0x04, BIT(0));
+}
+
+static int __selftest_poll(struct qvio_selftest_engine* engine) {
+	struct qvio_xdma_rd* self = engine->parent;
+	uintptr_t h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel, 0));
+	u32 status;
+
+	status = io_read_reg(h2c_channel, 0x40);
+	if(status & ~(BIT(0) | BIT(1) | BIT(2))) {
+		pr_err("H2C channel %d error, status=0x%X\n", self->channel, status);
+		return -EIO;
+	}
+
+	return io_read_reg(h2c_channel, 0x48) >= engine->descs;
+}
+
+static void __selftest_stop(struct qvio_selftest_engine* engine) {
+	struct qvio_xdma_rd* self = engine->parent;
+	uintptr_t h2c_channel = (uintptr_t)((u64)self->reg + xdma_mkaddr(0x0, self->channel, 0));
+
+	io_write_reg(h2c_channel, 0x04, 0); // Stop
+	io_read_reg(h2c_channel, 0x44); // RC status
+}
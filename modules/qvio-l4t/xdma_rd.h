@@ -3,10 +3,13 @@
 
 #include <linux/platform_device.h>
 #include <linux/irqreturn.h>
+#include <linux/hrtimer.h>
 
 #include "cdev.h"
 #include "video_queue.h"
 #include "dma_block.h"
+#include "xdma_desc.h"
+#include "selftest.h"
 
 struct qvio_xdma_rd {
 	struct kref ref;
@@ -17,6 +20,15 @@ struct qvio_xdma_rd {
 
 	void __iomem * reg;
 	int channel;
+	int channels; // H2C channels from channel on, a frame is striped over them
+	int irq_bit; // channel_int bit of channel, the C2H bits follow the H2C ones
+	u32 irq_pending; // channel_int bits of the stripes still running
+	u32 stripe_descs[QVIO_MAX_STRIPES]; // descriptors of the running stripes
+	struct dma_block_t wb_block; // struct xdma_poll_wb of each channel
+	int poll_us; // completion polling period, 0 for the IRQ
+	struct hrtimer poll_timer;
+	struct xdma_desc_policy desc_policy;
+	struct qvio_selftest_engine selftest;
 	struct mutex* mutex_irq_block;
 	struct qvio_video_queue* video_queue;
 	int irq_counter;
@@ -4,6 +4,8 @@
 #include <linux/slab.h>
 #include <linux/fs.h>
 #include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/math64.h>
 
 #include "zdev.h"
 #include "uapi/qvio-l4t.h"
@@ -11,14 +13,22 @@
 
 static struct qvio_cdev_class __cdev_class;
 
+static int zdev_clock_period_ms = 1000;
+module_param(zdev_clock_period_ms, int, 0644);
+MODULE_PARM_DESC(zdev_clock_period_ms, "period of the ticks clock samples, under half a wrap of the ticks counter");
+
 static void __device_free(struct kref *ref);
 static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg);
 static long __file_ioctl_g_ticks(struct file * filp, unsigned long arg);
+static long __file_ioctl_g_clock(struct file * filp, unsigned long arg);
+static int __file_mmap(struct file *filp, struct vm_area_struct *vma);
+static void __clock_work(struct work_struct *work);
 
 static const struct file_operations __fops = {
 	.owner = THIS_MODULE,
 	.open = qvio_cdev_open,
 	.release = qvio_cdev_release,
+	.mmap = __file_mmap,
 	.llseek = noop_llseek,
 	.unlocked_ioctl = __file_ioctl,
 };
@@ -58,9 +68,20 @@ struct qvio_zdev* qvio_zdev_new(void) {
 
 	kref_init(&self->ref);
 	mutex_init(&self->mutex_reg);
+	seqlock_init(&self->clock_lock);
+	INIT_DELAYED_WORK(&self->clock_work, __clock_work);
+
+	self->clock_page = (struct qvio_ticks_clock*)get_zeroed_page(GFP_KERNEL);
+	if(! self->clock_page) {
+		pr_err("get_zeroed_page() failed\n");
+		err = -ENOMEM;
+		goto err1;
+	}
 
 	return self;
 
+err1:
+	kfree(self);
 err0:
 	return NULL;
 }
@@ -77,6 +98,8 @@ static void __device_free(struct kref *ref) {
 
 	// pr_info("\n");
 
+	// still mapped pages are freed at munmap()
+	free_page((unsigned long)self->clock_page);
 	kfree(self);
 }
 
@@ -96,6 +119,8 @@ int qvio_zdev_probe(struct qvio_zdev* self) {
 		goto err0;
 	}
 
+	schedule_delayed_work(&self->clock_work, 0);
+
 	return 0;
 
 err0:
@@ -103,9 +128,168 @@ err0:
 }
 
 void qvio_zdev_remove(struct qvio_zdev* self) {
+	cancel_delayed_work_sync(&self->clock_work);
 	qvio_cdev_stop(&self->cdev, &__cdev_class);
 }
 
+static u64 __ticks_to_ns(const struct qvio_ticks_clock* clock, u64 ticks) {
+	s64 delta = ticks - clock->base_ticks;
+
+	if(delta >= 0)
+		return clock->base_ns + mul_u64_u32_shr(delta, clock->mult, clock->shift);
+
+	return clock->base_ns - mul_u64_u32_shr(-delta, clock->mult, clock->shift);
+}
+
+static u64 __ns_to_ticks(const struct qvio_ticks_clock* clock, u64 ns) {
+	s64 delta = ns - clock->base_ns;
+
+	if(delta >= 0)
+		return clock->base_ticks + mul_u64_u32_shr(delta, clock->inv_mult, clock->inv_shift);
+
+	return clock->base_ticks - mul_u64_u32_shr(-delta, clock->inv_mult, clock->inv_shift);
+}
+
+// raw ticks read at now_ns to 64 bits, around the predicted ticks once the rate is known
+static u64 __extend(const struct qvio_ticks_clock* clock, u64 now_ns, u32 ticks) {
+	u64 ref;
+
+	if(! (clock->flags & QVIO_TICKS_CLOCK_VALID))
+		return clock->base_ticks + (u32)(ticks - (u32)clock->base_ticks);
+
+	ref = __ns_to_ticks(clock, now_ns);
+
+	return ref + (s32)(ticks - (u32)ref);
+}
+
+static void __read_clock(struct qvio_zdev* self, struct qvio_ticks_clock* clock) {
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&self->clock_lock);
+		*clock = self->clock;
+	} while(read_seqretry(&self->clock_lock, seq));
+}
+
+// num / den as mult >> shift, with mult on 32 bits
+static int __calc_mult_shift(u64 num, u64 den, u32* mult, u32* shift) {
+	int sft;
+
+	sft = 32 - fls64(div64_u64(num, den));
+	if(sft <= 0)
+		return -ERANGE;
+
+	while(num >> (64 - sft)) {
+		num >>= 1;
+		den >>= 1;
+	}
+
+	*mult = (u32)div64_u64(num << sft, den);
+	*shift = sft;
+
+	return 0;
+}
+
+// the best of a few reads, CLOCK_MONOTONIC at the middle of the round trip
+static void __clock_sample(struct qvio_zdev* self, u32* ticks, u64* ns, u32* rtt_ns) {
+	uintptr_t reg = (uintptr_t)self->reg;
+	unsigned long flags;
+	u64 t0, t1;
+	u32 value;
+	int i;
+
+	*rtt_ns = U32_MAX;
+	for(i = 0;i < 4;i++) {
+		local_irq_save(flags);
+		t0 = ktime_get_ns();
+		value = io_read_reg(reg, 0x0C);
+		t1 = ktime_get_ns();
+		local_irq_restore(flags);
+
+		if(t1 - t0 < *rtt_ns) {
+			*rtt_ns = (u32)(t1 - t0);
+			*ticks = value;
+			*ns = t0 + (t1 - t0) / 2;
+		}
+	}
+}
+
+// the page is read by user space under seq, see qvio_ticks_clock
+static void __clock_publish(struct qvio_ticks_clock* page, const struct qvio_ticks_clock* clock) {
+	struct qvio_ticks_clock tmp = *clock;
+	u32 seq = page->seq;
+
+	tmp.seq = seq + 1;
+
+	WRITE_ONCE(page->seq, seq + 1);
+	smp_wmb();
+	*page = tmp;
+	smp_wmb();
+	WRITE_ONCE(page->seq, seq + 2);
+}
+
+static void __clock_work(struct work_struct *work) {
+	struct qvio_zdev* self = container_of(to_delayed_work(work), struct qvio_zdev, clock_work);
+	struct qvio_ticks_clock clock;
+	unsigned long flags;
+	u32 raw, rtt_ns;
+	u32 mult, shift, inv_mult, inv_shift;
+	u64 ticks, ns, dticks, dns;
+	int oldest;
+
+	__clock_sample(self, &raw, &ns, &rtt_ns);
+
+	// the only writer
+	clock = self->clock;
+	ticks = __extend(&clock, ns, raw);
+
+	if(clock.flags & QVIO_TICKS_CLOCK_VALID)
+		clock.error_ns = (s32)clamp_t(s64, (s64)(ns - __ticks_to_ns(&clock, ticks)), S32_MIN, S32_MAX);
+
+	// rate from the oldest to the newest sample of the window
+	self->win_ticks[self->win_count % QVIO_ZDEV_CLOCK_WINDOW] = ticks;
+	self->win_ns[self->win_count % QVIO_ZDEV_CLOCK_WINDOW] = ns;
+	self->win_count++;
+	if(self->win_count >= 2) {
+		oldest = self->win_count > QVIO_ZDEV_CLOCK_WINDOW ? self->win_count % QVIO_ZDEV_CLOCK_WINDOW : 0;
+		dticks = ticks - self->win_ticks[oldest];
+		dns = ns - self->win_ns[oldest];
+
+		if(! dticks || ! dns ||
+			__calc_mult_shift(dns, dticks, &mult, &shift) ||
+			__calc_mult_shift(dticks, dns, &inv_mult, &inv_shift)) {
+			pr_warn_ratelimited("unexpected value, dticks=%llu, dns=%llu\n", dticks, dns);
+		} else {
+			clock.mult = mult;
+			clock.shift = shift;
+			clock.inv_mult = inv_mult;
+			clock.inv_shift = inv_shift;
+			clock.freq_hz = (u32)min_t(u64, mul_u64_u32_shr(NSEC_PER_SEC, inv_mult, inv_shift), U32_MAX);
+			clock.flags |= QVIO_TICKS_CLOCK_VALID;
+		}
+	}
+
+	clock.base_ticks = ticks;
+	clock.base_ns = ns;
+	clock.rtt_ns = rtt_ns;
+	clock.samples++;
+
+	write_seqlock_irqsave(&self->clock_lock, flags);
+	self->clock = clock;
+	write_sequnlock_irqrestore(&self->clock_lock, flags);
+
+	__clock_publish(self->clock_page, &clock);
+
+#if 0
+	pr_info("ticks=%llu, ns=%llu, freq_hz=%u, error_ns=%d, rtt_ns=%u\n",
+		clock.base_ticks, clock.base_ns, clock.freq_hz, clock.error_ns, clock.rtt_ns);
+#endif
+
+	// a quick second sample for a first estimate of the rate
+	schedule_delayed_work(&self->clock_work,
+		msecs_to_jiffies(self->win_count < 2 ? 10 : max(zdev_clock_period_ms, 10)));
+}
+
 ssize_t qvio_zdev_attr_ver_show(struct qvio_zdev* self, char *buf) {
 	ssize_t ret;
 	uintptr_t reg = (uintptr_t)self->reg;
@@ -132,6 +316,16 @@ ssize_t qvio_zdev_attr_ticks_show(struct qvio_zdev* self, char *buf) {
 	return ret;
 }
 
+ssize_t qvio_zdev_attr_clock_show(struct qvio_zdev* self, char *buf) {
+	struct qvio_ticks_clock clock;
+
+	__read_clock(self, &clock);
+
+	return snprintf(buf, PAGE_SIZE, "valid %d\nticks %llu\nfreq_hz %u\nerror_ns %d\nrtt_ns %u\nsamples %u\n",
+		!! (clock.flags & QVIO_TICKS_CLOCK_VALID), __extend(&clock, ktime_get_ns(), qvio_zdev_ticks(self)),
+		clock.freq_hz, clock.error_ns, clock.rtt_ns, clock.samples);
+}
+
 ssize_t qvio_zdev_attr_value0_show(struct qvio_zdev* self, char *buf) {
 	ssize_t ret;
 	uintptr_t reg = (uintptr_t)self->reg;
@@ -159,6 +353,10 @@ static long __file_ioctl(struct file * filp, unsigned int cmd, unsigned long arg
 		ret = __file_ioctl_g_ticks(filp, arg);
 		break;
 
+	case QVIO_IOC_G_CLOCK:
+		ret = __file_ioctl_g_clock(filp, arg);
+		break;
+
 	default:
 		pr_err("unexpected, cmd=%d\n", cmd);
 		ret = -EINVAL;
@@ -190,6 +388,63 @@ err0:
 	return ret;
 }
 
+static long __file_ioctl_g_clock(struct file * filp, unsigned long arg) {
+	long ret;
+	struct qvio_zdev* self = filp->private_data;
+	struct qvio_ticks_clock args;
+
+	__read_clock(self, &args);
+	args.seq = 0;
+
+	ret = copy_to_user((void __user *)arg, &args, sizeof(args));
+	if (ret != 0) {
+		pr_err("copy_to_user() failed, err=%d\n", (int)ret);
+
+		ret = -EFAULT;
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return ret;
+}
+
+static int __file_mmap(struct file *filp, struct vm_area_struct *vma) {
+	int err;
+	struct qvio_zdev* self = filp->private_data;
+
+	if(vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE) {
+		pr_err("unexpected value, vma->vm_pgoff=%lu, size=%lu\n", vma->vm_pgoff, vma->vm_end - vma->vm_start);
+		err = -EINVAL;
+		goto err0;
+	}
+
+	// read-only, the driver is the only writer
+	if(vma->vm_flags & VM_WRITE) {
+		pr_err("unexpected value, vma->vm_flags=0x%lx\n", (unsigned long)vma->vm_flags);
+		err = -EPERM;
+		goto err0;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	err = vm_insert_page(vma, vma->vm_start, virt_to_page(self->clock_page));
+	if(err) {
+		pr_err("vm_insert_page() failed, err=%d\n", err);
+		goto err0;
+	}
+
+	return 0;
+
+err0:
+	return err;
+}
+
 int qvio_zdev_reset_mask(struct qvio_zdev* self, int reset_mask, unsigned int msecs) {
 	int err;
 	uintptr_t reg = (uintptr_t)self->reg;
@@ -213,3 +468,51 @@ int qvio_zdev_reset_mask(struct qvio_zdev* self, int reset_mask, unsigned int ms
 err0:
 	return err;
 }
+
+u32 qvio_zdev_ticks(struct qvio_zdev* self) {
+	uintptr_t reg = (uintptr_t)self->reg;
+
+	return io_read_reg(reg, 0x0C);
+}
+
+u32 qvio_zdev_value0(struct qvio_zdev* self) {
+	uintptr_t reg = (uintptr_t)self->reg;
+
+	return io_read_reg(reg, 0x14);
+}
+
+u64 qvio_zdev_ticks_extend(struct qvio_zdev* self, u32 ticks) {
+	struct qvio_ticks_clock clock;
+
+	__read_clock(self, &clock);
+
+	return __extend(&clock, ktime_get_ns(), ticks);
+}
+
+u64 qvio_zdev_ticks64(struct qvio_zdev* self) {
+	return qvio_zdev_ticks_extend(self, qvio_zdev_ticks(self));
+}
+
+int qvio_zdev_ticks_to_ns(struct qvio_zdev* self, u64 ticks, u64* ns) {
+	struct qvio_ticks_clock clock;
+
+	__read_clock(self, &clock);
+	if(! (clock.flags & QVIO_TICKS_CLOCK_VALID))
+		return -EAGAIN;
+
+	*ns = __ticks_to_ns(&clock, ticks);
+
+	return 0;
+}
+
+int qvio_zdev_ns_to_ticks(struct qvio_zdev* self, u64 ns, u64* ticks) {
+	struct qvio_ticks_clock clock;
+
+	__read_clock(self, &clock);
+	if(! (clock.flags & QVIO_TICKS_CLOCK_VALID))
+		return -EAGAIN;
+
+	*ticks = __ns_to_ticks(&clock, ns);
+
+	return 0;
+}
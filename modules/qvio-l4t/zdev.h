@@ -3,8 +3,13 @@
 
 #include <linux/platform_device.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 
 #include "cdev.h"
+#include "uapi/qvio-l4t.h"
+
+#define QVIO_ZDEV_CLOCK_WINDOW		16
 
 struct qvio_zdev {
 	struct kref ref;
@@ -15,6 +20,15 @@ struct qvio_zdev {
 
 	void __iomem * reg;
 	struct mutex mutex_reg;
+
+	// ticks clock, sampled by clock_work
+	seqlock_t clock_lock;
+	struct qvio_ticks_clock clock;
+	struct qvio_ticks_clock* clock_page; // mmap'ed by user space
+	struct delayed_work clock_work;
+	u64 win_ticks[QVIO_ZDEV_CLOCK_WINDOW]; // samples of the rate estimate
+	u64 win_ns[QVIO_ZDEV_CLOCK_WINDOW];
+	int win_count;
 };
 
 // register
@@ -33,10 +47,21 @@ void qvio_zdev_remove(struct qvio_zdev* self);
 // device attrs
 ssize_t qvio_zdev_attr_ver_show(struct qvio_zdev* self, char *buf);
 ssize_t qvio_zdev_attr_ticks_show(struct qvio_zdev* self, char *buf);
+ssize_t qvio_zdev_attr_clock_show(struct qvio_zdev* self, char *buf);
 ssize_t qvio_zdev_attr_value0_show(struct qvio_zdev* self, char *buf);
 ssize_t qvio_zdev_attr_value0_store(struct qvio_zdev* self, const char *buf, size_t count);
 
 // ioctl
 int qvio_zdev_reset_mask(struct qvio_zdev* self, int reset_mask, unsigned int msecs);
 
+// register reads, safe from IRQ context
+u32 qvio_zdev_ticks(struct qvio_zdev* self);
+u32 qvio_zdev_value0(struct qvio_zdev* self);
+
+// ticks clock, safe from IRQ context, -EAGAIN until the rate is known
+u64 qvio_zdev_ticks64(struct qvio_zdev* self);
+u64 qvio_zdev_ticks_extend(struct qvio_zdev* self, u32 ticks);
+int qvio_zdev_ticks_to_ns(struct qvio_zdev* self, u64 ticks, u64* ns);
+int qvio_zdev_ns_to_ticks(struct qvio_zdev* self, u64 ns, u64* ticks);
+
 #endif // __QVIO_ZDEV_H__
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -76,9 +77,11 @@ namespace __02_qdmabuf_ctl__ {
 				args.fd_flags = O_RDWR | O_CLOEXEC;
 				args.dma_dir = QDMABUF_DMA_DIR_BIDIRECTIONAL;
 				args.fd = 0;
-				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC, &args);
+				args.flags = 0;
+				args.numa_node = 0;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC_EXT, &args);
 				if(err < 0) {
-					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC) failed, err=%d", __FUNCTION__, __LINE__, err);
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC_EXT) failed, err=%d", __FUNCTION__, __LINE__, err);
 					break;
 				}
 
@@ -148,9 +151,11 @@ namespace __02_qdmabuf_ctl__ {
 				args.fd_flags = O_RDWR | O_CLOEXEC;
 				args.dma_dir = QDMABUF_DMA_DIR_BIDIRECTIONAL;
 				args.fd = 0;
-				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC, &args);
+				args.flags = 0;
+				args.numa_node = 0;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC_EXT, &args);
 				if(err < 0) {
-					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC) failed, err=%d", __FUNCTION__, __LINE__, err);
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC_EXT) failed, err=%d", __FUNCTION__, __LINE__, err);
 					break;
 				}
 
@@ -191,9 +196,11 @@ namespace __02_qdmabuf_ctl__ {
 				args.fd_flags = O_RDWR | O_CLOEXEC;
 				args.dma_dir = QDMABUF_DMA_DIR_BIDIRECTIONAL;
 				args.fd = 0;
-				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC, &args);
+				args.flags = 0;
+				args.numa_node = 0;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC_EXT, &args);
 				if(err < 0) {
-					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC) failed, err=%d", __FUNCTION__, __LINE__, err);
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC_EXT) failed, err=%d", __FUNCTION__, __LINE__, err);
 					break;
 				}
 
@@ -221,6 +228,33 @@ namespace __02_qdmabuf_ctl__ {
 			}
 			LOGD("-QDMABUF_IOCTL_INFO");
 
+			LOGD("+QDMABUF_IOCTL_QUERY_SEGS");
+			for(int i = 0;i < buffer_count;i++) {
+				const int max_segs = 16;
+				qdmabuf_seg segs[max_segs];
+				qdmabuf_query_segs_args args;
+				memset(&args, 0, sizeof(args));
+				args.fd = fd_dma_buf_vmalloc[i];
+				args.nsegs = max_segs;
+				args.segs = (__u64)(uintptr_t)segs;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_QUERY_SEGS, &args);
+				if(err) {
+					err = errno;
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_QUERY_SEGS) failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				LOGD("args={.size=%llu, .flags=0x%x, .nsegs=%u}", (unsigned long long)args.size, args.flags, args.nsegs);
+				for(int j = 0;j < (int)args.nsegs && j < max_segs;j++) {
+					LOGD("segs[%d]={.dma_addr=0x%llx, .len=%llu}", j,
+						(unsigned long long)segs[j].dma_addr, (unsigned long long)segs[j].len);
+				}
+			}
+			LOGD("-QDMABUF_IOCTL_QUERY_SEGS");
+
+			if(err)
+				break;
+
 			for(int i = 0;i < buffer_count;i++) {
 				int dma_buf_size = buf_size;
 
@@ -310,6 +344,69 @@ namespace __02_qdmabuf_ctl__ {
 #endif // BUILD_WITH_NVBUF
 #endif
 
+#if 1
+			{
+				int fd_memfd = memfd_create("02_qdmabuf-ctl", MFD_ALLOW_SEALING);
+				if(fd_memfd == -1) {
+					err = errno;
+					LOGE("%s(%d): memfd_create() failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+				oFreeStack += [fd_memfd]() {
+					close(fd_memfd);
+				};
+
+				err = ftruncate(fd_memfd, buf_size);
+				if(err) {
+					err = errno;
+					LOGE("%s(%d): ftruncate() failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				err = fcntl(fd_memfd, F_ADD_SEALS, F_SEAL_SHRINK);
+				if(err) {
+					err = errno;
+					LOGE("%s(%d): fcntl(F_ADD_SEALS) failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				qdmabuf_import_args args;
+				memset(&args, 0, sizeof(args));
+				args.addr = 0;
+				args.len = buf_size;
+				args.memfd = fd_memfd;
+				args.flags = QDMABUF_IMPORT_FLAG_MEMFD;
+				args.fd_flags = O_RDWR | O_CLOEXEC;
+				args.dma_dir = QDMABUF_DMA_DIR_BIDIRECTIONAL;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_IMPORT, &args);
+				if(err) {
+					err = errno;
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_IMPORT) failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				LOGD("memfd imported, args={.len=%d, .fd=%d}", (int)args.len, args.fd);
+
+				int fd_dma_buf = args.fd;
+				oFreeStack += [fd_dma_buf]() {
+					close(fd_dma_buf);
+				};
+
+				qdmabuf_query_segs_args segs_args;
+				memset(&segs_args, 0, sizeof(segs_args));
+				segs_args.fd = fd_dma_buf;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_QUERY_SEGS, &segs_args);
+				if(err) {
+					err = errno;
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_QUERY_SEGS) failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				LOGD("segs_args={.size=%llu, .flags=0x%x, .nsegs=%u}",
+					(unsigned long long)segs_args.size, segs_args.flags, segs_args.nsegs);
+			}
+#endif
+
 			ZzUtils::TestLoop([&](int ch) -> int {
 				return 0;
 			}, 1000000LL, 60LL);
@@ -78,6 +78,10 @@ namespace __11_tpg__ {
 						case '1':
 							OnTest1(now, "/dev/qtpg0");
 							break;
+
+						case '2':
+							OnTest2(now, "/dev/qtpg0");
+							break;
 						}
 					}
 
@@ -252,6 +256,117 @@ namespace __11_tpg__ {
 				}
 			}
 		}
+
+		// frames triggered by the driver
+		void OnTest2(int64_t now, const char* dev_name) {
+			int err;
+
+			switch(1) { case 1:
+				int fd_tpg = open(dev_name, O_RDWR);
+				if(fd_tpg == -1) {
+					err = errno;
+					LOGE("%s(%d): open() failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+				LOGD("open(\"%s\")=%d...\n", dev_name, fd_tpg);
+				ZzUtils::Scoped ZZ_GUARD_NAME([fd_tpg, dev_name]() {
+					LOGD("close(\"%s\")=%d...\n", dev_name, fd_tpg);
+					close(fd_tpg);
+				});
+
+				{
+					qvio_format args;
+					memset(&args, 0, sizeof(args));
+					args.fmt = nFmt;
+					args.width = nWidth;
+					args.height = nHeight;
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_S_FMT, &args);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_S_FMT) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+				}
+
+				{
+					qvio_tpg_rate args;
+					memset(&args, 0, sizeof(args));
+					args.num = oRateCtrl.num;
+					args.den = oRateCtrl.den;
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_S_RATE, &args);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_S_RATE) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+				}
+				ZzUtils::Scoped ZZ_GUARD_NAME([fd_tpg]() {
+					int err;
+					qvio_tpg_rate args;
+
+					memset(&args, 0, sizeof(args));
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_S_RATE, &args);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_S_RATE) failed, err=%d", __FUNCTION__, __LINE__, err);
+					}
+				});
+
+				{
+					qvio_tpg_config args;
+					memset(&args, 0, sizeof(args));
+					args.bypass = 0;
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_STREAMON, &args);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_STREAMON) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+				}
+				ZzUtils::Scoped ZZ_GUARD_NAME([fd_tpg]() {
+					int err;
+
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_STREAMOFF);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_STREAMOFF) failed, err=%d", __FUNCTION__, __LINE__, err);
+					}
+				});
+
+				int fd_stdin = 0; // stdin
+				while(true) {
+					fd_set readfds;
+					FD_ZERO(&readfds);
+					FD_SET(fd_stdin, &readfds);
+
+					timeval timeout = { 1, 0 };
+					err = select(fd_stdin + 1, &readfds, NULL, NULL, &timeout);
+					if (err < 0) {
+						LOGE("%s(%d): select() failed! err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					if (FD_ISSET(fd_stdin, &readfds)) {
+						int ch = getchar();
+
+						if(ch == 'q')
+							break;
+					}
+
+					qvio_tpg_stats args;
+					err = ioctl(fd_tpg, QVIO_IOC_TPG_G_STATS, &args);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QVIO_IOC_TPG_G_STATS) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					LOGD("TPG: triggers %llu, missed %llu, busy %llu, period %uns, max late %uns",
+						(unsigned long long)args.triggers, (unsigned long long)args.missed,
+						(unsigned long long)args.busy, args.period_ns, args.max_late_ns);
+				}
+			}
+		}
 	};
 }
 
@@ -0,0 +1,254 @@
+#include "ZzLog.h"
+#include "ZzUtils.h"
+#include "ZzClock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+
+#include "qdmabuf.h"
+
+ZZ_INIT_LOG("12_qdmabuf-fill")
+
+using namespace __zz_clock__;
+
+namespace __12_qdmabuf_fill__ {
+	struct App {
+		typedef App self_t;
+
+		int argc;
+		char **argv;
+
+		int nBufSize;
+		int nFrames;
+
+		App(int argc, char **argv) : argc(argc), argv(argv) {
+		}
+
+		~App() {
+		}
+
+		int Run() {
+			int err = 0;
+			ZzUtils::FreeStack oFreeStack;
+
+			nBufSize = 4096 * 2160 * 2;
+			nFrames = 120;
+
+			if(argc > 1)
+				nBufSize = atoi(argv[1]);
+			if(argc > 2)
+				nFrames = atoi(argv[2]);
+
+			switch(1) { case 1:
+				int fd_qdmabuf = open("/dev/qdmabuf0", O_RDWR);
+				if(fd_qdmabuf == -1) {
+					err = errno;
+					LOGE("%s(%d): open() failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+				oFreeStack += [fd_qdmabuf]() {
+					close(fd_qdmabuf);
+				};
+
+				const struct {
+					int type;
+					const char* name;
+				} types[] = {
+					{ QDMABUF_TYPE_DMA_CONTIG, "contig" },
+					{ QDMABUF_TYPE_DMA_SG, "dma-sg" },
+					{ QDMABUF_TYPE_VMALLOC, "vmalloc" },
+					{ QDMABUF_TYPE_CARVEOUT, "carveout" },
+				};
+
+				const struct {
+					int flags;
+					const char* name;
+				} modes[] = {
+					{ 0, "cached" },
+					{ QDMABUF_ALLOC_FLAG_WRITECOMBINE, "write-combine" },
+					{ QDMABUF_ALLOC_FLAG_UNCACHED, "uncached" },
+				};
+
+				LOGD("nBufSize=%d, nFrames=%d", nBufSize, nFrames);
+
+				for(int t = 0;t < sizeof(types) / sizeof(types[0]);t++) {
+					for(int m = 0;m < sizeof(modes) / sizeof(modes[0]);m++) {
+						err = OnFill(fd_qdmabuf, types[t].type, modes[m].flags, types[t].name, modes[m].name);
+						if(err)
+							break;
+					}
+
+					if(err)
+						break;
+				}
+			}
+
+			oFreeStack.Flush();
+
+			return err;
+		}
+
+		int OnFill(int fd_qdmabuf, int type, int flags, const char* type_name, const char* mode_name) {
+			int err = 0;
+			ZzUtils::FreeStack oFreeStack;
+
+			switch(1) { case 1:
+				qdmabuf_alloc_args args;
+				memset(&args, 0, sizeof(args));
+				args.len = nBufSize;
+				args.type = type;
+				args.fd_flags = O_RDWR | O_CLOEXEC;
+				args.dma_dir = QDMABUF_DMA_DIR_TO_DEVICE;
+				args.flags = flags;
+				err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_ALLOC_EXT, &args);
+				if(err < 0) {
+					err = errno;
+					// no carveout region, or a mode the type cannot honour
+					if(err == ENODEV || err == EINVAL) {
+						LOGW("%-8s %-14s not available", type_name, mode_name);
+						err = 0;
+						break;
+					}
+
+					LOGE("%s(%d): ioctl(QDMABUF_IOCTL_ALLOC_EXT) failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+
+				int fd_dma_buf = args.fd;
+				oFreeStack += [fd_dma_buf]() {
+					close(fd_dma_buf);
+				};
+
+				uint8_t* pBuf = (uint8_t*)mmap(NULL, nBufSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_dma_buf, 0);
+				if(pBuf == MAP_FAILED) {
+					err = errno;
+					LOGE("%s(%d): mmap() failed, err=%d", __FUNCTION__, __LINE__, err);
+					break;
+				}
+				oFreeStack += [&, pBuf]() {
+					munmap(pBuf, nBufSize);
+				};
+
+				int64_t nSyncTime = 0;
+				int64_t nFillTime = 0;
+				for(int i = 0;i < nFrames;i++) {
+					dma_buf_sync sync;
+					int64_t t0 = _clk();
+
+					sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+					err = ioctl(fd_dma_buf, DMA_BUF_IOCTL_SYNC, &sync);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(DMA_BUF_IOCTL_SYNC) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					int64_t t1 = _clk();
+
+					// sequential streaming write, as a frame producer would do
+					uint64_t* p = (uint64_t*)pBuf;
+					uint64_t v = 0x0101010101010101ULL * (uint8_t)i;
+					for(int j = 0;j < nBufSize / (int)sizeof(uint64_t);j++)
+						p[j] = v;
+
+					int64_t t2 = _clk();
+
+					sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+					err = ioctl(fd_dma_buf, DMA_BUF_IOCTL_SYNC, &sync);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(DMA_BUF_IOCTL_SYNC) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					int64_t t3 = _clk();
+
+					nSyncTime += (t1 - t0) + (t3 - t2);
+					nFillTime += (t2 - t1);
+				}
+
+				if(err)
+					break;
+
+				LOGI("%-8s %-14s fill %8.1f MB/s, sync %8.1f us/frame, total %8.1f us/frame",
+					type_name, mode_name,
+					nFillTime ? (double)nBufSize * nFrames / nFillTime : 0.0,
+					(double)nSyncTime / nFrames,
+					(double)(nSyncTime + nFillTime) / nFrames);
+
+				// touch a single line only, and sync just that range
+				const int nLineSize = 4096 * 2;
+				int64_t nRangeSyncTime = 0;
+				for(int i = 0;i < nFrames;i++) {
+					qdmabuf_sync_args sync;
+					memset(&sync, 0, sizeof(sync));
+					sync.fd = fd_dma_buf;
+					sync.offset = (int64_t)(i % (nBufSize / nLineSize)) * nLineSize;
+					sync.len = nLineSize;
+					int64_t t0 = _clk();
+
+					sync.flags = QDMABUF_SYNC_START | QDMABUF_SYNC_WRITE;
+					err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_SYNC, &sync);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QDMABUF_IOCTL_SYNC) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					int64_t t1 = _clk();
+
+					memset(pBuf + sync.offset, (uint8_t)i, nLineSize);
+
+					int64_t t2 = _clk();
+
+					sync.flags = QDMABUF_SYNC_END | QDMABUF_SYNC_WRITE;
+					err = ioctl(fd_qdmabuf, QDMABUF_IOCTL_SYNC, &sync);
+					if(err) {
+						err = errno;
+						LOGE("%s(%d): ioctl(QDMABUF_IOCTL_SYNC) failed, err=%d", __FUNCTION__, __LINE__, err);
+						break;
+					}
+
+					int64_t t3 = _clk();
+
+					nRangeSyncTime += (t1 - t0) + (t3 - t2);
+				}
+
+				if(err)
+					break;
+
+				LOGI("%-8s %-14s line sync %8.1f us/frame (%d bytes)",
+					type_name, mode_name, (double)nRangeSyncTime / nFrames, nLineSize);
+			}
+
+			oFreeStack.Flush();
+
+			return err;
+		}
+	};
+}
+
+using namespace __12_qdmabuf_fill__;
+
+int main(int argc, char *argv[]) {
+	LOGD("entering...");
+
+	int err;
+	{
+		App app(argc, argv);
+		err = app.Run();
+
+		LOGD("leaving...");
+	}
+
+	return err;
+}
@@ -14,6 +14,7 @@
 #define QDMABUF_TYPE_DMA_CONTIG		0x00
 #define QDMABUF_TYPE_DMA_SG			0x01
 #define QDMABUF_TYPE_VMALLOC		0x02
+#define QDMABUF_TYPE_CARVEOUT		0x03
 
 #define QDMABUF_VALID_FD_FLAGS 	(O_CLOEXEC | O_ACCMODE)
 
@@ -22,11 +23,39 @@
 #define QDMABUF_DMA_DIR_FROM_DEVICE		2
 #define QDMABUF_DMA_DIR_NONE			3
 
+/*
+ * CPU mapping attributes. QDMABUF_TYPE_DMA_CONTIG takes WRITECOMBINE only,
+ * QDMABUF_TYPE_DMA_SG and QDMABUF_TYPE_VMALLOC are always cached and take
+ * no flags. QDMABUF_TYPE_CARVEOUT is write-combined unless UNCACHED is
+ * given, or cached without flags when the reserved memory is ordinary RAM.
+ * Unsupported combinations fail with EINVAL.
+ */
+#define QDMABUF_ALLOC_FLAG_WRITECOMBINE	0x01
+#define QDMABUF_ALLOC_FLAG_UNCACHED		0x02
+
+#define QDMABUF_ALLOC_FLAGS_MASK		(QDMABUF_ALLOC_FLAG_WRITECOMBINE | QDMABUF_ALLOC_FLAG_UNCACHED)
+
+/* NUMA node of QDMABUF_TYPE_DMA_SG and QDMABUF_TYPE_VMALLOC pages */
+#define QDMABUF_NUMA_NODE(n)			((n) + 1)
+
+/**
+ * struct qdmabuf_alloc_args_v0 - QDMABUF_IOCTL_ALLOC layout, flags and
+ *                                numa_node are taken as 0
+ */
+struct qdmabuf_alloc_args_v0 {
+	__u64 len;
+	__u32 type;
+	__u32 fd_flags;
+	__u32 dma_dir;
+	__u32 fd;
+};
+
 /**
  * struct qdmabuf_alloc_args - metadata passed from userspace for
  *                                      allocations
  *
- * Provided by userspace as an argument to the ioctl
+ * Provided by userspace as an argument to QDMABUF_IOCTL_ALLOC_EXT, starts
+ * with struct qdmabuf_alloc_args_v0
  */
 struct qdmabuf_alloc_args {
 	__u64 len;
@@ -34,6 +63,8 @@ struct qdmabuf_alloc_args {
 	__u32 fd_flags;
 	__u32 dma_dir;
 	__u32 fd;
+	__u32 flags;
+	__u32 numa_node; // 0: device's node, QDMABUF_NUMA_NODE(n): node n
 };
 
 struct qdmabuf_info_args {
@@ -42,9 +73,84 @@ struct qdmabuf_info_args {
 	__u32 phy_addr;
 };
 
+#define QDMABUF_SEGS_FLAG_CONTIGUOUS	0x01
+
+/**
+ * struct qdmabuf_seg - one DMA segment of a buffer, as seen by the
+ *                      qdmabuf device
+ */
+struct qdmabuf_seg {
+	__u64 dma_addr;
+	__u64 len;
+};
+
+/**
+ * struct qdmabuf_query_segs_args - cached segment layout of a buffer
+ *
+ * Userspace fills fd, segs (pointer to an array of struct qdmabuf_seg,
+ * may be 0) and nsegs (capacity of that array). The driver returns the
+ * buffer size, flags and the total segment count in nsegs; at most the
+ * given capacity is copied to segs.
+ */
+struct qdmabuf_query_segs_args {
+	__u32 fd;
+	__u32 flags;
+	__u64 size;
+	__u32 nsegs;
+	__u32 reserved;
+	__u64 segs;
+};
+
+#define QDMABUF_SYNC_READ		(1 << 0)
+#define QDMABUF_SYNC_WRITE		(2 << 0)
+#define QDMABUF_SYNC_RW			(QDMABUF_SYNC_READ | QDMABUF_SYNC_WRITE)
+#define QDMABUF_SYNC_START		(0 << 2)
+#define QDMABUF_SYNC_END		(1 << 2)
+#define QDMABUF_SYNC_VALID_FLAGS_MASK \
+	(QDMABUF_SYNC_RW | QDMABUF_SYNC_END)
+
+/**
+ * struct qdmabuf_sync_args - CPU access synchronisation of a byte range
+ *
+ * Same flags as DMA_BUF_IOCTL_SYNC, limited to [offset, offset + len).
+ * A len of 0 extends the range to the end of the buffer.
+ */
+struct qdmabuf_sync_args {
+	__u32 fd;
+	__u32 flags;
+	__u64 offset;
+	__u64 len;
+};
+
+#define QDMABUF_IMPORT_FLAG_MEMFD	0x01
+
+/**
+ * struct qdmabuf_import_args - wrap user memory into a dma-buf
+ *
+ * Without QDMABUF_IMPORT_FLAG_MEMFD, addr is a page aligned address in
+ * the caller's address space and the pages are pinned long-term, charged
+ * against RLIMIT_MEMLOCK. With it, addr is a page aligned offset into the
+ * shmem backed memfd, which must be sealed with F_SEAL_SHRINK. len must be
+ * page aligned.
+ */
+struct qdmabuf_import_args {
+	__u64 addr;
+	__u64 len;
+	__u32 memfd;
+	__u32 flags;
+	__u32 fd_flags;
+	__u32 dma_dir;
+	__u32 fd;
+	__u32 reserved;
+};
+
 #define QDMABUF_IOC_MAGIC		'Q'
 
-#define QDMABUF_IOCTL_ALLOC		_IOWR(QDMABUF_IOC_MAGIC, 0x0, struct qdmabuf_alloc_args)
+#define QDMABUF_IOCTL_ALLOC		_IOWR(QDMABUF_IOC_MAGIC, 0x0, struct qdmabuf_alloc_args_v0)
 #define QDMABUF_IOCTL_INFO		_IOWR(QDMABUF_IOC_MAGIC, 0x1, struct qdmabuf_info_args)
+#define QDMABUF_IOCTL_QUERY_SEGS	_IOWR(QDMABUF_IOC_MAGIC, 0x2, struct qdmabuf_query_segs_args)
+#define QDMABUF_IOCTL_SYNC		_IOWR(QDMABUF_IOC_MAGIC, 0x3, struct qdmabuf_sync_args)
+#define QDMABUF_IOCTL_IMPORT		_IOWR(QDMABUF_IOC_MAGIC, 0x4, struct qdmabuf_import_args)
+#define QDMABUF_IOCTL_ALLOC_EXT		_IOWR(QDMABUF_IOC_MAGIC, 0x5, struct qdmabuf_alloc_args)
 
 #endif /* _UAPI_LINUX_QDMABUF_H */
@@ -25,9 +25,23 @@ enum qvio_umods_job_id {
 	QVIO_UMODS_JOB_ID_STOP_STREAMING,
 };
 
+/*
+ * Requests without QVIO_UMODS_REQ_FLAG_NO_RSP are waited on by the kernel
+ * until the response with the same sequence arrives; the daemon may answer
+ * them in any order. A negative u.*.flags in the response is returned as the
+ * errno of the V4L2 call. NO_RSP requests must not be answered.
+ *
+ * Waiting is opt-in: until the daemon enables the ring with
+ * QVID_IOC_S_UMODS_RING every request carries NO_RSP, and requests raised
+ * while no daemon holds the UMODS fd are dropped rather than queued.
+ */
+#define QVIO_UMODS_REQ_FLAG_NO_RSP	0x0001
+
 struct qvio_umods_req {
 	__u16 job_id; // qvio_umods_job_id
 	__u16 sequence;
+	__u16 flags; // QVIO_UMODS_REQ_FLAG_xxx
+	__u16 reserved;
 
 	union {
 		struct {
@@ -133,10 +147,97 @@ struct qvio_umods_rsp_req {
 	struct qvio_umods_req req;
 };
 
+/*
+ * UMODS_FD shared ring, enabled with QVID_IOC_S_UMODS_RING and mmap'ed from
+ * offset 0 of the UMODS_FD:
+ *
+ *   [qvio_umods_ring_hdr][req slots @ req_offset][rsp slots @ rsp_offset]
+ *
+ * Indices are free running, slot = index & (nslots - 1). The kernel produces
+ * requests at req_head and the daemon consumes them at req_tail; the daemon
+ * produces responses at rsp_head and the kernel consumes them at rsp_tail.
+ * Publish an index with a release store after the slot is written, and read
+ * the peer's index with an acquire load.
+ *
+ * New requests are signalled through poll() on the UMODS_FD and the
+ * optional eventfd. QVID_IOC_UMODS_RING_KICK hands the posted responses to
+ * the kernel and refills request slots that were held back while full.
+ * Disabling the ring takes its posted responses, and requests still in
+ * their slots are handed out by QVID_IOC_G_UMODS_REQ again, so stop
+ * consuming the ring before disabling it.
+ * Ask for the UMODS_FD with O_RDWR to map the ring writable.
+ */
+#define QVIO_UMODS_RING_SLOTS		64
+
+struct qvio_umods_ring_hdr {
+	__u32 nslots;
+	__u32 req_offset;
+	__u32 rsp_offset;
+	__u32 size;
+
+	__u32 req_head;
+	__u32 req_tail;
+	__u32 rsp_head;
+	__u32 rsp_tail;
+
+	__u32 req_overflows; // requests held back in the kernel while the ring was full
+	__u32 rsp_unmatched; // responses without a waiting request
+	__u32 reserved[6];
+};
+
+struct qvio_umods_ring {
+	__u32 enable;
+	__s32 eventfd; // -1: poll() only
+
+	__u32 nslots; // out
+	__u32 size; // out, mmap length
+};
+
 struct qvio_g_ticks {
 	__u32 ticks;
 };
 
+/*
+ * zdev ticks clock: the free running 32-bit ticks counter extended to 64 bits
+ * and correlated with CLOCK_MONOTONIC by periodic samples of the driver. Get
+ * it with QVIO_IOC_G_CLOCK, or mmap() one page read-only at offset 0 of the
+ * qenv node and copy it out without syscalls:
+ *
+ *   do {
+ *     seq = clock->seq; // acquire
+ *     copy = *clock;
+ *   } while((seq & 1) || seq != clock->seq); // read barrier before the reload
+ *
+ * The conversions, on 96-bit intermediates as mul_u64_u32_shr() of the kernel:
+ *
+ *   ns = base_ns + (((__s64)(ticks - base_ticks) * mult) >> shift)
+ *   ticks = base_ticks + (((__s64)(ns - base_ns) * inv_mult) >> inv_shift)
+ *
+ * and a raw counter value, e.g. from QVIO_IOC_G_TICKS or qvio_frame_meta, is
+ * extended with base_ticks + (__s32)(raw - (__u32)base_ticks). They hold once
+ * QVIO_TICKS_CLOCK_VALID is set, near base_ns, which is refreshed every
+ * sample period.
+ */
+#define QVIO_TICKS_CLOCK_VALID	0x0001
+
+struct qvio_ticks_clock {
+	__u32 seq; // odd while being updated
+	__u32 flags; // QVIO_TICKS_CLOCK_xxx
+
+	__u64 base_ticks; // extended ticks of the last sample
+	__u64 base_ns; // ns, CLOCK_MONOTONIC of the last sample
+	__u32 mult; // ns per tick << shift
+	__u32 shift;
+	__u32 inv_mult; // ticks per ns << inv_shift
+	__u32 inv_shift;
+
+	__u32 freq_hz; // estimated rate of the counter
+	__s32 error_ns; // last sample against the previous estimate
+	__u32 rtt_ns; // register read round trip of the last sample
+	__u32 samples; // since probe
+	__u32 reserved[6];
+};
+
 struct qvio_format {
 	__u32 width;
 	__u32 height;
@@ -184,10 +285,36 @@ struct qvio_buffer {
 	__u32 stride[4];
 };
 
+/*
+ * QBUF with a presentation time, for the read (playback) engines: the
+ * transfer of the buffer starts at pts instead of as soon as the previous
+ * one completes. A pts in the past starts at once. TICKS fails with
+ * EOPNOTSUPP on a device without a ticks clock, and EAGAIN until its rate
+ * is known.
+ */
+enum qvio_pts_clock {
+	QVIO_PTS_CLOCK_MONOTONIC = 1, // ns of CLOCK_MONOTONIC
+	QVIO_PTS_CLOCK_TICKS, // zdev ticks clock (qvio_ticks_clock), raw 32-bit values are extended around now
+};
+
+struct qvio_timed_buffer {
+	struct qvio_buffer buf;
+
+	__u64 pts;
+	__u32 clock; // ref to qvio_pts_clock
+	__u32 reserved;
+};
+
+#define QVIO_NUMA_NODE(n)	((n) + 1)
+
+// or'ed into qvio_req_bufs.buf_type, numa_node is ignored without it
+#define QVIO_REQ_BUFS_FLAG_NUMA_NODE	0x8000
+
 struct qvio_req_bufs {
 	__u32 count;
 
-	__u16 buf_type; // ref to qvio_buf_type
+	__u16 buf_type; // ref to qvio_buf_type, plus QVIO_REQ_BUFS_FLAG_*
+	__u16 numa_node; // 0: device's node, QVIO_NUMA_NODE(n): node n
 
 	__u32 offset[4];
 	__u32 stride[4];
@@ -197,6 +324,50 @@ struct qvio_tpg_config {
 	__u16 bypass;
 };
 
+/*
+ * TPG frames triggered by the driver from a hrtimer in non-bypass mode, in
+ * place of QVIO_IOC_TPG_TRIGGER: num/den frames per second, or a period of
+ * zdev ticks (qvio_ticks_clock), all 0 for manual triggers. It takes effect
+ * at once while streaming, and the stats restart.
+ */
+struct qvio_tpg_rate {
+	__u32 num;
+	__u32 den;
+	__u32 period_ticks; // in place of num/den when not 0
+	__u32 reserved;
+};
+
+struct qvio_tpg_stats {
+	__u64 triggers; // frames started by the timer
+	__u64 missed; // deadlines without a frame started
+	__u64 busy; // of missed, the core was still busy with the previous frame
+	__u32 period_ns; // 0: manual triggers
+	__u32 max_late_ns; // of the timer expiries
+};
+
+/*
+ * Per-frame metadata of the qdma_wr capture nodes, one struct per buffer of
+ * the companion "<node>-meta" V4L2_BUF_TYPE_META_CAPTURE node. sequence and
+ * timestamp equal those of the image buffer of the same frame.
+ */
+#define QVIO_META_FMT_FRAME		v4l2_fourcc('Q', 'V', 'M', 'F')
+
+#define QVIO_FRAME_META_FLAG_STARVED	0x0001 // no buffer queued at completion, engine idled
+
+struct qvio_frame_meta {
+	__u32 sequence;
+	__u32 flags; // QVIO_FRAME_META_FLAG_xxx
+	__u64 timestamp; // ns, CLOCK_MONOTONIC at completion
+	__u64 start_ns; // ns, CLOCK_MONOTONIC at ap_start
+	__u32 dma_ns; // timestamp - start_ns
+	__u32 ticks; // zdev ticks counter at completion
+	__u32 value0; // zdev value0 register at completion
+	__u32 bytes; // bytesused of the image buffer
+	__u32 starved; // completions with an empty job list since streamon
+	__u32 meta_drops; // frames without a queued meta buffer since streamon
+	__u32 reserved[4];
+};
+
 #define QVIO_IOC_MAGIC		'Q'
 
 // qvio v4l2 ioctls
@@ -207,6 +378,8 @@ struct qvio_tpg_config {
 // UMODS_FD ioctls
 #define QVID_IOC_G_UMODS_REQ		_IOWR(QVIO_IOC_MAGIC, 1, struct qvio_umods_req)
 #define QVID_IOC_S_UMODS_RSP		_IOWR(QVIO_IOC_MAGIC, 2, struct qvio_umods_rsp)
+#define QVID_IOC_S_UMODS_RING		_IOWR(QVIO_IOC_MAGIC, 3, struct qvio_umods_ring)
+#define QVID_IOC_UMODS_RING_KICK	_IO  (QVIO_IOC_MAGIC, 4)
 
 // qvio ioctls
 #define QVIO_IOC_G_TICKS		_IOR (QVIO_IOC_MAGIC, 0x1, struct qvio_g_ticks)
@@ -225,5 +398,10 @@ struct qvio_tpg_config {
 #define QVIO_IOC_TPG_STREAMON	_IOW (QVIO_IOC_MAGIC, 0xB, struct qvio_tpg_config)
 #define QVIO_IOC_TPG_STREAMOFF	_IO  (QVIO_IOC_MAGIC, 0xC)
 #define QVIO_IOC_TPG_TRIGGER	_IO  (QVIO_IOC_MAGIC, 0xD)
+#define QVIO_IOC_QBUF_TIMED		_IOWR(QVIO_IOC_MAGIC, 0xE, struct qvio_timed_buffer)
+#define QVIO_IOC_G_CLOCK		_IOR (QVIO_IOC_MAGIC, 0xF, struct qvio_ticks_clock)
+#define QVIO_IOC_TPG_S_RATE		_IOW (QVIO_IOC_MAGIC, 0x10, struct qvio_tpg_rate)
+#define QVIO_IOC_TPG_G_STATS	_IOR (QVIO_IOC_MAGIC, 0x11, struct qvio_tpg_stats)
+#define QVIO_IOC_TPG_G_RATE		_IOR (QVIO_IOC_MAGIC, 0x12, struct qvio_tpg_rate)
 
 #endif /* _UAPI_LINUX_QVIO_L4T_H */